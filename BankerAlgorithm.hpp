@@ -6,143 +6,556 @@
 #include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <span>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory_resource>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "ResourceKernels.hpp"
+#include "WorkListSafety.hpp"
+#include "ParallelSafety.hpp"
+#include "Stats.hpp"
+#include "SafetyReport.hpp"
 
 #define RETURN_UNSAFE_SEQUENCES false
 
 using std::vector, std::string;
 
+// Algorithm used to search for a safe sequence
+enum class SafetyEngine {
+    // Repeated FIFO passes over every unfinished process
+    SCAN,
+    // Per resource work lists that only revisit processes a release could unblock, see WorkListSafety.hpp
+    WORK_LIST,
+    // FIFO passes with each pass split across a thread pool, see ParallelSafety.hpp
+    // Snapshots smaller than PARALLEL_SAFETY_THRESHOLD elements use SCAN instead
+    PARALLEL,
+    // Work lists on compressed sparse rows, see SparseSafety.hpp. BasicBankerAlgorithm holds dense matrices and runs
+    // WORK_LIST in its place.
+    SPARSE
+};
+
+// Error of a snapshot in which a process holds more units of a resource type than its maximum claim
+// Every engine that checks allocations against maximums throws this one, so all modes report a bad snapshot alike
+template <typename T>
+std::runtime_error allocationExceedsMaximum(size_t row, size_t col, T maximum, T allocation) {
+    return std::runtime_error(
+        "Invalid Program Snapshot, at row " + std::to_string(row) + " col " + std::to_string(col) +
+        ", the value of maxMatrix (" + std::to_string(maximum) +
+        ") is less than the value of allocationMatrix (" + std::to_string(allocation) + ")");
+}
+
 // Encapsulates the functionality of Banker's Algorithm
 // This object is designed to take information extracted from the text file by the Program Snashot Reader
 // Then, it performs Banker's Algorithm to find a safe sequence
-class BankerAlgorithm {
+// T is the unsigned type of a resource count, see BasicResourceMatrix. Sums of released resources are checked, and a safety
+// check throws std::overflow_error rather than continue with a wrapped available vector.
+template <typename T>
+class BasicBankerAlgorithm {
     public:
         // Construct Banker Algorithm, assigning the supplied availableVector, maxMatrix, and allocationMatrix
-        BankerAlgorithm(vector<size_t> availableVector, vector<vector<size_t>> maxMatrix, vector<vector<size_t>> allocationMatrix) :
-                        availableVector(availableVector), maxMatrix(maxMatrix), allocationMatrix(allocationMatrix){
+        // Both constructors allocate the object's own datastructures from resource, such as a SnapshotArena, or from the
+        // global allocator when it is null. The resource must outlive the object.
+        BasicBankerAlgorithm(std::span<const T> availableVector, BasicResourceMatrix<T> maxMatrix, BasicResourceMatrix<T> allocationMatrix,
+                             std::pmr::memory_resource* resource = nullptr) :
+                             availableVector(resource), maxStorage(std::move(maxMatrix)), allocationStorage(std::move(allocationMatrix)),
+                             maxMatrix(maxStorage), allocationMatrix(allocationStorage), needMatrix(resource), scratchAvailable(resource),
+                             finished(resourceOrDefault(resource)), finishedPerRound(resourceOrDefault(resource)),
+                             kernels(BasicResourceKernels<T>::best()){
+            initialize(availableVector);
+        }
 
-            numProcesses = maxMatrix.size();
-            numResources = maxMatrix[0].size();
+        // Construct Banker Algorithm on matrices owned elsewhere, such as a memory-mapped binary snapshot, without copying them
+        // The matrices must stay alive while the object is used
+        BasicBankerAlgorithm(std::span<const T> availableVector, BasicResourceMatrixView<T> maxMatrix, BasicResourceMatrixView<T> allocationMatrix,
+                             std::pmr::memory_resource* resource = nullptr) :
+                             availableVector(resource), maxMatrix(maxMatrix), allocationMatrix(allocationMatrix), needMatrix(resource),
+                             scratchAvailable(resource), finished(resourceOrDefault(resource)), finishedPerRound(resourceOrDefault(resource)),
+                             kernels(BasicResourceKernels<T>::best()){
+            initialize(availableVector);
+        }
 
-            // Resize the needMatrix to the same length and width as the maxMatrix
-            needMatrix = vector<vector<size_t>>(numProcesses, vector<size_t>(numResources));
+        // The matrix views may point into the object's own storage, which a copy would not update
+        BasicBankerAlgorithm(const BasicBankerAlgorithm&) = delete;
+        BasicBankerAlgorithm& operator=(const BasicBankerAlgorithm&) = delete;
 
-            // Calculate need matrix from the maxMatrix - allocationMatrix
-            calculateNeedMatrix();
+        // Replace the comparison kernels picked by CPU feature detection, for example with the scalar reference kernels
+        void useKernels(const BasicResourceKernels<T>& kernels) {
+            this->kernels = kernels;
         }
 
-        vector<size_t> findSafeSequence() {
-            // Backup availableVector before algorithm is applied
-            const auto availableVectorCopy = availableVector;
+        // Find a safe sequence with the chosen engine
+        // The work list engine returns the same sequence as the scan when order is SequenceOrder::FIFO
+        vector<size_t> findSafeSequence(SafetyEngine engine, SequenceOrder order = SequenceOrder::FIFO) {
+            StatTimer timer(Stat::SAFETY_NANOSECONDS);
+            Stats::process().add(Stat::SAFETY_CHECKS, 1);
+            engine = resolveEngine(engine);
 
-            // Fake boolean used for an int-based boolean vector
-            enum BOOL {
-                FALSE,
-                TRUE
-            };
+            if (engine == SafetyEngine::SCAN) {
+                return findSafeSequence();
+            }
 
+            vector<size_t> safeSequence;
+            bool finishedAll;
+            if (engine == SafetyEngine::PARALLEL) {
+                BasicParallelSafety<T> parallel(availableVector, needMatrix, allocationMatrix, kernels, pool != nullptr ? *pool : ThreadPool::shared());
+                safeSequence = parallel.findSafeSequence(order);
+                finishedAll = parallel.allFinished();
+            } else {
+                BasicWorkListSafety<T> workList(availableVector, needMatrix, allocationMatrix, kernels);
+                safeSequence = workList.findSafeSequence(order);
+                finishedAll = workList.allFinished();
+            }
+            Stats::process().add(Stat::PROCESSES_FINISHED, safeSequence.size());
+
+            // If there are still processes that did not complete, there is a deadlock
+            if (!finishedAll && !RETURN_UNSAFE_SEQUENCES) {
+                return vector<size_t>();
+            }
+            return safeSequence;
+        }
+
+        // Check safety with the chosen engine and, when the state is unsafe, diagnose the deadlock
+        // The diagnosis is read from the state the scan stops in, so the scan engine costs no extra pass. The other engines
+        // stop in the same state, as every engine finishes every process it can, but are followed by a scan when unsafe.
+        SafetyReport checkSafety(SafetyEngine engine, SequenceOrder order = SequenceOrder::FIFO) {
+            SafetyReport report;
+            if (resolveEngine(engine) != SafetyEngine::SCAN) {
+                report.sequence = findSafeSequence(engine, order);
+                report.safe = report.sequence.size() == numProcesses;
+                if (report.safe) {
+                    return report;
+                }
+            }
+
+            {
+                StatTimer timer(Stat::SAFETY_NANOSECONDS);
+                Stats::process().add(Stat::SAFETY_CHECKS, 1);
+                report.sequence.clear();
+                report.safe = scanSafeSequence(report.sequence);
+            }
+            if (!report.safe) {
+                diagnoseDeadlock(report);
+            }
+            return report;
+        }
+
+        // Run the parallel engine on the given pool instead of the shared one
+        void useThreadPool(ThreadPool& pool) {
+            this->pool = &pool;
+        }
+
+        // Runs on scratch copies of availableVector and the finished flags that the object keeps between calls,
+        // so checking the same snapshot again allocates nothing but the returned sequence
+        vector<size_t> findSafeSequence() {
             // Vector that keeps track of a safe sequence
             vector<size_t> safeSequence;
 
+            // If there are still processes that did not complete, there is a deadlock
+            // Return empty vector
+            if (!scanSafeSequence(safeSequence) && !RETURN_UNSAFE_SEQUENCES) {
+                return vector<size_t>();
+            }
+
+            // If all processes are complete at the end of the algorithm, the Program Snapshot is safe
+            // Return safe sequence
+            return safeSequence;
+        }
+
+        // findSafeSequence into a sequence owned by the caller, such as a std::pmr::vector on the same arena as the object,
+        // so a check makes no call to the global allocator at all. Returns true if the state is safe.
+        // safeSequence is cleared first, and holds the processes finished before the deadlock when the state is unsafe.
+        template <typename Sequence>
+        bool findSafeSequenceInto(Sequence& safeSequence) {
+            StatTimer timer(Stat::SAFETY_NANOSECONDS);
+            Stats::process().add(Stat::SAFETY_CHECKS, 1);
+            safeSequence.clear();
+            return scanSafeSequence(safeSequence);
+        }
+
+        // Largest request of each resource type each process can be granted on its own while the state stays safe
+        // Row i col j is the largest x such that granting process i a request of x units of resource j, and nothing else,
+        // leaves a safe state. Every entry is zero when the current state is already unsafe.
+        //
+        // Granting x units to process p at position k of a safe sequence moves x units from available to p, which only
+        // matters to the processes before p in the sequence: p needs x units less, and releases them again when it finishes.
+        // So x is safe without any probe while every earlier process had x units of slack in resource j, and the bounds are
+        // first set from the minimum slack of each prefix. The remaining entries are binary searched, each probe starting
+        // from the longest prefix of the sequence that still runs rather than from the initial state. Processes are split
+        // across the pool set by useThreadPool, or ThreadPool::shared().
+        BasicResourceMatrix<T> maximumGrantableRequests() {
+            BasicResourceMatrix<T> grantable(numProcesses, numResources);
+            const vector<size_t> safeSequence = findSafeSequence();
+            if (safeSequence.size() != numProcesses) {
+                return grantable;
+            }
+
+            // Available resources just before each position of the safe sequence runs
+            const size_t stride = needMatrix.stride();
+            BasicResourceMatrix<T> availableAt(numProcesses, numResources);
+            vector<size_t> positionOf(numProcesses);
+            AlignedVector<T> running(availableVector);
+            AlignedVector<T> prefixSlack(stride, std::numeric_limits<T>::max());
+            for (size_t k = 0; k < numProcesses; k++) {
+                const size_t process = safeSequence[k];
+                positionOf[process] = k;
+                std::copy(running.begin(), running.begin() + numResources, availableAt.row(k).begin());
+                for (size_t j = 0; j < numResources; j++) {
+                    grantable(process, j) = std::min({needMatrix(process, j), availableVector[j], prefixSlack[j]});
+                    prefixSlack[j] = std::min<T>(prefixSlack[j], running[j] - needMatrix(process, j));
+                }
+                // The sums were already checked by the scan above
+                kernels.addInto(running.data(), allocationMatrix.paddedRow(process).data(), stride);
+            }
+
+            std::atomic<size_t> probes = 0;
+            auto searchProcesses = [&](size_t begin, size_t end) {
+                GrantProbe probe(*this, safeSequence, availableAt);
+                size_t localProbes = 0;
+                for (size_t process = begin; process < end; process++) {
+                    for (size_t j = 0; j < numResources; j++) {
+                        // Invariant: low units are safe to grant, more than high are not
+                        T low = grantable(process, j);
+                        T high = std::min(needMatrix(process, j), availableVector[j]);
+                        while (low < high) {
+                            const T middle = low + (high - low + 1) / 2;
+                            localProbes++;
+                            if (probe.isSafe(process, positionOf[process], j, middle)) {
+                                low = middle;
+                            } else {
+                                high = middle - 1;
+                            }
+                        }
+                        grantable(process, j) = low;
+                    }
+                }
+                probes += localProbes;
+            };
+            // Four chunks per thread keep the threads balanced when some processes take many more probes than others,
+            // while each chunk still builds one GrantProbe for all of its processes
+            ThreadPool& searchPool = pool != nullptr ? *pool : ThreadPool::shared();
+            searchPool.parallelFor(0, numProcesses, numProcesses / (searchPool.size() * 4), searchProcesses);
+            Stats::process().add(Stat::SAFETY_CHECKS, probes);
+
+            return grantable;
+        }
+
+    private:
+        // Fake boolean used for an int-based boolean vector
+        enum BOOL {
+            FALSE,
+            TRUE
+        };
+
+        // Safety check of the state after one hypothetical grant, with scratch buffers reused by every probe of a chunk of processes
+        class GrantProbe {
+            public:
+                GrantProbe(const BasicBankerAlgorithm& bankers, const vector<size_t>& safeSequence, const BasicResourceMatrix<T>& availableAt) :
+                           bankers(bankers), safeSequence(safeSequence), availableAt(availableAt),
+                           available(bankers.needMatrix.stride()), need(bankers.needMatrix.stride()), allocation(bankers.needMatrix.stride()),
+                           finished(bankers.numProcesses) {}
+
+                // Whether granting amount units of resource to the process at position of the safe sequence leaves a safe state
+                bool isSafe(size_t process, size_t position, size_t resource, T amount) {
+                    // The sequence still runs up to the first process before position that lacks the slack for the grant
+                    size_t start = 0;
+                    while (start < position && availableAt(start, resource) - bankers.needMatrix(safeSequence[start], resource) >= amount) {
+                        start++;
+                    }
+
+                    const size_t stride = available.size();
+                    std::copy(availableAt.paddedRow(start).begin(), availableAt.paddedRow(start).end(), available.begin());
+                    available[resource] -= amount;
+                    std::copy(bankers.needMatrix.paddedRow(process).begin(), bankers.needMatrix.paddedRow(process).end(), need.begin());
+                    need[resource] -= amount;
+                    std::copy(bankers.allocationMatrix.paddedRow(process).begin(), bankers.allocationMatrix.paddedRow(process).end(), allocation.begin());
+                    allocation[resource] += amount;
+
+                    std::fill(finished.begin(), finished.end(), FALSE);
+                    for (size_t k = 0; k < start; k++) {
+                        finished[safeSequence[k]] = TRUE;
+                    }
+
+                    // Same FIFO passes as findSafeSequence, with the granting process reading its edited rows
+                    // Moving units from available to an allocation keeps every total, so the sums cannot overflow here
+                    size_t numFinished = start;
+                    bool progress = true;
+                    while (progress) {
+                        progress = false;
+                        for (size_t i = 0; i < bankers.numProcesses; i++) {
+                            if (finished[i] == TRUE) {
+                                continue;
+                            }
+                            const T* needRow = (i == process) ? need.data() : bankers.needMatrix.paddedRow(i).data();
+                            if (bankers.kernels.lessEqual(needRow, available.data(), stride)) {
+                                const T* allocationRow = (i == process) ? allocation.data() : bankers.allocationMatrix.paddedRow(i).data();
+                                bankers.kernels.addInto(available.data(), allocationRow, stride);
+                                finished[i] = TRUE;
+                                numFinished++;
+                                progress = true;
+                            }
+                        }
+                    }
+                    return numFinished == bankers.numProcesses;
+                }
+
+            private:
+                const BasicBankerAlgorithm& bankers;
+                const vector<size_t>& safeSequence;
+                const BasicResourceMatrix<T>& availableAt;
+                AlignedVector<T> available;
+                AlignedVector<T> need;
+                AlignedVector<T> allocation;
+                vector<BOOL> finished;
+        };
+
+        // Engine that actually runs, the parallel engine falls back to the scan below PARALLEL_SAFETY_THRESHOLD elements
+        SafetyEngine resolveEngine(SafetyEngine engine) const {
+            if (engine == SafetyEngine::SPARSE) {
+                return SafetyEngine::WORK_LIST;
+            }
+            if (engine == SafetyEngine::PARALLEL && numProcesses * numResources < PARALLEL_SAFETY_THRESHOLD) {
+                return SafetyEngine::SCAN;
+            }
+            return engine;
+        }
+
+        // FIFO scan behind findSafeSequence, appending every process it finishes to safeSequence
+        // Returns whether every process finished. scratchAvailable and finished are left in the state the scan stopped in.
+        template <typename Sequence>
+        bool scanSafeSequence(Sequence& safeSequence) {
+            // Work on a copy of availableVector, so it needs no restoring afterwards
+            scratchAvailable.assign(availableVector.begin(), availableVector.end());
+            safeSequence.reserve(numProcesses);
+
             // Vector that keeps track of which processes are finished
-            vector<BOOL> finished(numProcesses, FALSE);
+            finished.assign(numProcesses, FALSE);
 
             // Keep track of the number of processes finished in each cycle
             size_t changeInFinishedProcesses = 1;
 
+            // Counted for Stats
+            finishedPerRound.clear();
+            size_t rounds = 0;
+            size_t comparisons = 0;
+            if (ENABLE_STATS) {
+                finishedPerRound.reserve(std::min<size_t>(numProcesses + 1, STATS_MAX_ROUNDS));
+            }
+
             // Start the algorithm
             while (changeInFinishedProcesses > 0) {
                 // At the start of each cycle, the change of finished processes is zero
                 changeInFinishedProcesses = 0;
 
                 // Iterate through each process FIFO
-                for (auto i = 0; i < numProcesses; i++) {
+                for (size_t i = 0; i < numProcesses; i++) {
                     if (finished[i] == FALSE) {
-                        if (compareVector(needMatrix[i], availableVector)) {
+                        comparisons++;
+                        if (compareVector(needMatrix.paddedRow(i), scratchAvailable)) {
                             finished[i] = TRUE;
                             safeSequence.push_back(i);
                             changeInFinishedProcesses++;
 
                             // Free the resources no longer used by the process that just finished
                             // This is represented by adding the allocated resources of the freed process to the available resources
-                            freeResources(allocationMatrix[i]);
+                            if (!freeResources(allocationMatrix.paddedRow(i))) {
+                                throw std::overflow_error("Available resources overflowed when process " + std::to_string(i) + " released its allocation");
+                            }
                         }
                     }
                 }
+                if (ENABLE_STATS && rounds < STATS_MAX_ROUNDS) {
+                    finishedPerRound.push_back(changeInFinishedProcesses);
+                }
+                rounds++;
             }
 
-            // Restore availableVector from before algorithm
-            availableVector = availableVectorCopy;
+            Stats::process().add(Stat::SAFETY_ROUNDS, rounds);
+            Stats::process().add(Stat::VECTOR_COMPARISONS, comparisons);
+            Stats::process().add(Stat::PROCESSES_FINISHED, safeSequence.size());
+            Stats::process().recordRounds(finishedPerRound);
 
-            // If there are still processes that did not complete, there is a deadlock
-            // Return empty vector
-            for (auto status: finished) {
-                if (status == FALSE) {
-                    if (RETURN_UNSAFE_SEQUENCES) {
-                        return safeSequence;
+            return safeSequence.size() == numProcesses;
+        }
+
+        // Fill in the blocked processes of an unsafe report and rank their preemption, after scanSafeSequence stopped
+        // Preempting a process is simulated by releasing its allocation into the final available vector and finishing
+        // every other blocked process that then can, which costs a scan over the blocked processes per candidate
+        void diagnoseDeadlock(SafetyReport& report) const {
+            vector<size_t> blocked;
+            for (size_t i = 0; i < numProcesses; i++) {
+                if (finished[i] == FALSE) {
+                    blocked.push_back(i);
+                }
+            }
+
+            for (auto process: blocked) {
+                BlockedProcess entry{process, {}};
+                for (size_t j = 0; j < numResources; j++) {
+                    if (needMatrix(process, j) > scratchAvailable[j]) {
+                        entry.shortfall.push_back({j, static_cast<size_t>(needMatrix(process, j) - scratchAvailable[j])});
                     }
-                    return vector<size_t>();
                 }
+                report.blocked.push_back(std::move(entry));
             }
 
-            // If all processes are complete at the end of the algorithm, the Program Snapshot is safe
-            // Return safe sequence
-            return safeSequence;
+            AlignedVector<T> work(scratchAvailable.size());
+            vector<BOOL> done(blocked.size());
+            for (size_t b = 0; b < blocked.size(); b++) {
+                std::copy(scratchAvailable.begin(), scratchAvailable.end(), work.begin());
+                if (!kernels.addInto(work.data(), allocationMatrix.paddedRow(blocked[b]).data(), work.size())) {
+                    throw std::overflow_error("Available resources overflowed when process " + std::to_string(blocked[b]) + " was preempted");
+                }
+                std::fill(done.begin(), done.end(), FALSE);
+                done[b] = TRUE;
+
+                size_t unblocked = 0;
+                bool progress = true;
+                while (progress) {
+                    progress = false;
+                    for (size_t k = 0; k < blocked.size(); k++) {
+                        if (done[k] == FALSE && kernels.lessEqual(needMatrix.paddedRow(blocked[k]).data(), work.data(), work.size())) {
+                            if (!kernels.addInto(work.data(), allocationMatrix.paddedRow(blocked[k]).data(), work.size())) {
+                                throw std::overflow_error("Available resources overflowed when process " + std::to_string(blocked[k]) + " released its allocation");
+                            }
+                            done[k] = TRUE;
+                            unblocked++;
+                            progress = true;
+                        }
+                    }
+                }
+                if (unblocked > 0) {
+                    report.preemption.push_back({blocked[b], unblocked});
+                }
+            }
+            std::stable_sort(report.preemption.begin(), report.preemption.end(), [](const PreemptionCandidate& lhs, const PreemptionCandidate& rhs) {
+                return lhs.unblocked > rhs.unblocked;
+            });
+        }
+
+        // Checks the dimensions of the snapshot, then prepares availableVector and needMatrix
+        void initialize(std::span<const T> availableVector) {
+            numProcesses = maxMatrix.rows();
+            numResources = maxMatrix.cols();
+
+            // Sizes are checked once here so the comparison kernels in the safety scan do not need to check them on every call
+            if (allocationMatrix.rows() != numProcesses || allocationMatrix.cols() != numResources || availableVector.size() != numResources ||
+                allocationMatrix.stride() != maxMatrix.stride()) {
+                throw std::runtime_error("Available Vector, Maximum Matrix and Allocation Matrix dimensions do not match.");
+            }
+
+            // Store availableVector padded like the matrix rows, so the kernels can run across a whole padded row
+            this->availableVector.assign(maxMatrix.stride(), 0);
+            std::copy(availableVector.begin(), availableVector.end(), this->availableVector.begin());
+
+            // Resize the needMatrix to the same length and width as the maxMatrix
+            needMatrix = BasicResourceMatrix<T>(numProcesses, numResources, needMatrix.memoryResource());
+
+            // Calculate need matrix from the maxMatrix - allocationMatrix
+            calculateNeedMatrix();
         }
 
-    private:
         // Need Matrix is calculated by finding the difference of each element of the same position in the
         // Max Matrix and Allocation Matrix (ie. maxMatrix(i, j) - allocationMatrix(i, j) for all i, j in range)
         void calculateNeedMatrix() {
             // Nested for loop to find the difference of each position in the matrices
-            for (auto row = 0; row < maxMatrix.size() && row < allocationMatrix.size() && row < needMatrix.size(); row++) {
-                for (auto col = 0; col < maxMatrix[row].size() && col < allocationMatrix[row].size() && col < needMatrix[row].size(); col++) {
-
-                    // Difference must be calculated after casting to integers to preserve negative values
-                    int difference = static_cast<int>(maxMatrix[row][col]) - static_cast<int>(allocationMatrix[row][col]);
+            for (size_t row = 0; row < maxMatrix.rows() && row < allocationMatrix.rows() && row < needMatrix.rows(); row++) {
+                for (size_t col = 0; col < maxMatrix.cols() && col < allocationMatrix.cols() && col < needMatrix.cols(); col++) {
 
-                    // If the difference is negative, it indicates that there are more resources allocated than possible
+                    // If the allocation exceeds the maximum, more resources are allocated than possible
                     // This means that the Program Snapshot provided by the text file is invalid
-                    if (difference < 0) {
-                        throw std::runtime_error(
-                            "Invalid Program Snapshot, at row " + std::to_string(row) + " col " + std::to_string(col) +
-                            ", the value of maxMatrix (" + std::to_string(maxMatrix[row][col]) +
-                            ") is less than the value of allocationMatrix (" + std::to_string(allocationMatrix[row][col]) + ")");
+                    // The counts are compared before subtracting, as the unsigned difference would wrap around
+                    if (maxMatrix(row, col) < allocationMatrix(row, col)) {
+                        throw allocationExceedsMaximum(row, col, maxMatrix(row, col), allocationMatrix(row, col));
                     }
-                    needMatrix[row][col] = static_cast<size_t>(difference);
+                    needMatrix(row, col) = maxMatrix(row, col) - allocationMatrix(row, col);
                 }
             }
         }
 
         // Returns true if every element on the lhs is less than or equal to the rhs
-        bool compareVector (const vector<size_t>& lhs, const vector<size_t>& rhs) const{
-            if (lhs.size() != rhs.size()) {
-                throw std::runtime_error("Attempted comparison of vectors of different lengths.");
-            }
-
-            // If just one element of the lhs is greater than another in the same position as the rhs, return false
-            for (auto i = 0; i < lhs.size(); i++) {
-                if (lhs[i] > rhs[i]) {
-                    return false;
-                }
-            }
-
-            return true;
+        // Both sides must be padded rows of the same length, which the constructor guarantees
+        bool compareVector (std::span<const T> lhs, std::span<const T> rhs) const{
+            return kernels.lessEqual(lhs.data(), rhs.data(), lhs.size());
         }
 
-        // Adds elements from the allocationVector into availableVector
-        void freeResources(const vector<size_t>& allocationVector) {
-            for (auto i = 0; i < allocationVector.size(); i++) {
-                availableVector[i] += allocationVector[i];
-            }
+        // Adds elements from the allocationVector into the scratch copy of availableVector used by the scan
+        // Returns false if a sum overflowed
+        bool freeResources(std::span<const T> allocationVector) {
+            return kernels.addInto(scratchAvailable.data(), allocationVector.data(), allocationVector.size());
         }
         
         // Datastructures used for calculating safe sequence
-        vector<size_t> availableVector;
-        vector<vector<size_t>> maxMatrix;
-        vector<vector<size_t>> allocationMatrix;
-        vector<vector<size_t>> needMatrix;
+        // Matrices are stored row-major in one contiguous buffer each, so the safety scan streams through memory
+        // maxMatrix and allocationMatrix view either the storage below or memory owned by the caller
+        AlignedVector<T> availableVector;
+        BasicResourceMatrix<T> maxStorage;
+        BasicResourceMatrix<T> allocationStorage;
+        BasicResourceMatrixView<T> maxMatrix;
+        BasicResourceMatrixView<T> allocationMatrix;
+        BasicResourceMatrix<T> needMatrix;
+
+        // Scratch buffers of the scan, sized on the first call and reused by every later one
+        AlignedVector<T> scratchAvailable;
+        std::pmr::vector<BOOL> finished;
+        std::pmr::vector<uint64_t> finishedPerRound;
+
+        // Vectorized kernels used by compareVector and freeResources
+        BasicResourceKernels<T> kernels;
+
+        // Pool used by the parallel engine, ThreadPool::shared() when null
+        ThreadPool* pool = nullptr;
 
         // Other variables
         size_t numProcesses;
         size_t numResources;
-};
\ No newline at end of file
+};
+
+using BankerAlgorithm = BasicBankerAlgorithm<size_t>;
+
+// Call use(bankers) with a BasicBankerAlgorithm on the snapshot, its counts narrowed to the smallest type that holds them,
+// see snapshotCountWidth. Narrower counts fit more of a row into every vector compare. The snapshot is copied unless it
+// already needs 64 bits.
+// The copies and the object allocate from resource when one is given, see BasicBankerAlgorithm.
+template <typename Use>
+auto withNarrowestBankers(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix, Use use,
+                          std::pmr::memory_resource* resource = nullptr) {
+    auto solveAs = [&]<typename T>(T) {
+        AlignedVector<T> narrowAvailable(availableVector.size(), 0, resource);
+        std::transform(availableVector.begin(), availableVector.end(), narrowAvailable.begin(), narrowCount<T, size_t>);
+        BasicBankerAlgorithm<T> bankers(narrowAvailable, BasicResourceMatrix<T>(maxMatrix, resource), BasicResourceMatrix<T>(allocationMatrix, resource), resource);
+        return use(bankers);
+    };
+
+    switch (snapshotCountWidth(availableVector, maxMatrix, allocationMatrix)) {
+        case CountWidth::U8:
+            return solveAs(uint8_t());
+        case CountWidth::U16:
+            return solveAs(uint16_t());
+        case CountWidth::U32:
+            return solveAs(uint32_t());
+        default:
+            BankerAlgorithm bankers(availableVector, maxMatrix, allocationMatrix, resource);
+            return use(bankers);
+    }
+}
+
+// Find a safe sequence of a snapshot with its counts narrowed to the smallest type that holds them
+inline vector<size_t> findSafeSequenceNarrowest(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                                                SafetyEngine engine, SequenceOrder order = SequenceOrder::FIFO, std::pmr::memory_resource* resource = nullptr) {
+    return withNarrowestBankers(availableVector, maxMatrix, allocationMatrix, [&](auto& bankers) {
+        return bankers.findSafeSequence(engine, order);
+    }, resource);
+}
+
+// Check the safety of a snapshot with its counts narrowed to the smallest type that holds them, see checkSafety
+inline SafetyReport checkSafetyNarrowest(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                                         SafetyEngine engine, SequenceOrder order = SequenceOrder::FIFO, std::pmr::memory_resource* resource = nullptr) {
+    return withNarrowestBankers(availableVector, maxMatrix, allocationMatrix, [&](auto& bankers) {
+        return bankers.checkSafety(engine, order);
+    }, resource);
+}
@@ -0,0 +1,414 @@
+// BankerEngine.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "ResourceKernels.hpp"
+#include "WorkListSafety.hpp"
+#include "BankerAlgorithm.hpp"
+#include "Stats.hpp"
+
+using std::vector, std::string;
+
+// Outcome of a resource request made to the BankerEngine
+enum class RequestStatus {
+    // The resources were allocated and the state is still safe
+    GRANTED,
+    // Not enough resources are available right now, the process has to wait
+    MUST_WAIT,
+    // Granting the request would leave the state unsafe, the process has to wait
+    UNSAFE
+};
+
+inline const char* requestStatusName(RequestStatus status) {
+    switch (status) {
+        case RequestStatus::GRANTED: return "granted";
+        case RequestStatus::MUST_WAIT: return "must wait";
+        case RequestStatus::UNSAFE: return "unsafe";
+    }
+    return "unknown";
+}
+
+// Long-lived Banker's Algorithm that updates its state in place as processes request and release resources
+// Unlike BankerAlgorithm, which checks one complete snapshot, the engine keeps a safe sequence of the current state
+// together with the vector of available resources before each process of the sequence runs (its "work" vector).
+// A request r from the process at position p of the sequence only lowers the work vectors up to p, and only in the
+// resource types r asks for. So the request is safe if every process before p still fits with r taken away, which is
+// checked in O(p * nonzero(r)) without running a full safety check. Only when that check fails is a full safety check
+// run, since another order might still be safe.
+class BankerEngine {
+    public:
+        // Marks a position of the cached sequence whose process was removed
+        static constexpr size_t NO_PROCESS = SIZE_MAX;
+
+        // Construct the engine from the state of a Program Snapshot
+        // The matrices are moved into the engine, so pass rvalues to avoid copying them
+        BankerEngine(vector<size_t> availableVector, ResourceMatrix maxMatrix, ResourceMatrix allocationMatrix) :
+                     maxMatrix(std::move(maxMatrix)), allocationMatrix(std::move(allocationMatrix)), kernels(ResourceKernels::best()) {
+
+            numResources = this->maxMatrix.cols();
+            if (this->allocationMatrix.rows() != this->maxMatrix.rows() || this->allocationMatrix.cols() != numResources || availableVector.size() != numResources) {
+                throw std::runtime_error("Available Vector, Maximum Matrix and Allocation Matrix dimensions do not match.");
+            }
+
+            // Store availableVector padded like the matrix rows, so the kernels can run across a whole padded row
+            this->availableVector = AlignedVector<size_t>(this->maxMatrix.stride(), 0);
+            std::copy(availableVector.begin(), availableVector.end(), this->availableVector.begin());
+
+            needMatrix = ResourceMatrix(this->maxMatrix.rows(), numResources);
+            for (size_t row = 0; row < this->maxMatrix.rows(); row++) {
+                for (size_t col = 0; col < numResources; col++) {
+                    if (this->maxMatrix(row, col) < this->allocationMatrix(row, col)) {
+                        throw allocationExceedsMaximum(row, col, this->maxMatrix(row, col), this->allocationMatrix(row, col));
+                    }
+                    needMatrix(row, col) = this->maxMatrix(row, col) - this->allocationMatrix(row, col);
+                }
+            }
+
+            active = vector<bool>(this->maxMatrix.rows(), true);
+            sequencePosition = vector<size_t>(this->maxMatrix.rows(), NO_PROCESS);
+            numActive = this->maxMatrix.rows();
+
+            // Resources are only moved between availableVector and allocationMatrix, so their total never changes
+            totalResources = this->availableVector;
+            for (size_t row = 0; row < this->allocationMatrix.rows(); row++) {
+                if (!kernels.addInto(totalResources.data(), this->allocationMatrix.paddedRow(row).data(), this->allocationMatrix.stride())) {
+                    throw std::overflow_error("Total resources of the Program Snapshot do not fit into 64 bits");
+                }
+            }
+
+            refreshSafeSequence();
+        }
+
+        // Process pid asks for the resources in requestVector
+        // Throws if the request exceeds what the process declared it would need
+        RequestStatus request(size_t pid, std::span<const size_t> requestVector) {
+            checkProcess(pid);
+            checkVector(requestVector);
+
+            for (size_t j = 0; j < numResources; j++) {
+                if (requestVector[j] > needMatrix(pid, j)) {
+                    throw std::runtime_error(
+                        "Process " + std::to_string(pid) + " requested " + std::to_string(requestVector[j]) + " of resource " +
+                        std::to_string(j) + " but only declared a remaining need of " + std::to_string(needMatrix(pid, j)));
+                }
+            }
+
+            requestedColumns.clear();
+            for (size_t j = 0; j < numResources; j++) {
+                if (requestVector[j] > availableVector[j]) {
+                    return RequestStatus::MUST_WAIT;
+                }
+                if (requestVector[j] > 0) {
+                    requestedColumns.push_back(j);
+                }
+            }
+
+            if (requestedColumns.empty()) {
+                return RequestStatus::GRANTED;
+            }
+
+            // Fast path, the cached safe sequence still works with the request granted
+            if (sequenceValid && cachedSequenceAllows(pid, requestVector)) {
+                moveResources(pid, requestVector, true);
+                const size_t position = sequencePosition[pid];
+                for (size_t k = 0; k <= position; k++) {
+                    for (auto j: requestedColumns) {
+                        sequenceWork(k, j) -= requestVector[j];
+                    }
+                }
+                return RequestStatus::GRANTED;
+            }
+
+            // Slow path, try the request and search for any safe sequence
+            const bool wasValid = sequenceValid;
+            const bool wasChecked = stateChecked;
+            moveResources(pid, requestVector, true);
+            if (refreshSafeSequence()) {
+                return RequestStatus::GRANTED;
+            }
+
+            // Unsafe, roll the request back
+            // A failed search leaves the cached sequence untouched, so it describes the rolled back state again
+            moveResources(pid, requestVector, false);
+            sequenceValid = wasValid;
+            stateChecked = wasChecked;
+            return RequestStatus::UNSAFE;
+        }
+
+        // Process pid gives back the resources in releaseVector
+        // Releasing never makes a safe state unsafe, so the cached sequence stays valid
+        void release(size_t pid, std::span<const size_t> releaseVector) {
+            checkProcess(pid);
+            checkVector(releaseVector);
+
+            for (size_t j = 0; j < numResources; j++) {
+                if (releaseVector[j] > allocationMatrix(pid, j)) {
+                    throw std::runtime_error(
+                        "Process " + std::to_string(pid) + " released " + std::to_string(releaseVector[j]) + " of resource " +
+                        std::to_string(j) + " but only holds " + std::to_string(allocationMatrix(pid, j)));
+                }
+            }
+
+            moveResources(pid, releaseVector, false);
+
+            // The work vectors up to and including the process grow by the released amount, the ones after it do not change
+            if (sequenceValid) {
+                const size_t position = sequencePosition[pid];
+                for (size_t k = 0; k <= position; k++) {
+                    for (size_t j = 0; j < numResources; j++) {
+                        sequenceWork(k, j) += releaseVector[j];
+                    }
+                }
+            } else {
+                stateChecked = false;
+            }
+        }
+
+        // Add a process that holds no resources yet and may claim up to maxVector, returning its pid
+        // pids of removed processes are reused
+        size_t addProcess(std::span<const size_t> maxVector) {
+            checkVector(maxVector);
+
+            size_t pid;
+            if (!freePids.empty()) {
+                pid = freePids.back();
+                freePids.pop_back();
+            } else {
+                pid = maxMatrix.rows();
+                maxMatrix.appendZeroRow();
+                allocationMatrix.appendZeroRow();
+                needMatrix.appendZeroRow();
+                active.push_back(false);
+                sequencePosition.push_back(NO_PROCESS);
+            }
+
+            std::copy(maxVector.begin(), maxVector.end(), maxMatrix.row(pid).begin());
+            std::copy(maxVector.begin(), maxVector.end(), needMatrix.row(pid).begin());
+            active[pid] = true;
+            numActive++;
+
+            // A process holding nothing can run last once every other process has returned its resources,
+            // so it extends the cached sequence if its maximum fits into the total resources
+            if (sequenceValid) {
+                if (kernels.lessEqual(needMatrix.paddedRow(pid).data(), totalResources.data(), numPadded())) {
+                    sequencePosition[pid] = sequence.size();
+                    sequence.push_back(pid);
+                    sequenceWork.appendRow(std::span<const size_t>(totalResources.data(), numResources));
+                } else {
+                    sequenceValid = false;
+                    stateChecked = true;
+                }
+            }
+
+            return pid;
+        }
+
+        // Remove a process, returning everything it holds to the available resources
+        void removeProcess(size_t pid) {
+            checkProcess(pid);
+
+            auto allocation = allocationMatrix.row(pid);
+            for (size_t j = 0; j < numResources; j++) {
+                availableVector[j] += allocation[j];
+            }
+
+            // The removed process stays in the cached sequence as an empty placeholder
+            // Its allocation now sits in the work vectors up to and including its position instead of being released after it
+            if (sequenceValid) {
+                const size_t position = sequencePosition[pid];
+                for (size_t k = 0; k <= position; k++) {
+                    for (size_t j = 0; j < numResources; j++) {
+                        sequenceWork(k, j) += allocation[j];
+                    }
+                }
+                sequence[position] = NO_PROCESS;
+                removedInSequence++;
+            } else {
+                stateChecked = false;
+            }
+
+            std::fill(maxMatrix.row(pid).begin(), maxMatrix.row(pid).end(), 0);
+            std::fill(allocation.begin(), allocation.end(), 0);
+            std::fill(needMatrix.row(pid).begin(), needMatrix.row(pid).end(), 0);
+            sequencePosition[pid] = NO_PROCESS;
+            active[pid] = false;
+            numActive--;
+            freePids.push_back(pid);
+
+            // Drop the placeholders once they make up most of the sequence
+            if (sequenceValid && removedInSequence * 2 > sequence.size()) {
+                refreshSafeSequence();
+            }
+        }
+
+        // Returns true if the current state is safe
+        bool isSafe() {
+            if (!sequenceValid && !stateChecked) {
+                refreshSafeSequence();
+            }
+            return sequenceValid;
+        }
+
+        // Safe sequence of the current state, or an empty vector if the state is unsafe
+        vector<size_t> findSafeSequence() {
+            vector<size_t> result;
+            if (isSafe()) {
+                result.reserve(numActive);
+                for (auto pid: sequence) {
+                    if (pid != NO_PROCESS) {
+                        result.push_back(pid);
+                    }
+                }
+            }
+            return result;
+        }
+
+        std::span<const size_t> getAvailableResources() const {
+            return std::span<const size_t>(availableVector.data(), numResources);
+        }
+
+        std::span<const size_t> getAllocation(size_t pid) const {
+            return allocationMatrix.row(pid);
+        }
+
+        std::span<const size_t> getNeed(size_t pid) const {
+            return needMatrix.row(pid);
+        }
+
+        bool isActive(size_t pid) const {
+            return pid < active.size() && active[pid];
+        }
+
+        // Number of pids handed out so far, including removed ones
+        size_t processCapacity() const {
+            return active.size();
+        }
+
+        size_t processCount() const {
+            return numActive;
+        }
+
+        size_t resourceCount() const {
+            return numResources;
+        }
+
+    private:
+        // Throws if pid is not an active process
+        void checkProcess(size_t pid) const {
+            if (!isActive(pid)) {
+                throw std::runtime_error("Process " + std::to_string(pid) + " does not exist.");
+            }
+        }
+
+        // Throws if vector does not cover every resource type
+        void checkVector(std::span<const size_t> vector) const {
+            if (vector.size() != numResources) {
+                throw std::runtime_error("Resource vector must have " + std::to_string(numResources) + " entries.");
+            }
+        }
+
+        // Returns true if every process before pid in the cached sequence still fits into its work vector once
+        // requestVector has been taken from the available resources
+        bool cachedSequenceAllows(size_t pid, std::span<const size_t> requestVector) const {
+            const size_t position = sequencePosition[pid];
+            for (size_t k = 0; k < position; k++) {
+                const size_t process = sequence[k];
+                if (process == NO_PROCESS) {
+                    continue;
+                }
+                for (auto j: requestedColumns) {
+                    if (needMatrix(process, j) + requestVector[j] > sequenceWork(k, j)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Moves resources from availableVector to pid (grant) or back from pid to availableVector (release)
+        void moveResources(size_t pid, std::span<const size_t> amount, bool grant) {
+            for (size_t j = 0; j < numResources; j++) {
+                if (grant) {
+                    availableVector[j] -= amount[j];
+                    allocationMatrix(pid, j) += amount[j];
+                    needMatrix(pid, j) -= amount[j];
+                } else {
+                    availableVector[j] += amount[j];
+                    allocationMatrix(pid, j) -= amount[j];
+                    needMatrix(pid, j) += amount[j];
+                }
+            }
+        }
+
+        // Run a full safety check and cache the sequence and work vectors it finds
+        // Returns true if the state is safe
+        bool refreshSafeSequence() {
+            StatTimer timer(Stat::SAFETY_NANOSECONDS);
+            Stats::process().add(Stat::SAFETY_CHECKS, 1);
+            WorkListSafety workList(availableVector, needMatrix, allocationMatrix, kernels);
+            auto found = workList.findSafeSequence(SequenceOrder::ANY);
+            stateChecked = true;
+            sequenceValid = workList.allFinished();
+            if (!sequenceValid) {
+                return false;
+            }
+
+            // Removed pids have no need and hold nothing, leave them out of the sequence
+            sequence.clear();
+            sequence.reserve(numActive);
+            std::fill(sequencePosition.begin(), sequencePosition.end(), NO_PROCESS);
+            sequencePosition.resize(active.size(), NO_PROCESS);
+            for (auto pid: found) {
+                if (active[pid]) {
+                    sequencePosition[pid] = sequence.size();
+                    sequence.push_back(pid);
+                }
+            }
+            removedInSequence = 0;
+
+            sequenceWork = ResourceMatrix(sequence.size(), numResources);
+            AlignedVector<size_t> work = availableVector;
+            for (size_t k = 0; k < sequence.size(); k++) {
+                std::copy(work.begin(), work.begin() + numResources, sequenceWork.row(k).begin());
+                kernels.addInto(work.data(), allocationMatrix.paddedRow(sequence[k]).data(), allocationMatrix.stride());
+            }
+            return true;
+        }
+
+        size_t numPadded() const {
+            return maxMatrix.stride();
+        }
+
+        // Current state
+        AlignedVector<size_t> availableVector;
+        AlignedVector<size_t> totalResources;
+        ResourceMatrix maxMatrix;
+        ResourceMatrix allocationMatrix;
+        ResourceMatrix needMatrix;
+        vector<bool> active;
+        vector<size_t> freePids;
+        size_t numActive = 0;
+        size_t numResources = 0;
+
+        // Cached safe sequence, position of each pid in it, and the available resources before each position runs
+        vector<size_t> sequence;
+        vector<size_t> sequencePosition;
+        ResourceMatrix sequenceWork;
+        size_t removedInSequence = 0;
+        bool sequenceValid = false;
+
+        // True if the state has not changed since a full check found it unsafe
+        bool stateChecked = false;
+
+        // Resource types with a nonzero amount in the request being checked
+        vector<size_t> requestedColumns;
+
+        ResourceKernels kernels;
+};
@@ -0,0 +1,508 @@
+// BankerServer.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "BankerEngine.hpp"
+#include "ProgramSnapshotReader.hpp"
+#include "ServerProtocol.hpp"
+#include "ThreadPool.hpp"
+
+using std::vector, std::string;
+
+// Bytes of requests waiting for the pool plus responses not sent yet above which the server stops reading from a
+// connection, so a client that pipelines without reading its responses cannot grow the server's buffers without bound
+// The unsplit input is bounded by SERVER_PROTOCOL_MAX_PAYLOAD on top of this.
+#define SERVER_MAX_BACKLOG_BYTES (4u << 20)
+
+// Safety-check daemon listening on a Unix domain socket, see ServerProtocol.hpp for the messages
+//
+// Resource states are loaded once from snapshot files with ProgramSnapshotReader and kept in memory as named BankerEngine
+// objects, which decide requests and releases incrementally. One thread runs an epoll loop that accepts connections,
+// reads requests and writes responses. Requests are answered on a small thread pool: the requests a connection has
+// pipelined are handed to the pool together and run in order, so each connection sees its requests applied in the order
+// it sent them while different connections are served in parallel. A finished batch is handed back to the loop through an
+// eventfd. A connection whose backlog exceeds SERVER_MAX_BACKLOG_BYTES is not read from until it drains. SIGINT and
+// SIGTERM stop the server.
+class BankerServer {
+    public:
+        // Listen on socketPath, replacing a stale socket file, with numThreads solver threads (0 means one per core)
+        BankerServer(const string& socketPath, size_t numThreads) : socketPath(socketPath) {
+            // Block the stop signals before the solver threads start, so they are only ever picked up by the signalfd
+            sigset_t stopSignals;
+            sigemptyset(&stopSignals);
+            sigaddset(&stopSignals, SIGINT);
+            sigaddset(&stopSignals, SIGTERM);
+            pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+            signalFD = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+            pool = std::make_unique<ThreadPool>(numThreads);
+
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (socketPath.size() >= sizeof(address.sun_path)) {
+                throw std::runtime_error("Socket path is too long, " + socketPath);
+            }
+            std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+            listenFD = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            unlink(socketPath.c_str());
+            if (listenFD == -1 || bind(listenFD, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 || listen(listenFD, SOMAXCONN) == -1) {
+                throw std::runtime_error("Failed to listen on " + socketPath + ", " + std::strerror(errno));
+            }
+
+            wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epollFD = epoll_create1(EPOLL_CLOEXEC);
+            if (signalFD == -1 || wakeFD == -1 || epollFD == -1) {
+                throw std::runtime_error("Failed to set up the server event loop");
+            }
+            watch(listenFD, LISTEN_ID, EPOLLIN, EPOLL_CTL_ADD);
+            watch(wakeFD, WAKE_ID, EPOLLIN, EPOLL_CTL_ADD);
+            watch(signalFD, SIGNAL_ID, EPOLLIN, EPOLL_CTL_ADD);
+        }
+
+        ~BankerServer() {
+            // Finish the batches still on the pool before the connections they answer go away
+            pool.reset();
+            for (auto& [id, connection]: connections) {
+                close(connection.fd);
+            }
+            for (int fd: {listenFD, wakeFD, signalFD, epollFD}) {
+                if (fd != -1) {
+                    close(fd);
+                }
+            }
+            unlink(socketPath.c_str());
+        }
+
+        BankerServer(const BankerServer&) = delete;
+        BankerServer& operator=(const BankerServer&) = delete;
+
+        // Serve until SIGINT or SIGTERM
+        void run() {
+            epoll_event events[64];
+            bool stopping = false;
+
+            while (!stopping) {
+                const int count = epoll_wait(epollFD, events, 64, -1);
+                if (count == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error("epoll_wait failed");
+                }
+
+                for (int i = 0; i < count; i++) {
+                    const uint64_t id = events[i].data.u64;
+                    if (id == LISTEN_ID) {
+                        acceptConnections();
+                    } else if (id == WAKE_ID) {
+                        collectFinishedBatches();
+                    } else if (id == SIGNAL_ID) {
+                        stopping = true;
+                    } else {
+                        serveConnection(id, events[i].events);
+                    }
+                }
+            }
+        }
+
+    private:
+        // epoll ids of the server's own descriptors, connections are numbered after them
+        static constexpr uint64_t LISTEN_ID = 0;
+        static constexpr uint64_t WAKE_ID = 1;
+        static constexpr uint64_t SIGNAL_ID = 2;
+
+        struct Connection {
+            int fd = -1;
+            // Bytes received and not yet split into requests
+            vector<char> input;
+            // Complete requests waiting for the connection's batch on the pool to finish
+            vector<char> pending;
+            // Responses not sent yet, starting at outputSent
+            vector<char> output;
+            size_t outputSent = 0;
+            // A batch of this connection's requests is on the pool
+            bool busy = false;
+            // The client will send nothing more
+            bool readClosed = false;
+            // The client has closed the connection, responses can no longer be delivered
+            bool hungUp = false;
+        };
+
+        // Responses to a batch of requests, handed from the pool back to the event loop
+        struct FinishedBatch {
+            uint64_t connectionId;
+            vector<char> responses;
+        };
+
+        // A loaded resource state, requests on the same state are serialized by its mutex
+        struct NamedState {
+            template <typename... EngineArguments>
+            NamedState(const string& name, EngineArguments&&... arguments) : name(name), engine(std::forward<EngineArguments>(arguments)...) {}
+
+            string name;
+            std::mutex mutex;
+            BankerEngine engine;
+        };
+
+        void watch(int fd, uint64_t id, uint32_t events, int operation) {
+            epoll_event event = {};
+            event.events = events;
+            event.data.u64 = id;
+            if (epoll_ctl(epollFD, operation, fd, &event) == -1) {
+                throw std::runtime_error("epoll_ctl failed");
+            }
+        }
+
+        void acceptConnections() {
+            while (true) {
+                const int fd = accept4(listenFD, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd == -1) {
+                    return;
+                }
+                const uint64_t id = nextConnectionId++;
+                connections[id].fd = fd;
+                watch(fd, id, EPOLLIN, EPOLL_CTL_ADD);
+            }
+        }
+
+        void serveConnection(uint64_t id, uint32_t events) {
+            auto found = connections.find(id);
+            if (found == connections.end()) {
+                return;
+            }
+            Connection& connection = found->second;
+
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (!receiveRequests(connection)) {
+                    closeConnection(id);
+                    return;
+                }
+                dispatch(id, connection);
+            }
+            if (events & (EPOLLHUP | EPOLLERR)) {
+                // The client is gone, so finish what it sent but stop watching the socket, which would report the hangup forever
+                connection.hungUp = true;
+                epoll_ctl(epollFD, EPOLL_CTL_DEL, connection.fd, nullptr);
+            }
+            flush(id, connection);
+        }
+
+        // Requests waiting for the pool and responses not sent yet
+        static size_t backlog(const Connection& connection) {
+            return connection.pending.size() + connection.output.size() - connection.outputSent;
+        }
+
+        // Read what the client has sent, until the backlog is over its limit, and move the complete requests to pending
+        // Returns false if the connection is broken or sent a malformed request
+        bool receiveRequests(Connection& connection) {
+            char chunk[65536];
+            while (backlog(connection) < SERVER_MAX_BACKLOG_BYTES) {
+                const ssize_t received = read(connection.fd, chunk, sizeof(chunk));
+                if (received > 0) {
+                    connection.input.insert(connection.input.end(), chunk, chunk + received);
+                    if (!splitRequests(connection)) {
+                        return false;
+                    }
+                    continue;
+                }
+                if (received == 0) {
+                    connection.readClosed = true;
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                return false;
+            }
+            return true;
+        }
+
+        // Move the complete requests at the front of the input to pending
+        // Returns false if a request is malformed
+        bool splitRequests(Connection& connection) {
+            size_t consumed = 0;
+            try {
+                size_t size;
+                while ((size = completeMessageSize(std::span<const char>(connection.input).subspan(consumed))) != 0) {
+                    consumed += size;
+                }
+            } catch (const std::runtime_error&) {
+                return false;
+            }
+            connection.pending.insert(connection.pending.end(), connection.input.begin(), connection.input.begin() + consumed);
+            connection.input.erase(connection.input.begin(), connection.input.begin() + consumed);
+            return true;
+        }
+
+        // Hand every pending request of the connection to the pool as one batch, unless a batch is already running
+        void dispatch(uint64_t id, Connection& connection) {
+            if (connection.busy || connection.pending.empty()) {
+                return;
+            }
+            connection.busy = true;
+            pool->submit([this, id, requests = std::move(connection.pending)] {
+                FinishedBatch batch{id, {}};
+                size_t position = 0;
+                while (position < requests.size()) {
+                    const size_t size = completeMessageSize(std::span<const char>(requests).subspan(position));
+                    handleRequest(std::span<const char>(requests).subspan(position, size), batch.responses);
+                    position += size;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(finishedMutex);
+                    finished.push_back(std::move(batch));
+                }
+                const uint64_t one = 1;
+                ssize_t ignored = write(wakeFD, &one, sizeof(one));
+                (void)ignored;
+            });
+            connection.pending.clear();
+        }
+
+        void collectFinishedBatches() {
+            uint64_t counter;
+            ssize_t ignored = read(wakeFD, &counter, sizeof(counter));
+            (void)ignored;
+
+            vector<FinishedBatch> batches;
+            {
+                std::lock_guard<std::mutex> lock(finishedMutex);
+                batches.swap(finished);
+            }
+
+            for (auto& batch: batches) {
+                auto found = connections.find(batch.connectionId);
+                if (found == connections.end()) {
+                    continue;
+                }
+                Connection& connection = found->second;
+                connection.output.insert(connection.output.end(), batch.responses.begin(), batch.responses.end());
+                connection.busy = false;
+                dispatch(batch.connectionId, connection);
+                flush(batch.connectionId, connection);
+            }
+        }
+
+        // Send as much output as the socket takes, and close the connection once the client is done and fully answered
+        void flush(uint64_t id, Connection& connection) {
+            if (connection.hungUp) {
+                if (!connection.busy && connection.pending.empty()) {
+                    closeConnection(id);
+                }
+                return;
+            }
+
+            while (connection.outputSent < connection.output.size()) {
+                const ssize_t sent = send(connection.fd, connection.output.data() + connection.outputSent,
+                                          connection.output.size() - connection.outputSent, MSG_NOSIGNAL);
+                if (sent > 0) {
+                    connection.outputSent += sent;
+                } else if (sent == -1 && errno == EINTR) {
+                    continue;
+                } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                } else {
+                    closeConnection(id);
+                    return;
+                }
+            }
+
+            if (connection.outputSent == connection.output.size()) {
+                connection.output.clear();
+                connection.outputSent = 0;
+                if (connection.readClosed && !connection.busy && connection.pending.empty()) {
+                    closeConnection(id);
+                    return;
+                }
+            }
+
+            // Only wait for the socket to drain while output is left, and stop reading once the client is done or while the
+            // backlog is over its limit
+            uint32_t events = (connection.readClosed || backlog(connection) >= SERVER_MAX_BACKLOG_BYTES) ? 0u : uint32_t(EPOLLIN);
+            if (!connection.output.empty()) {
+                events |= EPOLLOUT;
+            }
+            watch(connection.fd, id, events, EPOLL_CTL_MOD);
+        }
+
+        void closeConnection(uint64_t id) {
+            auto found = connections.find(id);
+            if (found != connections.end()) {
+                close(found->second.fd);
+                connections.erase(found);
+            }
+        }
+
+        // Runs on the pool, appends the response to one request to responses
+        void handleRequest(std::span<const char> message, vector<char>& responses) {
+            MessageHeader header;
+            std::memcpy(&header, message.data(), sizeof(header));
+            const MessageType type = static_cast<MessageType>(header.type);
+            MessageReader reader(message.subspan(sizeof(header)));
+            MessageWriter writer(responses);
+            const size_t responseStart = responses.size();
+
+            try {
+                switch (type) {
+                    case MessageType::LOAD: {
+                        const size_t nameLength = reader.number();
+                        const string name(reader.text(nameLength));
+                        const auto path = reader.rest();
+                        auto [handle, state] = loadState(name, string(path.begin(), path.end()));
+                        writeStateInfo(writer, header, handle, *state);
+                        break;
+                    }
+                    case MessageType::OPEN: {
+                        const auto name = reader.rest();
+                        auto [handle, state] = openState(string(name.begin(), name.end()));
+                        writeStateInfo(writer, header, handle, *state);
+                        break;
+                    }
+                    case MessageType::UNLOAD: {
+                        unloadState(reader.number());
+                        writer.begin(type, header.requestId, ResponseStatus::OK);
+                        break;
+                    }
+                    case MessageType::REQUEST:
+                    case MessageType::RELEASE: {
+                        auto state = findState(reader.number());
+                        const size_t pid = reader.number();
+                        const vector<size_t> amount = reader.numbers();
+
+                        ResponseStatus status = ResponseStatus::OK;
+                        {
+                            std::lock_guard<std::mutex> lock(state->mutex);
+                            if (type == MessageType::RELEASE) {
+                                state->engine.release(pid, amount);
+                            } else {
+                                switch (state->engine.request(pid, amount)) {
+                                    case RequestStatus::GRANTED: status = ResponseStatus::GRANTED; break;
+                                    case RequestStatus::MUST_WAIT: status = ResponseStatus::MUST_WAIT; break;
+                                    case RequestStatus::UNSAFE: status = ResponseStatus::UNSAFE; break;
+                                }
+                            }
+                        }
+                        writer.begin(type, header.requestId, status);
+                        break;
+                    }
+                    case MessageType::CHECK: {
+                        auto state = findState(reader.number());
+                        vector<size_t> safeSequence;
+                        bool safe;
+                        {
+                            std::lock_guard<std::mutex> lock(state->mutex);
+                            safe = state->engine.isSafe();
+                            safeSequence = state->engine.findSafeSequence();
+                        }
+                        writer.begin(type, header.requestId, safe ? ResponseStatus::SAFE : ResponseStatus::DEADLOCK);
+                        writer.numbers(safeSequence);
+                        break;
+                    }
+                    default:
+                        throw std::runtime_error("Unknown message type " + std::to_string(header.type));
+                }
+            } catch (const std::exception& e) {
+                // Replace whatever part of the response was written with the error
+                responses.resize(responseStart);
+                writer.begin(type, header.requestId, ResponseStatus::ERROR);
+                writer.text(e.what());
+            }
+            writer.finish();
+        }
+
+        void writeStateInfo(MessageWriter& writer, const MessageHeader& header, uint64_t handle, NamedState& state) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            writer.begin(static_cast<MessageType>(header.type), header.requestId, ResponseStatus::OK);
+            writer.number(handle);
+            writer.number(state.engine.processCapacity());
+            writer.number(state.engine.resourceCount());
+        }
+
+        // Parse a snapshot file into a new state, which replaces any state loaded under the same name
+        std::pair<uint64_t, std::shared_ptr<NamedState>> loadState(const string& name, const string& file_name) {
+            ProgramSnapshotReader reader(file_name);
+            auto state = std::make_shared<NamedState>(name, reader.takeAvailableResources(), reader.takeMaximumMatrix(), reader.takeAllocationMatrix());
+
+            std::lock_guard<std::mutex> lock(statesMutex);
+            auto previous = stateNames.find(name);
+            if (previous != stateNames.end()) {
+                states.erase(previous->second);
+            }
+            const uint64_t handle = nextStateHandle++;
+            states[handle] = state;
+            stateNames[name] = handle;
+            return {handle, state};
+        }
+
+        std::pair<uint64_t, std::shared_ptr<NamedState>> openState(const string& name) {
+            std::lock_guard<std::mutex> lock(statesMutex);
+            auto found = stateNames.find(name);
+            if (found == stateNames.end()) {
+                throw std::runtime_error("No state named " + name);
+            }
+            return {found->second, states.at(found->second)};
+        }
+
+        void unloadState(uint64_t handle) {
+            std::lock_guard<std::mutex> lock(statesMutex);
+            auto found = states.find(handle);
+            if (found == states.end()) {
+                throw std::runtime_error("Unknown state handle " + std::to_string(handle));
+            }
+            stateNames.erase(found->second->name);
+            states.erase(found);
+        }
+
+        // The state stays alive for the caller even if it is unloaded meanwhile
+        std::shared_ptr<NamedState> findState(uint64_t handle) {
+            std::lock_guard<std::mutex> lock(statesMutex);
+            auto found = states.find(handle);
+            if (found == states.end()) {
+                throw std::runtime_error("Unknown state handle " + std::to_string(handle));
+            }
+            return found->second;
+        }
+
+        string socketPath;
+        int listenFD = -1;
+        int wakeFD = -1;
+        int signalFD = -1;
+        int epollFD = -1;
+
+        // Only touched by the event loop thread
+        std::unordered_map<uint64_t, Connection> connections;
+        uint64_t nextConnectionId = SIGNAL_ID + 1;
+
+        std::mutex finishedMutex;
+        vector<FinishedBatch> finished;
+
+        std::mutex statesMutex;
+        std::unordered_map<uint64_t, std::shared_ptr<NamedState>> states;
+        std::unordered_map<string, uint64_t> stateNames;
+        uint64_t nextStateHandle = 1;
+
+        std::unique_ptr<ThreadPool> pool;
+};
@@ -0,0 +1,290 @@
+// BinarySnapshot.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "MappedFile.hpp"
+
+using std::vector, std::string;
+
+// Binary Program Snapshot format
+//
+// A BinarySnapshotHeader followed by the available vector, the maximum matrix and the allocation matrix.
+// Every block starts at a multiple of RESOURCE_MATRIX_ALIGNMENT bytes from the start of the file, and rows are
+// padded with zeros to the stride of a ResourceMatrix, so a memory-mapped file can be used by BankerAlgorithm as it is.
+// Numbers are stored in the byte order of the machine that wrote the file, recorded by byteOrderMark.
+#define BINARY_SNAPSHOT_MAGIC "BNKSNAP"
+#define BINARY_SNAPSHOT_VERSION 1
+#define BINARY_SNAPSHOT_BYTE_ORDER_MARK 0x01020304u
+
+struct BinarySnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    // Bytes per resource count
+    uint32_t elementWidth;
+    uint64_t numProcesses;
+    uint64_t numResources;
+    // Elements per padded row, of the available vector as well as of both matrices, the elements past numResources are zero
+    uint64_t stride;
+    // Offsets in bytes from the start of the file
+    uint64_t availableOffset;
+    uint64_t maximumOffset;
+    uint64_t allocationOffset;
+    uint64_t fileSize;
+    uint32_t byteOrderMark;
+    // Reserved for future layouts, must be zero
+    uint32_t flags;
+};
+
+// Returns true if the contents of a file start with the binary snapshot magic
+inline bool hasBinarySnapshotMagic(std::string_view contents) {
+    return contents.size() >= sizeof(BinarySnapshotHeader::magic) &&
+           std::memcmp(contents.data(), BINARY_SNAPSHOT_MAGIC, sizeof(BinarySnapshotHeader::magic)) == 0;
+}
+
+// Header of a binary snapshot with the given dimensions, with every block at its aligned offset
+inline BinarySnapshotHeader makeBinarySnapshotHeader(size_t numProcesses, size_t numResources) {
+    auto alignUp = [](uint64_t offset) {
+        return (offset + RESOURCE_MATRIX_ALIGNMENT - 1) / RESOURCE_MATRIX_ALIGNMENT * RESOURCE_MATRIX_ALIGNMENT;
+    };
+
+    BinarySnapshotHeader header = {};
+    std::memcpy(header.magic, BINARY_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = BINARY_SNAPSHOT_VERSION;
+    header.elementWidth = sizeof(size_t);
+    header.numProcesses = numProcesses;
+    header.numResources = numResources;
+    header.stride = ResourceMatrix::paddedStride(numResources);
+    header.byteOrderMark = BINARY_SNAPSHOT_BYTE_ORDER_MARK;
+
+    const uint64_t matrixBytes = header.numProcesses * header.stride * sizeof(size_t);
+    header.availableOffset = alignUp(sizeof(BinarySnapshotHeader));
+    header.maximumOffset = alignUp(header.availableOffset + header.stride * sizeof(size_t));
+    header.allocationOffset = alignUp(header.maximumOffset + matrixBytes);
+    header.fileSize = header.allocationOffset + matrixBytes;
+    return header;
+}
+
+// Bytes placed at an offset of a binary snapshot image, every byte not covered by a segment is zero
+struct BinarySnapshotSegment {
+    uint64_t offset;
+    const void* data;
+    size_t bytes;
+};
+
+// Segments of the binary snapshot image of the datastructures, in increasing order of offset
+// They point into header and the datastructures, so those must outlive the segments. A matrix whose stride already matches
+// the snapshot is a single segment, any other matrix is one segment per row.
+inline vector<BinarySnapshotSegment> binarySnapshotSegments(const BinarySnapshotHeader& header, std::span<const size_t> availableVector,
+                                                            ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    const size_t numResources = availableVector.size();
+    if (maxMatrix.cols() != numResources || allocationMatrix.cols() != numResources || maxMatrix.rows() != allocationMatrix.rows()) {
+        throw std::runtime_error("Available Vector, Maximum Matrix and Allocation Matrix dimensions do not match.");
+    }
+
+    vector<BinarySnapshotSegment> segments;
+    segments.push_back({0, &header, sizeof(header)});
+    segments.push_back({header.availableOffset, availableVector.data(), numResources * sizeof(size_t)});
+
+    auto addMatrix = [&](uint64_t offset, ResourceMatrixView matrix) {
+        if (matrix.empty()) {
+            return;
+        }
+        if (matrix.stride() == header.stride) {
+            segments.push_back({offset, matrix.data(), matrix.rows() * matrix.stride() * sizeof(size_t)});
+            return;
+        }
+        for (size_t row = 0; row < matrix.rows(); row++) {
+            segments.push_back({offset + row * header.stride * sizeof(size_t), matrix.row(row).data(), numResources * sizeof(size_t)});
+        }
+    };
+    addMatrix(header.maximumOffset, maxMatrix);
+    addMatrix(header.allocationOffset, allocationMatrix);
+
+    return segments;
+}
+
+// Copy segments into buffer, which holds an image of imageSize bytes, and zero every byte between them
+inline void encodeBinarySnapshot(char* buffer, uint64_t imageSize, const vector<BinarySnapshotSegment>& segments) {
+    uint64_t offset = 0;
+    for (const auto& segment: segments) {
+        std::memset(buffer + offset, 0, segment.offset - offset);
+        std::memcpy(buffer + segment.offset, segment.data, segment.bytes);
+        offset = segment.offset + segment.bytes;
+    }
+    std::memset(buffer + offset, 0, imageSize - offset);
+}
+
+// Write a snapshot in the binary format
+inline void writeBinarySnapshot(const string& file_name, std::span<const size_t> availableVector,
+                                ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    const BinarySnapshotHeader header = makeBinarySnapshotHeader(maxMatrix.rows(), availableVector.size());
+    const auto segments = binarySnapshotSegments(header, availableVector, maxMatrix, allocationMatrix);
+
+    // Assemble the file in memory so rows written with a different stride get re-padded
+    vector<char> buffer(header.fileSize);
+    encodeBinarySnapshot(buffer.data(), header.fileSize, segments);
+
+    std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), buffer.size());
+    if (!file) {
+        throw std::runtime_error("Failed to write binary snapshot " + file_name);
+    }
+}
+
+// Write a snapshot in the plain text format read by ProgramSnapshotReader
+inline void writeTextSnapshot(const string& file_name, std::span<const size_t> availableVector,
+                              ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    std::ofstream file(file_name, std::ios::trunc);
+
+    auto writeRow = [&](std::span<const size_t> row) {
+        for (size_t col = 0; col < row.size(); col++) {
+            file << row[col] << (col + 1 < row.size() ? " " : "");
+        }
+        file << '\n';
+    };
+
+    file << "// Allocation Matrix\n";
+    for (size_t row = 0; row < allocationMatrix.rows(); row++) {
+        writeRow(allocationMatrix.row(row));
+    }
+    file << "\n// Maximum Matrix\n";
+    for (size_t row = 0; row < maxMatrix.rows(); row++) {
+        writeRow(maxMatrix.row(row));
+    }
+    file << "\n// Available Resources\n";
+    writeRow(availableVector);
+
+    if (!file) {
+        throw std::runtime_error("Failed to write text snapshot " + file_name);
+    }
+}
+
+// Binary snapshot image held in memory owned by someone else, such as a mapped file or a buffer received from a pipe
+// The image must start on a RESOURCE_MATRIX_ALIGNMENT boundary. It is validated on construction, and the views it hands out
+// point straight into it.
+class BinarySnapshotView {
+    public:
+        BinarySnapshotView() = default;
+
+        // source names where the image came from in error messages
+        BinarySnapshotView(const char* image, size_t imageSize, const string& source) : image(image), imageSize(imageSize) {
+            if (imageSize < sizeof(BinarySnapshotHeader)) {
+                throw std::runtime_error("Binary snapshot is too short, " + source);
+            }
+            validate(source);
+        }
+
+        const BinarySnapshotHeader& header() const {
+            return *reinterpret_cast<const BinarySnapshotHeader*>(image);
+        }
+
+        std::span<const size_t> getAvailableResources() const {
+            return std::span<const size_t>(at(header().availableOffset), header().numResources);
+        }
+
+        ResourceMatrixView getMaximumMatrix() const {
+            return ResourceMatrixView(at(header().maximumOffset), header().numProcesses, header().numResources, header().stride);
+        }
+
+        ResourceMatrixView getAllocationMatrix() const {
+            return ResourceMatrixView(at(header().allocationOffset), header().numProcesses, header().numResources, header().stride);
+        }
+
+    private:
+        // Check the header, that every block lies inside the image and is aligned, and that the padding of every row is zero
+        void validate(const string& source) const {
+            const BinarySnapshotHeader& h = header();
+
+            if (std::memcmp(h.magic, BINARY_SNAPSHOT_MAGIC, sizeof(h.magic)) != 0) {
+                throw std::runtime_error("Not a binary snapshot, " + source);
+            }
+            if (h.version != BINARY_SNAPSHOT_VERSION) {
+                throw std::runtime_error("Unsupported binary snapshot version " + std::to_string(h.version) + ", " + source);
+            }
+            if (h.byteOrderMark != BINARY_SNAPSHOT_BYTE_ORDER_MARK) {
+                throw std::runtime_error("Binary snapshot was written on a machine with a different byte order, " + source);
+            }
+            if (h.elementWidth != sizeof(size_t) || h.flags != 0) {
+                throw std::runtime_error("Unsupported binary snapshot layout, " + source);
+            }
+            // A row of stride counts must have a byte size that fits in 64 bits, or every size computed below wraps
+            if (h.numResources == 0 || h.numResources > UINT64_MAX / sizeof(size_t) - RESOURCE_MATRIX_ALIGNMENT ||
+                h.stride != ResourceMatrix::paddedStride(h.numResources)) {
+                throw std::runtime_error("Invalid binary snapshot row stride, " + source);
+            }
+
+            const uint64_t matrixBytes = h.numProcesses * h.stride * sizeof(size_t);
+            if (h.numProcesses != 0 && matrixBytes / h.numProcesses != h.stride * sizeof(size_t)) {
+                throw std::runtime_error("Invalid binary snapshot dimensions, " + source);
+            }
+            checkBlock(h.availableOffset, h.stride * sizeof(size_t), source);
+            checkBlock(h.maximumOffset, matrixBytes, source);
+            checkBlock(h.allocationOffset, matrixBytes, source);
+
+            // The kernels add whole padded rows and cache keys hash them, so padding that is not zero would make a snapshot
+            // overflow where it does not, or miss the cache for matrices it already holds
+            checkPadding(h.availableOffset, 1, source);
+            checkPadding(h.maximumOffset, h.numProcesses, source);
+            checkPadding(h.allocationOffset, h.numProcesses, source);
+        }
+
+        void checkBlock(uint64_t offset, uint64_t bytes, const string& source) const {
+            if (offset % RESOURCE_MATRIX_ALIGNMENT != 0 || offset > imageSize || bytes > imageSize - offset) {
+                throw std::runtime_error("Binary snapshot is truncated or corrupt, " + source);
+            }
+        }
+
+        void checkPadding(uint64_t offset, uint64_t rows, const string& source) const {
+            const BinarySnapshotHeader& h = header();
+            const size_t* block = at(offset);
+            for (uint64_t row = 0; row < rows; row++) {
+                for (uint64_t col = h.numResources; col < h.stride; col++) {
+                    if (block[row * h.stride + col] != 0) {
+                        throw std::runtime_error("Binary snapshot has non-zero row padding, " + source);
+                    }
+                }
+            }
+        }
+
+        const size_t* at(uint64_t offset) const {
+            return reinterpret_cast<const size_t*>(image + offset);
+        }
+
+        const char* image = nullptr;
+        size_t imageSize = 0;
+};
+
+// Binary snapshot file mapped into memory read-only
+// The views it hands out point straight into the mapping and stay valid as long as the object lives
+class MappedSnapshot {
+    public:
+        explicit MappedSnapshot(const string& file_name) : file(file_name), snapshot(file.data(), file.size(), file_name) {}
+
+        const BinarySnapshotHeader& header() const {
+            return snapshot.header();
+        }
+
+        std::span<const size_t> getAvailableResources() const {
+            return snapshot.getAvailableResources();
+        }
+
+        ResourceMatrixView getMaximumMatrix() const {
+            return snapshot.getMaximumMatrix();
+        }
+
+        ResourceMatrixView getAllocationMatrix() const {
+            return snapshot.getAllocationMatrix();
+        }
+
+    private:
+        MappedFile file;
+        BinarySnapshotView snapshot;
+};
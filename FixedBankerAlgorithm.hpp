@@ -0,0 +1,206 @@
+// FixedBankerAlgorithm.hpp
+#pragma once
+
+#include <array>
+#include <span>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "BankerAlgorithm.hpp"
+#include "SafetyReport.hpp"
+#include "Stats.hpp"
+
+// Program Snapshot of a system whose number of processes and resource types is fixed at compile time
+template <size_t P, size_t R>
+struct FixedSnapshot {
+    std::array<size_t, R> available;
+    std::array<std::array<size_t, R>, P> maximum;
+    std::array<std::array<size_t, R>, P> allocation;
+};
+
+// The first length entries of sequence are the safe sequence, or the processes that finished before the rest blocked
+template <size_t P>
+struct FixedSafeSequence {
+    bool safe = false;
+    size_t length = 0;
+    std::array<size_t, P> sequence = {};
+
+    // Counted for Stats, as by the scan engine of BankerAlgorithm
+    // Every round but the last finishes a process, so there are at most P + 1.
+    size_t rounds = 0;
+    size_t comparisons = 0;
+    std::array<uint64_t, P + 1> finishedPerRound = {};
+};
+
+// Banker's Algorithm for P processes and R resource types, both known at compile time
+// Everything lives in std::array and the loops over resource types are unrolled, so a check never allocates. Everything
+// is also constexpr, so a snapshot known at compile time can be checked by static_assert.
+// Finds the same FIFO sequence as the scan engine of BankerAlgorithm.
+template <size_t P, size_t R>
+class FixedBankerAlgorithm {
+    public:
+        // Throws if an allocation exceeds its maximum, which fails compilation when checked at compile time
+        constexpr explicit FixedBankerAlgorithm(const FixedSnapshot<P, R>& snapshot) :
+                                                availableVector(snapshot.available), allocationMatrix(snapshot.allocation) {
+            for (size_t row = 0; row < P; row++) {
+                for (size_t col = 0; col < R; col++) {
+                    if (snapshot.maximum[row][col] < snapshot.allocation[row][col]) {
+                        throw allocationExceedsMaximum(row, col, snapshot.maximum[row][col], snapshot.allocation[row][col]);
+                    }
+                    needMatrix[row][col] = snapshot.maximum[row][col] - snapshot.allocation[row][col];
+                }
+            }
+        }
+
+        constexpr FixedSafeSequence<P> findSafeSequence() const {
+            FixedSafeSequence<P> result;
+            std::array<size_t, R> work = availableVector;
+            std::array<bool, P> finished = {};
+
+            size_t finishedThisRound = 1;
+            while (finishedThisRound > 0) {
+                finishedThisRound = 0;
+                for (size_t i = 0; i < P; i++) {
+                    if (!finished[i]) {
+                        result.comparisons++;
+                        if (fits(needMatrix[i], work, Columns())) {
+                            release(allocationMatrix[i], work, i, Columns());
+                            finished[i] = true;
+                            result.sequence[result.length++] = i;
+                            finishedThisRound++;
+                        }
+                    }
+                }
+                result.finishedPerRound[result.rounds++] = finishedThisRound;
+            }
+            result.safe = result.length == P;
+            return result;
+        }
+
+        constexpr bool isSafe() const {
+            return findSafeSequence().safe;
+        }
+
+    private:
+        using Columns = std::make_index_sequence<R>;
+
+        // Returns true if every need is at most the available count, comparing every column without branching
+        template <size_t... J>
+        static constexpr bool fits(const std::array<size_t, R>& need, const std::array<size_t, R>& work, std::index_sequence<J...>) {
+            return (true & ... & (need[J] <= work[J]));
+        }
+
+        // Add the allocation of a finished process to the available counts
+        template <size_t... J>
+        static constexpr void release(const std::array<size_t, R>& allocation, std::array<size_t, R>& work, size_t process, std::index_sequence<J...>) {
+            if ((false | ... | (allocation[J] > SIZE_MAX - work[J]))) {
+                throw std::overflow_error("Available resources overflowed when process " + std::to_string(process) + " released its allocation");
+            }
+            ((work[J] += allocation[J]), ...);
+        }
+
+        std::array<size_t, R> availableVector;
+        std::array<std::array<size_t, R>, P> allocationMatrix;
+        std::array<std::array<size_t, R>, P> needMatrix = {};
+};
+
+template <size_t P, size_t R>
+struct FixedShape {};
+
+template <typename... Shapes>
+struct FixedShapeList {};
+
+// Shapes, processes by resource types, that are checked with FixedBankerAlgorithm instead of BankerAlgorithm
+// Add the shapes of deployed systems here. Each one compiles a solver of its own, so keep the list short.
+using CompiledFixedShapes = FixedShapeList<FixedShape<4, 4>, FixedShape<5, 3>, FixedShape<16, 4>>;
+
+// Check a snapshot with FixedBankerAlgorithm<P, R>, copying it onto the stack first
+template <size_t P, size_t R>
+FixedSafeSequence<P> findSafeSequenceFixed(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    FixedSnapshot<P, R> snapshot;
+    std::copy_n(availableVector.begin(), R, snapshot.available.begin());
+    for (size_t row = 0; row < P; row++) {
+        std::copy_n(maxMatrix.row(row).begin(), R, snapshot.maximum[row].begin());
+        std::copy_n(allocationMatrix.row(row).begin(), R, snapshot.allocation[row].begin());
+    }
+
+    StatTimer timer(Stat::SAFETY_NANOSECONDS);
+    Stats::process().add(Stat::SAFETY_CHECKS, 1);
+    const FixedSafeSequence<P> found = FixedBankerAlgorithm<P, R>(snapshot).findSafeSequence();
+    Stats::process().add(Stat::SAFETY_ROUNDS, found.rounds);
+    Stats::process().add(Stat::VECTOR_COMPARISONS, found.comparisons);
+    Stats::process().add(Stat::PROCESSES_FINISHED, found.length);
+    Stats::process().recordRounds(std::span<const uint64_t>(found.finishedPerRound.data(), std::min<size_t>(found.rounds, STATS_MAX_ROUNDS)));
+    return found;
+}
+
+template <size_t... Ps, size_t... Rs>
+std::optional<SafetyReport> checkSafetyFixedShapes(FixedShapeList<FixedShape<Ps, Rs>...>, std::span<const size_t> availableVector,
+                                                   ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    if (availableVector.size() != maxMatrix.cols() || allocationMatrix.rows() != maxMatrix.rows() || allocationMatrix.cols() != maxMatrix.cols()) {
+        return std::nullopt;
+    }
+
+    std::optional<SafetyReport> report;
+    auto checkAs = [&]<size_t P, size_t R>(FixedShape<P, R>) {
+        if (maxMatrix.rows() != P || maxMatrix.cols() != R) {
+            return false;
+        }
+        const FixedSafeSequence<P> found = findSafeSequenceFixed<P, R>(availableVector, maxMatrix, allocationMatrix);
+        if (found.safe) {
+            report.emplace();
+            report->safe = true;
+            report->sequence.assign(found.sequence.begin(), found.sequence.end());
+        }
+        return true;
+    };
+    (checkAs(FixedShape<Ps, Rs>()) || ...);
+    return report;
+}
+
+// Check a snapshot with the FixedBankerAlgorithm of its shape when that is one of CompiledFixedShapes
+// Returns nothing when it is not, or when the snapshot is unsafe, as the deadlock is diagnosed by BankerAlgorithm
+// Only the FIFO sequence of the scan engine is found, so callers asking for another engine or order must not use it
+inline std::optional<SafetyReport> checkSafetyFixed(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    return checkSafetyFixedShapes(CompiledFixedShapes(), availableVector, maxMatrix, allocationMatrix);
+}
+
+// Snapshots shipped with the program, checked by the compiler
+// sample.txt
+inline constexpr FixedSnapshot<5, 3> SAMPLE_SNAPSHOT = {
+    {3, 3, 2},
+    {{{7, 5, 3}, {3, 2, 2}, {9, 0, 2}, {2, 2, 2}, {4, 3, 3}}},
+    {{{0, 1, 0}, {2, 0, 0}, {3, 0, 2}, {2, 1, 1}, {0, 0, 2}}}
+};
+static_assert(FixedBankerAlgorithm<5, 3>(SAMPLE_SNAPSHOT).findSafeSequence().sequence == std::array<size_t, 5>{1, 3, 4, 0, 2},
+              "sample.txt must be safe with the sequence (1, 3, 4, 0, 2)");
+
+// example1.txt
+inline constexpr FixedSnapshot<5, 3> EXAMPLE1_SNAPSHOT = {
+    {7, 5, 7},
+    {{{6, 5, 3}, {4, 2, 1}, {5, 1, 2}, {1, 0, 2}, {5, 2, 3}}},
+    {{{1, 0, 2}, {3, 1, 0}, {0, 1, 1}, {1, 0, 1}, {1, 0, 2}}}
+};
+static_assert(FixedBankerAlgorithm<5, 3>(EXAMPLE1_SNAPSHOT).isSafe(), "example1.txt must be safe");
+
+// example2.txt
+inline constexpr FixedSnapshot<4, 4> EXAMPLE2_SNAPSHOT = {
+    {1, 0, 2, 0},
+    {{{3, 1, 1, 1}, {0, 2, 1, 2}, {4, 1, 1, 1}, {1, 1, 1, 1}}},
+    {{{2, 0, 1, 1}, {0, 1, 0, 0}, {1, 0, 1, 1}, {1, 1, 0, 1}}}
+};
+static_assert(FixedBankerAlgorithm<4, 4>(EXAMPLE2_SNAPSHOT).isSafe(), "example2.txt must be safe");
+
+// deadlock.txt, the sample with fewer resources available
+inline constexpr FixedSnapshot<5, 3> DEADLOCK_SNAPSHOT = {
+    {1, 0, 2},
+    SAMPLE_SNAPSHOT.maximum,
+    SAMPLE_SNAPSHOT.allocation
+};
+static_assert(!FixedBankerAlgorithm<5, 3>(DEADLOCK_SNAPSHOT).isSafe(), "deadlock.txt must deadlock");
@@ -0,0 +1,79 @@
+// MappedFile.hpp
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::string;
+
+// Whole file, or the start of an open descriptor, mapped into memory read-only
+// An empty file has no mapping and a size of zero
+class MappedFile {
+    public:
+        explicit MappedFile(const string& file_name) {
+            const int fd = open(file_name.c_str(), O_RDONLY);
+            if (fd == -1) {
+                throw std::runtime_error("File Not Found, " + file_name);
+            }
+
+            struct stat status;
+            if (fstat(fd, &status) == -1) {
+                close(fd);
+                throw std::runtime_error("Failed to read file size, " + file_name);
+            }
+            mappedSize = status.st_size;
+
+            if (mappedSize > 0) {
+                mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping == MAP_FAILED) {
+                    mapping = nullptr;
+                    close(fd);
+                    throw std::runtime_error("Failed to map file " + file_name);
+                }
+                // The file is read front to back exactly once
+                madvise(mapping, mappedSize, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+
+        // Map the first size bytes of an open descriptor, such as a shared memory region, which stays open
+        MappedFile(int fd, size_t size, const string& name) : mappedSize(size) {
+            if (mappedSize > 0) {
+                mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+                if (mapping == MAP_FAILED) {
+                    mapping = nullptr;
+                    throw std::runtime_error("Failed to map " + name);
+                }
+            }
+        }
+
+        ~MappedFile() {
+            if (mapping != nullptr) {
+                munmap(mapping, mappedSize);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const {
+            return static_cast<const char*>(mapping);
+        }
+
+        size_t size() const {
+            return mappedSize;
+        }
+
+        std::string_view text() const {
+            return std::string_view(data(), mappedSize);
+        }
+
+    private:
+        void* mapping = nullptr;
+        size_t mappedSize = 0;
+};
@@ -0,0 +1,172 @@
+// ParallelSafety.hpp
+#pragma once
+
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "ResourceKernels.hpp"
+#include "WorkListSafety.hpp"
+#include "ThreadPool.hpp"
+#include "Stats.hpp"
+
+using std::vector;
+
+// Below this many matrix elements (processes * resources) the parallel engine is not worth its synchronization
+// and BankerAlgorithm runs the serial scan instead
+#define PARALLEL_SAFETY_THRESHOLD (1 << 18)
+
+// Number of matrix elements checked by one task of a pass
+#define PARALLEL_SAFETY_GRAIN (1 << 14)
+
+// Safety check that splits every pass over the unfinished processes across a thread pool
+//
+// Ordering guarantee:
+// - SequenceOrder::FIFO returns exactly the sequence of the serial FIFO scan. Every pass first checks all unfinished
+//   processes in parallel against the available vector at the start of the pass. Available resources only grow during
+//   a pass, so a process that fits then also fits when the serial scan reaches it. A serial sweep in index order then
+//   finishes those processes, and only re-checks the ones that did not fit if something has been released earlier in the pass.
+// - SequenceOrder::ANY returns some valid safe sequence. Every pass finishes all processes that fit the available vector at
+//   the start of the pass, in index order, and adds their allocations together in parallel. The sequence can differ from the
+//   serial one, but whether the state is safe does not.
+// T is the unsigned type of a resource count, see BasicResourceMatrix
+template <typename T>
+class BasicParallelSafety {
+    public:
+        // The matrices must stay alive while the object is used
+        // availableVector must be padded to the stride of the matrices
+        BasicParallelSafety(std::span<const T> availableVector, BasicResourceMatrixView<T> needMatrix,
+                            BasicResourceMatrixView<T> allocationMatrix, const BasicResourceKernels<T>& kernels, ThreadPool& pool) :
+                       availableVector(availableVector.begin(), availableVector.end()),
+                       needMatrix(needMatrix), allocationMatrix(allocationMatrix), kernels(kernels), pool(pool) {}
+
+        // Returns the processes in the order they finished
+        // If a deadlock stops some processes from finishing, allFinished() is false afterwards
+        vector<size_t> findSafeSequence(SequenceOrder order) {
+            const size_t numProcesses = needMatrix.rows();
+            const size_t stride = needMatrix.stride();
+            const size_t grain = std::max<size_t>(1, PARALLEL_SAFETY_GRAIN / std::max<size_t>(1, needMatrix.cols()));
+
+            vector<size_t> safeSequence;
+            safeSequence.reserve(numProcesses);
+
+            // Unfinished processes in index order, and whether each fit at the start of the current pass
+            vector<size_t> unfinished(numProcesses);
+            for (size_t i = 0; i < numProcesses; i++) {
+                unfinished[i] = i;
+            }
+            vector<char> fits(numProcesses);
+
+            // Allocations released by each task in a relaxed order pass
+            AlignedVector<T> released;
+            if (order == SequenceOrder::ANY) {
+                released = AlignedVector<T>(((numProcesses + grain - 1) / grain) * stride, 0);
+            }
+            // Set by a task whose released allocations overflowed, tasks cannot throw across the pool
+            std::atomic<bool> releaseOverflowed{false};
+
+            // Counted for Stats
+            vector<uint64_t> finishedPerRound;
+            size_t rounds = 0;
+            std::atomic<uint64_t> comparisons{0};
+            uint64_t sweepComparisons = 0;
+            if (ENABLE_STATS) {
+                finishedPerRound.reserve(std::min<size_t>(numProcesses + 1, STATS_MAX_ROUNDS));
+            }
+
+            bool progress = true;
+            while (progress && !unfinished.empty()) {
+                progress = false;
+
+                // Check every unfinished process against the available vector at the start of the pass
+                pool.parallelFor(0, unfinished.size(), grain, [&](size_t begin, size_t end) {
+                    T* taskReleased = (order == SequenceOrder::ANY) ? released.data() + (begin / grain) * stride : nullptr;
+                    if (taskReleased != nullptr) {
+                        std::fill(taskReleased, taskReleased + stride, 0);
+                    }
+
+                    comparisons.fetch_add(end - begin, std::memory_order_relaxed);
+                    for (size_t k = begin; k < end; k++) {
+                        const size_t process = unfinished[k];
+                        fits[k] = kernels.lessEqual(needMatrix.paddedRow(process).data(), availableVector.data(), stride);
+                        if (fits[k] && taskReleased != nullptr &&
+                            !kernels.addInto(taskReleased, allocationMatrix.paddedRow(process).data(), stride)) {
+                            releaseOverflowed = true;
+                        }
+                    }
+                });
+
+                if (order == SequenceOrder::ANY) {
+                    const size_t numTasks = (unfinished.size() + grain - 1) / grain;
+                    for (size_t task = 0; task < numTasks; task++) {
+                        if (!kernels.addInto(availableVector.data(), released.data() + task * stride, stride)) {
+                            releaseOverflowed = true;
+                        }
+                    }
+                    if (releaseOverflowed) {
+                        throw std::overflow_error("Available resources overflowed while processes released their allocations");
+                    }
+                }
+
+                // Sweep the pass in index order, keeping the processes that did not finish
+                bool releasedThisPass = false;
+                size_t kept = 0;
+                for (size_t k = 0; k < unfinished.size(); k++) {
+                    const size_t process = unfinished[k];
+                    bool finishes = fits[k];
+
+                    if (order == SequenceOrder::FIFO) {
+                        if (!finishes && releasedThisPass) {
+                            sweepComparisons++;
+                            finishes = kernels.lessEqual(needMatrix.paddedRow(process).data(), availableVector.data(), stride);
+                        }
+                        if (finishes) {
+                            if (!kernels.addInto(availableVector.data(), allocationMatrix.paddedRow(process).data(), stride)) {
+                                throw std::overflow_error("Available resources overflowed when process " + std::to_string(process) + " released its allocation");
+                            }
+                            releasedThisPass = true;
+                        }
+                    }
+
+                    if (finishes) {
+                        safeSequence.push_back(process);
+                        progress = true;
+                    } else {
+                        unfinished[kept++] = process;
+                    }
+                }
+                if (ENABLE_STATS && rounds < STATS_MAX_ROUNDS) {
+                    finishedPerRound.push_back(unfinished.size() - kept);
+                }
+                rounds++;
+                unfinished.resize(kept);
+            }
+
+            Stats::process().add(Stat::SAFETY_ROUNDS, rounds);
+            Stats::process().add(Stat::VECTOR_COMPARISONS, comparisons.load() + sweepComparisons);
+            Stats::process().recordRounds(finishedPerRound);
+
+            finishedAll = unfinished.empty();
+            return safeSequence;
+        }
+
+        bool allFinished() const {
+            return finishedAll;
+        }
+
+    private:
+        // Datastructures used for calculating safe sequence
+        AlignedVector<T> availableVector;
+        BasicResourceMatrixView<T> needMatrix;
+        BasicResourceMatrixView<T> allocationMatrix;
+        const BasicResourceKernels<T>& kernels;
+        ThreadPool& pool;
+
+        bool finishedAll = false;
+};
+
+using ParallelSafety = BasicParallelSafety<size_t>;
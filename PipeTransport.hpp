@@ -0,0 +1,744 @@
+// PipeTransport.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <optional>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "ResourceMatrix.hpp"
+#include "BinarySnapshot.hpp"
+#include "MappedFile.hpp"
+#include "ProgramSnapshotReader.hpp"
+#include "Stats.hpp"
+#include "SafetyReport.hpp"
+#include "SnapshotDelta.hpp"
+
+#define READ_END 0
+#define WRITE_END 1
+
+using std::vector, std::string;
+
+// How a snapshot is sent from the parent process to the child
+enum class Transport {
+    // One write per element, the original protocol
+    ELEMENT,
+    // The binary snapshot image as one length-prefixed frame, gathered straight out of the matrices with writev
+    FRAMED,
+    // The binary snapshot image in a memfd shared memory region the child maps, only its size crosses the pipe
+    SHARED_MEMORY,
+    // A keyframe with the whole snapshot, then only what changed since the snapshot sent before, see SnapshotDelta.hpp
+    DELTA
+};
+
+inline const char* transportName(Transport transport) {
+    switch (transport) {
+        case Transport::ELEMENT: return "element";
+        case Transport::FRAMED: return "framed";
+        case Transport::SHARED_MEMORY: return "shm";
+        case Transport::DELTA: return "delta";
+    }
+    return "unknown";
+}
+
+// write and read, counting the call and the bytes transferred in Stats
+inline ssize_t countedWrite(int fd, const void* data, size_t bytes) {
+    const ssize_t written = write(fd, data, bytes);
+    Stats::process().add(Stat::PIPE_WRITE_CALLS, 1);
+    Stats::process().add(Stat::PIPE_BYTES_WRITTEN, written > 0 ? written : 0);
+    return written;
+}
+
+inline ssize_t countedRead(int fd, void* data, size_t bytes) {
+    const ssize_t received = read(fd, data, bytes);
+    Stats::process().add(Stat::PIPE_READ_CALLS, 1);
+    Stats::process().add(Stat::PIPE_BYTES_READ, received > 0 ? received : 0);
+    return received;
+}
+
+// Write every byte to fd, carrying on after short writes and interrupted calls
+inline void writeFull(int fd, const void* data, size_t bytes, const string& what) {
+    const char* cursor = static_cast<const char*>(data);
+    while (bytes > 0) {
+        const ssize_t written = countedWrite(fd, cursor, bytes);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            throw std::runtime_error(what + " write to pipe failed.");
+        }
+        cursor += written;
+        bytes -= written;
+    }
+}
+
+// Read exactly bytes from fd, carrying on after short reads and interrupted calls
+inline void readFull(int fd, void* data, size_t bytes, const string& what) {
+    char* cursor = static_cast<char*>(data);
+    while (bytes > 0) {
+        const ssize_t received = countedRead(fd, cursor, bytes);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            throw std::runtime_error(what + " read from pipe failed.");
+        }
+        cursor += received;
+        bytes -= received;
+    }
+}
+
+// Write every part to fd with as few writev calls as possible, carrying on after short writes
+inline void writevFull(int fd, vector<iovec>& parts, const string& what) {
+    size_t first = 0;
+    while (first < parts.size()) {
+        const int count = static_cast<int>(std::min<size_t>(parts.size() - first, IOV_MAX));
+        ssize_t written = writev(fd, parts.data() + first, count);
+        Stats::process().add(Stat::PIPE_WRITE_CALLS, 1);
+        Stats::process().add(Stat::PIPE_BYTES_WRITTEN, written > 0 ? written : 0);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            throw std::runtime_error(what + " write to pipe failed.");
+        }
+
+        // Skip the parts written completely, and the written front of a part written partly
+        while (first < parts.size() && static_cast<size_t>(written) >= parts[first].iov_len) {
+            written -= parts[first].iov_len;
+            first++;
+        }
+        if (written > 0) {
+            parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + written;
+            parts[first].iov_len -= written;
+        }
+    }
+}
+
+// Send ProgramSnapshotReader Object over Pipe
+inline void sendObjectOverPipe(int fd[2], ProgramSnapshotReader& obj) {
+    const auto& availableVector = obj.getAvailableResources();
+    const ResourceMatrix& maximumMatrix = obj.getMaximumMatrix();
+    const ResourceMatrix& allocationMatrix = obj.getAllocationMatrix();
+
+    size_t row_counter = 0;
+    size_t col_counter = 0;
+
+    // Send Available Resources Vector
+    // First, send the size of the vector
+    size_t size_availableVector = availableVector.size();
+    if (countedWrite(fd[WRITE_END], &size_availableVector, sizeof(size_availableVector)) != sizeof(size_availableVector)) {
+        throw std::runtime_error("availableVector size write to pipe failed.");
+    }
+    // Next, send each value of the vector
+    for (auto value: availableVector) {
+        if (countedWrite(fd[WRITE_END], &value, sizeof(value)) != sizeof(value)) {
+            throw std::runtime_error("availableVector write to pipe failed.");
+        }
+    }
+
+    
+    // Send Maximum Matrix
+    // First, send the number of rows in the vector
+    size_t size_maximumMatrix = maximumMatrix.rows();
+    if (countedWrite(fd[WRITE_END], &size_maximumMatrix, sizeof(size_maximumMatrix)) != sizeof(size_maximumMatrix)) {
+        throw std::runtime_error("maximumMatrix number of rows write to pipe failed.");
+    }
+
+    for (size_t r = 0; r < maximumMatrix.rows(); r++) {
+        auto row = maximumMatrix.row(r);
+
+        // Next, send the size of the row
+        size_t row_size = row.size();
+        if (countedWrite(fd[WRITE_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
+            throw std::runtime_error(std::to_string(row_counter) + "th row of Maximum Matrix size write to pipe failed.");
+        }
+        
+        // Finally, send the row's contents
+        col_counter = 0;
+        for (auto value: row) {
+            if(countedWrite(fd[WRITE_END], &value, sizeof(value)) != sizeof(value)) {
+                throw std::runtime_error(
+                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
+                    "th row of Maximum Matrix write to pipe failed.");
+            }
+
+            col_counter++;
+        }
+        row_counter++;
+    }
+
+
+    // Send Allocation Matrix
+    // First, send the number of rows in the vector
+    size_t size_allocationMatrix = allocationMatrix.rows();
+    if (countedWrite(fd[WRITE_END], &size_allocationMatrix, sizeof(size_allocationMatrix)) != sizeof(size_allocationMatrix)) {
+        throw std::runtime_error("allocationMatrix number of rows write to pipe failed.");
+    }
+
+    for (size_t r = 0; r < allocationMatrix.rows(); r++) {
+        auto row = allocationMatrix.row(r);
+
+        // Next, send the size of the row
+        size_t row_size = row.size();
+        if (countedWrite(fd[WRITE_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
+            throw std::runtime_error(std::to_string(row_counter) + "th row of Allocation Matrix size write to pipe failed.");
+        }
+        
+        // Finally, send the row's contents
+        col_counter = 0;
+        for (auto value: row) {
+            if(countedWrite(fd[WRITE_END], &value, sizeof(value)) != sizeof(value)) {
+                throw std::runtime_error(
+                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
+                    "th row of Allocation Matrix write to pipe failed.");
+            }
+
+            col_counter++;
+        }
+        row_counter++;
+    }
+
+    return;
+}
+
+// Receive ProgramSnapshotReader Object from Pipe
+inline void receiveObjectOverPipe(int fd[2], ProgramSnapshotReader& obj) {
+    std::vector<size_t> availableVector;
+    ResourceMatrix maximumMatrix;
+    ResourceMatrix allocationMatrix;
+
+    // counters used for throwing errors
+    size_t row_counter = 0;
+    size_t col_counter = 0;
+
+    // Every row is received into the same buffer, and each matrix reserves all of its rows once the first one has been appended
+    std::vector<size_t> row;
+
+    // Receive available resources vector
+    // First, receive the size of the vector
+    size_t size_availableVector;
+    if (countedRead(fd[READ_END], &size_availableVector, sizeof(size_availableVector)) != sizeof(size_availableVector)) {
+        throw std::runtime_error("availableVector size read from pipe failed.");
+    }
+    availableVector = vector<size_t>(size_availableVector, 0);
+    // Next, receive each value of the vector
+    for (auto &value: availableVector) {
+        if (countedRead(fd[READ_END], &value, sizeof(value)) != sizeof(value)) {
+            throw std::runtime_error("availableVector read from pipe failed.");
+        }
+    }
+
+    // Receive Maximum Matrix
+    // First, receive the number of rows in the vector
+    size_t size_maximumMatrix;
+    if (countedRead(fd[READ_END], &size_maximumMatrix, sizeof(size_maximumMatrix)) != sizeof(size_maximumMatrix)) {
+        throw std::runtime_error("maximumMatrix number of rows read from pipe failed.");
+    }
+
+    for (size_t r = 0; r < size_maximumMatrix; r++) {
+        // Next, receive the size of the row
+        size_t row_size;
+        if (countedRead(fd[READ_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
+            throw std::runtime_error(std::to_string(row_counter) + "th row of Maximum Matrix size read from pipe failed.");
+        }
+        row.resize(row_size);
+
+        // Finally, receive the row's contents
+        col_counter = 0;
+        for (auto& value: row) {
+            if(countedRead(fd[READ_END], &value, sizeof(value)) != sizeof(value)) {
+                throw std::runtime_error(
+                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
+                    "th row of Maximum Matrix read from pipe failed.");
+            }
+
+            col_counter++;
+        }
+        maximumMatrix.appendRow(row);
+        if (r == 0) {
+            maximumMatrix.reserveRows(size_maximumMatrix);
+        }
+        row_counter++;
+    }
+
+
+    // Receive Allocation Matrix
+    // First, receive the number of rows in the vector
+    size_t size_allocationMatrix;
+    if (countedRead(fd[READ_END], &size_allocationMatrix, sizeof(size_allocationMatrix)) != sizeof(size_allocationMatrix)) {
+        throw std::runtime_error("allocationMatrix number of rows read from pipe failed.");
+    }
+
+    for (size_t r = 0; r < size_allocationMatrix; r++) {
+        // Next, receive the size of the row
+        size_t row_size;
+        if (countedRead(fd[READ_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
+            throw std::runtime_error(std::to_string(row_counter) + "th row of Allocation Matrix size read from pipe failed.");
+        }
+        row.resize(row_size);
+
+        // Finally, receive the row's contents
+        col_counter = 0;
+        for (auto& value: row) {
+            if(countedRead(fd[READ_END], &value, sizeof(value)) != sizeof(value)) {
+                throw std::runtime_error(
+                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
+                    "th row of Allocation Matrix read from pipe failed.");
+            }
+
+            col_counter++;
+        }
+        allocationMatrix.appendRow(row);
+        if (r == 0) {
+            allocationMatrix.reserveRows(size_allocationMatrix);
+        }
+        row_counter++;
+    }
+
+    // Set the passed object's value to the ones read from fd
+    obj.setAvailableResources(std::move(availableVector));
+    obj.setMaximumMatrix(std::move(maximumMatrix));
+    obj.setallocationMatrix(std::move(allocationMatrix));
+
+    return;
+}
+
+// Send String over Pipe
+inline void sendStringOverPipe(int fd[2], const string& message) {
+    // First, send length of string to pipe, then the string's raw value including its terminator
+    size_t msglen = message.size() + 1;
+    writeFull(fd[WRITE_END], &msglen, sizeof(msglen), "String length");
+    writeFull(fd[WRITE_END], message.c_str(), msglen, "String");
+}
+
+// Receive String from Pipe
+inline string receiveStringOverPipe(int fd[2]) {
+    // First, receive length of string from pipe, then the string itself
+    size_t msglen;
+    readFull(fd[READ_END], &msglen, sizeof(msglen), "String length");
+    if (msglen == 0) {
+        throw std::runtime_error("String length read from pipe failed.");
+    }
+
+    string out(msglen, '\0');
+    readFull(fd[READ_END], out.data(), msglen, "String");
+    out.resize(msglen - 1);
+    return out;
+}
+
+// Send the counters of this process over Pipe, as the counters followed by the length and contents of the round list
+inline void sendStatsOverPipe(int fd[2], const StatsReport& report) {
+    writeFull(fd[WRITE_END], report.counters.data(), sizeof(report.counters), "Stats");
+    const uint64_t numRounds = report.finishedPerRound.size();
+    writeFull(fd[WRITE_END], &numRounds, sizeof(numRounds), "Stats round count");
+    writeFull(fd[WRITE_END], report.finishedPerRound.data(), numRounds * sizeof(uint64_t), "Stats rounds");
+}
+
+// Receive counters sent by sendStatsOverPipe
+inline StatsReport receiveStatsOverPipe(int fd[2]) {
+    StatsReport report;
+    readFull(fd[READ_END], report.counters.data(), sizeof(report.counters), "Stats");
+    uint64_t numRounds;
+    readFull(fd[READ_END], &numRounds, sizeof(numRounds), "Stats round count");
+    report.finishedPerRound.resize(numRounds);
+    readFull(fd[READ_END], report.finishedPerRound.data(), numRounds * sizeof(uint64_t), "Stats rounds");
+    return report;
+}
+
+// Send a sparse snapshot over Pipe with one writev: the number of processes, resource types and non-zero entries of both
+// matrices, then the available vector and the row starts, columns and values of the maximum and allocation matrices
+inline void sendSparseSnapshotOverPipe(int fd[2], const SparseSnapshot& snapshot) {
+    StatTimer timer(Stat::TRANSFER_NANOSECONDS);
+    const uint64_t dimensions[4] = {snapshot.maxMatrix.rows(), snapshot.maxMatrix.cols(), snapshot.maxMatrix.nonZeros(), snapshot.allocationMatrix.nonZeros()};
+
+    vector<iovec> parts;
+    auto add = [&](const void* data, size_t bytes) {
+        if (bytes > 0) {
+            parts.push_back({const_cast<void*>(data), bytes});
+        }
+    };
+    add(dimensions, sizeof(dimensions));
+    add(snapshot.availableVector.data(), snapshot.availableVector.size() * sizeof(size_t));
+    for (const SparseResourceMatrix* matrix: {&snapshot.maxMatrix, &snapshot.allocationMatrix}) {
+        add(matrix->rowStarts().data(), matrix->rowStarts().size() * sizeof(size_t));
+        add(matrix->columnIndices().data(), matrix->nonZeros() * sizeof(uint32_t));
+        add(matrix->entryValues().data(), matrix->nonZeros() * sizeof(size_t));
+    }
+    writevFull(fd[WRITE_END], parts, "Sparse snapshot");
+}
+
+// Receive a sparse snapshot sent by sendSparseSnapshotOverPipe
+inline SparseSnapshot receiveSparseSnapshotOverPipe(int fd[2]) {
+    StatTimer timer(Stat::TRANSFER_NANOSECONDS);
+    uint64_t dimensions[4];
+    readFull(fd[READ_END], dimensions, sizeof(dimensions), "Sparse snapshot dimensions");
+    const auto [numProcesses, numResources, maximumNonZeros, allocationNonZeros] = dimensions;
+
+    SparseSnapshot snapshot;
+    snapshot.availableVector.resize(numResources);
+    readFull(fd[READ_END], snapshot.availableVector.data(), numResources * sizeof(size_t), "Sparse snapshot available vector");
+
+    auto receiveMatrix = [&](uint64_t nonZeros) {
+        vector<size_t> rowStart(numProcesses + 1);
+        vector<uint32_t> columns(nonZeros);
+        vector<size_t> values(nonZeros);
+        readFull(fd[READ_END], rowStart.data(), rowStart.size() * sizeof(size_t), "Sparse snapshot row starts");
+        readFull(fd[READ_END], columns.data(), nonZeros * sizeof(uint32_t), "Sparse snapshot columns");
+        readFull(fd[READ_END], values.data(), nonZeros * sizeof(size_t), "Sparse snapshot values");
+        return SparseResourceMatrix::fromArrays(numResources, std::move(rowStart), std::move(columns), std::move(values));
+    };
+    snapshot.maxMatrix = receiveMatrix(maximumNonZeros);
+    snapshot.allocationMatrix = receiveMatrix(allocationNonZeros);
+    return snapshot;
+}
+
+// Send a safety report over Pipe as one block of 64-bit words, see encodeSafetyReport, preceded by their number
+inline void sendSafetyReportOverPipe(int fd[2], const SafetyReport& report) {
+    const vector<uint64_t> words = encodeSafetyReport(report);
+    const uint64_t numWords = words.size();
+    writeFull(fd[WRITE_END], &numWords, sizeof(numWords), "Safety report length");
+    writeFull(fd[WRITE_END], words.data(), numWords * sizeof(uint64_t), "Safety report");
+}
+
+// Receive a safety report sent by sendSafetyReportOverPipe
+inline SafetyReport receiveSafetyReportOverPipe(int fd[2]) {
+    uint64_t numWords;
+    readFull(fd[READ_END], &numWords, sizeof(numWords), "Safety report length");
+    vector<uint64_t> words(numWords);
+    readFull(fd[READ_END], words.data(), numWords * sizeof(uint64_t), "Safety report");
+    return decodeSafetyReport(words, "Safety report read from pipe");
+}
+
+// Thrown when a delta frame does not follow the frame the receiver applied last
+// The frame has been read, so the pipe is still in step, but the sender must send a keyframe before any further delta
+class SnapshotOutOfStep : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+// Snapshot received from the parent process
+// Owns whatever the transport received it into, and the views it hands out stay valid until the next receive or as
+// long as the object lives. The delta transport patches the previous snapshot, so it must keep receiving into the same object.
+class ReceivedSnapshot {
+    public:
+        ReceivedSnapshot() = default;
+
+        ReceivedSnapshot(const ReceivedSnapshot&) = delete;
+        ReceivedSnapshot& operator=(const ReceivedSnapshot&) = delete;
+
+        std::span<const size_t> getAvailableResources() const {
+            return available;
+        }
+
+        ResourceMatrixView getMaximumMatrix() const {
+            return maxView;
+        }
+
+        ResourceMatrixView getAllocationMatrix() const {
+            return allocationView;
+        }
+
+        // Receive one value at a time with receiveObjectOverPipe
+        void receiveElements(int fd[2]) {
+            ProgramSnapshotReader reader;
+            receiveObjectOverPipe(fd, reader);
+            availableVector = reader.takeAvailableResources();
+            maxMatrix = reader.takeMaximumMatrix();
+            allocationMatrix = reader.takeAllocationMatrix();
+
+            available = availableVector;
+            maxView = maxMatrix;
+            allocationView = allocationMatrix;
+        }
+
+        // Receive a binary snapshot image framed by its length in bytes
+        void receiveFrame(int fd[2]) {
+            uint64_t imageSize;
+            readFull(fd[READ_END], &imageSize, sizeof(imageSize), "Snapshot frame length");
+            image.resize(imageSize);
+            readFull(fd[READ_END], image.data(), imageSize, "Snapshot frame");
+            useImage(BinarySnapshotView(image.data(), imageSize, "snapshot frame received from pipe"));
+        }
+
+        // Receive the size of the binary snapshot image written into the shared memory region memoryFD, and map it
+        void receiveSharedMemory(int fd[2], int memoryFD) {
+            uint64_t imageSize;
+            readFull(fd[READ_END], &imageSize, sizeof(imageSize), "Shared memory snapshot size");
+            mapping.emplace(memoryFD, imageSize, "shared memory snapshot");
+            useImage(BinarySnapshotView(mapping->data(), imageSize, "shared memory snapshot"));
+        }
+
+        // Receive a keyframe into this snapshot, or a delta to patch it with
+        // Throws SnapshotOutOfStep if a delta is not based on the frame received last
+        void receiveDelta(int fd[2]) {
+            DeltaFrameHeader header;
+            readFull(fd[READ_END], &header, sizeof(header), "Snapshot delta header");
+            if (header.kind == static_cast<uint64_t>(DeltaFrameKind::KEYFRAME)) {
+                availableVector.resize(header.numResources);
+                maxMatrix = ResourceMatrix(header.numProcesses, header.numResources);
+                allocationMatrix = ResourceMatrix(header.numProcesses, header.numResources);
+                vector<iovec> parts = {
+                    {availableVector.data(), availableVector.size() * sizeof(size_t)},
+                    {maxMatrix.data(), maxMatrix.rows() * maxMatrix.stride() * sizeof(size_t)},
+                    {allocationMatrix.data(), allocationMatrix.rows() * allocationMatrix.stride() * sizeof(size_t)}
+                };
+                for (auto& part: parts) {
+                    readFull(fd[READ_END], part.iov_base, part.iov_len, "Snapshot keyframe");
+                }
+            } else {
+                deltaWords.resize(deltaPayloadWords(header));
+                readFull(fd[READ_END], deltaWords.data(), deltaWords.size() * sizeof(uint64_t), "Snapshot delta");
+                if (header.baseSequence != deltaSequence || deltaSequence == 0) {
+                    deltaSequence = 0;
+                    throw SnapshotOutOfStep("Snapshot delta " + std::to_string(header.sequence) + " is based on frame " +
+                                            std::to_string(header.baseSequence) + ", not on the frame received last.");
+                }
+                try {
+                    applySnapshotDelta(header, deltaWords, availableVector, maxMatrix, allocationMatrix);
+                } catch (const std::runtime_error& e) {
+                    deltaSequence = 0;
+                    throw SnapshotOutOfStep(e.what());
+                }
+            }
+            deltaSequence = header.sequence;
+
+            available = availableVector;
+            maxView = maxMatrix;
+            allocationView = allocationMatrix;
+        }
+
+    private:
+        void useImage(const BinarySnapshotView& snapshot) {
+            available = snapshot.getAvailableResources();
+            maxView = snapshot.getMaximumMatrix();
+            allocationView = snapshot.getAllocationMatrix();
+        }
+
+        // Storage of the element and delta transports
+        vector<size_t> availableVector;
+        ResourceMatrix maxMatrix;
+        ResourceMatrix allocationMatrix;
+
+        // Number of the delta frame received last, 0 once a delta could not be applied
+        uint64_t deltaSequence = 0;
+        vector<uint64_t> deltaWords;
+
+        // Storage of the framed and shared memory transports
+        AlignedVector<char> image;
+        std::optional<MappedFile> mapping;
+
+        std::span<const size_t> available;
+        ResourceMatrixView maxView;
+        ResourceMatrixView allocationView;
+};
+
+// Sends snapshots from the parent process to the child over a pipe with the selected transport
+// Must be created before forking, so the child inherits the shared memory region of Transport::SHARED_MEMORY
+class SnapshotTransport {
+    public:
+        explicit SnapshotTransport(Transport transport) : transport(transport) {
+            if (transport == Transport::SHARED_MEMORY) {
+                memoryFD = memfd_create("bankers-snapshot", MFD_CLOEXEC);
+                if (memoryFD == -1) {
+                    throw std::runtime_error("Shared Memory Creation Failed");
+                }
+            }
+        }
+
+        ~SnapshotTransport() {
+            if (memoryFD != -1) {
+                close(memoryFD);
+            }
+        }
+
+        SnapshotTransport(const SnapshotTransport&) = delete;
+        SnapshotTransport& operator=(const SnapshotTransport&) = delete;
+
+        Transport kind() const {
+            return transport;
+        }
+
+        // Send a snapshot to the other end of fd
+        // With Transport::SHARED_MEMORY the previous snapshot is overwritten, so the child must be done with it
+        void send(int fd[2], std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            StatTimer timer(Stat::TRANSFER_NANOSECONDS);
+            switch (transport) {
+                case Transport::ELEMENT:
+                    sendElements(fd, availableVector, maxMatrix, allocationMatrix);
+                    break;
+                case Transport::FRAMED:
+                    sendFrame(fd, availableVector, maxMatrix, allocationMatrix);
+                    break;
+                case Transport::SHARED_MEMORY:
+                    sendSharedMemory(fd, availableVector, maxMatrix, allocationMatrix);
+                    break;
+                case Transport::DELTA:
+                    sendDelta(fd, availableVector, maxMatrix, allocationMatrix);
+                    break;
+            }
+        }
+
+        // Send the snapshot sent last again as a keyframe, once the receiver reported SnapshotOutOfStep
+        void resendKeyframe(int fd[2]) {
+            StatTimer timer(Stat::TRANSFER_NANOSECONDS);
+            sendKeyframe(fd, baseAvailable, baseMax, baseAllocation);
+        }
+
+        // Receive a snapshot sent from the other end of fd
+        void receive(int fd[2], ReceivedSnapshot& snapshot) const {
+            StatTimer timer(Stat::TRANSFER_NANOSECONDS);
+            switch (transport) {
+                case Transport::ELEMENT:
+                    snapshot.receiveElements(fd);
+                    break;
+                case Transport::FRAMED:
+                    snapshot.receiveFrame(fd);
+                    break;
+                case Transport::SHARED_MEMORY:
+                    snapshot.receiveSharedMemory(fd, memoryFD);
+                    break;
+                case Transport::DELTA:
+                    snapshot.receiveDelta(fd);
+                    break;
+            }
+        }
+
+    private:
+        void sendElements(int fd[2], std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            ProgramSnapshotReader reader;
+            reader.setAvailableResources(availableVector);
+            reader.setMaximumMatrix(ResourceMatrix(maxMatrix));
+            reader.setallocationMatrix(ResourceMatrix(allocationMatrix));
+            sendObjectOverPipe(fd, reader);
+        }
+
+        // The frame length followed by the segments of the image, with the gaps between them taken from a block of zeros
+        void sendFrame(int fd[2], std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            static const char zeros[RESOURCE_MATRIX_ALIGNMENT] = {};
+
+            const BinarySnapshotHeader header = makeBinarySnapshotHeader(maxMatrix.rows(), availableVector.size());
+            const auto segments = binarySnapshotSegments(header, availableVector, maxMatrix, allocationMatrix);
+            const uint64_t imageSize = header.fileSize;
+
+            vector<iovec> parts;
+            parts.reserve(2 * segments.size() + 2);
+            parts.push_back({const_cast<uint64_t*>(&imageSize), sizeof(imageSize)});
+
+            uint64_t offset = 0;
+            auto addZeros = [&](uint64_t end) {
+                while (offset < end) {
+                    const size_t bytes = std::min<uint64_t>(end - offset, sizeof(zeros));
+                    parts.push_back({const_cast<char*>(zeros), bytes});
+                    offset += bytes;
+                }
+            };
+            for (const auto& segment: segments) {
+                addZeros(segment.offset);
+                parts.push_back({const_cast<void*>(segment.data), segment.bytes});
+                offset += segment.bytes;
+            }
+            addZeros(imageSize);
+
+            writevFull(fd[WRITE_END], parts, "Snapshot frame");
+        }
+
+        // Write the image into the shared memory region, then tell the child its size
+        void sendSharedMemory(int fd[2], std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            const BinarySnapshotHeader header = makeBinarySnapshotHeader(maxMatrix.rows(), availableVector.size());
+            const auto segments = binarySnapshotSegments(header, availableVector, maxMatrix, allocationMatrix);
+            const uint64_t imageSize = header.fileSize;
+
+            if (ftruncate(memoryFD, imageSize) == -1) {
+                throw std::runtime_error("Shared memory resize failed.");
+            }
+            void* region = mmap(nullptr, imageSize, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFD, 0);
+            if (region == MAP_FAILED) {
+                throw std::runtime_error("Shared memory map failed.");
+            }
+            encodeBinarySnapshot(static_cast<char*>(region), imageSize, segments);
+            munmap(region, imageSize);
+
+            writeFull(fd[WRITE_END], &imageSize, sizeof(imageSize), "Shared memory snapshot size");
+        }
+
+        // A delta from the snapshot sent last when there is one and it is smaller, otherwise a keyframe
+        // The sent snapshot is patched with the same delta, so it always matches what the receiver holds.
+        void sendDelta(int fd[2], std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            DeltaFrameHeader header;
+            if (sentSequence == 0 || !encodeSnapshotDelta(baseAvailable, baseMax, baseAllocation, availableVector, maxMatrix, allocationMatrix,
+                                                          header, deltaWords)) {
+                baseAvailable.assign(availableVector.begin(), availableVector.end());
+                baseMax = ResourceMatrix(maxMatrix);
+                baseAllocation = ResourceMatrix(allocationMatrix);
+                sendKeyframe(fd, baseAvailable, baseMax, baseAllocation);
+                return;
+            }
+
+            header.baseSequence = sentSequence;
+            header.sequence = ++sentSequence;
+            vector<iovec> parts = {
+                {&header, sizeof(header)},
+                {deltaWords.data(), deltaWords.size() * sizeof(uint64_t)}
+            };
+            try {
+                writevFull(fd[WRITE_END], parts, "Snapshot delta");
+            } catch (const std::runtime_error&) {
+                // The receiver may have part of the frame, so nothing further can be based on it
+                sentSequence = 0;
+                throw;
+            }
+            applySnapshotDelta(header, deltaWords, baseAvailable, baseMax, baseAllocation);
+        }
+
+        // Every row is sent with its padding, so the receiver reads each matrix straight into its storage
+        void sendKeyframe(int fd[2], std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            static const size_t zeros[RESOURCE_MATRIX_ALIGNMENT / sizeof(size_t)] = {};
+
+            const size_t numResources = availableVector.size();
+            const size_t padding = ResourceMatrix::paddedStride(numResources) - numResources;
+            DeltaFrameHeader header = {static_cast<uint64_t>(DeltaFrameKind::KEYFRAME), ++sentSequence, 0, maxMatrix.rows(), numResources, 0, 0, 0};
+
+            vector<iovec> parts;
+            parts.reserve(2 + 4 * maxMatrix.rows());
+            parts.push_back({&header, sizeof(header)});
+            parts.push_back({const_cast<size_t*>(availableVector.data()), numResources * sizeof(size_t)});
+            for (ResourceMatrixView matrix: {maxMatrix, allocationMatrix}) {
+                if (matrix.stride() == numResources + padding) {
+                    parts.push_back({const_cast<size_t*>(matrix.data()), matrix.rows() * matrix.stride() * sizeof(size_t)});
+                    continue;
+                }
+                for (size_t r = 0; r < matrix.rows(); r++) {
+                    parts.push_back({const_cast<size_t*>(matrix.row(r).data()), numResources * sizeof(size_t)});
+                    if (padding > 0) {
+                        parts.push_back({const_cast<size_t*>(zeros), padding * sizeof(size_t)});
+                    }
+                }
+            }
+            try {
+                writevFull(fd[WRITE_END], parts, "Snapshot keyframe");
+            } catch (const std::runtime_error&) {
+                sentSequence = 0;
+                throw;
+            }
+        }
+
+        Transport transport;
+        int memoryFD = -1;
+
+        // Delta transport: the snapshot the receiver holds once it has applied the frame sent last, and the number of that
+        // frame, 0 before the first keyframe or after a failed send
+        vector<size_t> baseAvailable;
+        ResourceMatrix baseMax;
+        ResourceMatrix baseAllocation;
+        uint64_t sentSequence = 0;
+        vector<uint64_t> deltaWords;
+};
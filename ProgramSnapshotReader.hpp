@@ -3,10 +3,20 @@
 
 #include <vector>
 #include <string>
+#include <span>
+#include <memory_resource>
 #include <filesystem>
 #include <iostream>
-#include <fstream>
 #include <stdexcept>
+#include <string_view>
+#include <charconv>
+#include <cstring>
+
+#include "ResourceMatrix.hpp"
+#include "BinarySnapshot.hpp"
+#include "SparseSnapshot.hpp"
+#include "Stats.hpp"
+#include "MappedFile.hpp"
 
 using std::vector, std::string;
 
@@ -20,47 +30,100 @@ public:
         read(file_name);
     }
 
-    // Read data from plain text file and extract Program Snapshot data and populate available, max, and allocation datastructures
+    // Creates a ProgramSnapshotReader Object whose datastructures are allocated from resource, such as a SnapshotArena,
+    // instead of the global allocator. The resource must outlive the reader and everything taken out of it.
+    explicit ProgramSnapshotReader(std::pmr::memory_resource* resource) :
+                                   availableVector(resourceOrDefault(resource)), maxMatrix(resource), allocationMatrix(resource),
+                                   rowScratch(resourceOrDefault(resource)) {}
+
+    ProgramSnapshotReader(const string &file_name, std::pmr::memory_resource* resource) : ProgramSnapshotReader(resource) {
+        read(file_name);
+    }
+
+    // Creates a ProgramSnapshotReader Object and reads a file the caller has already mapped, file_name names it in errors
+    ProgramSnapshotReader(const MappedFile &file, const string &file_name, std::pmr::memory_resource* resource = nullptr) :
+                          ProgramSnapshotReader(resource) {
+        read(file, file_name);
+    }
+
+    // Read data from a plain text or binary file and extract Program Snapshot data and populate available, max, and allocation datastructures
+    // The format is detected from the start of the file, see BinarySnapshot.hpp. Sparse snapshots, see SparseSnapshot.hpp,
+    // are expanded into dense matrices.
+    // The file is mapped once, and the format is detected and every format read from that one mapping, so reading a text
+    // snapshot allocates nothing but the datastructures
     void read(const string &file_name) {
-        // check if file was downloaded and exit if it cannot find it
-        if (!std::filesystem::exists(file_name))
-        {
-            throw std::runtime_error("File Not Found, " + file_name);
+        // Throws "File Not Found" if it cannot be opened
+        const MappedFile file(file_name);
+        read(file, file_name);
+    }
+
+    // Read a file the caller has already mapped, such as to look its bytes up in a ResultCache first
+    void read(const MappedFile &file, const string &file_name) {
+        StatTimer timer(Stat::PARSE_NANOSECONDS);
+        if (hasBinarySnapshotMagic(file.text())) {
+            read_from_binary(BinarySnapshotView(file.data(), file.size(), file_name));
+        } else if (isSparseSnapshotContents(file.text())) {
+            read_from_sparse(SparseSnapshotReader(file.text(), file_name));
+        } else {
+            read_from_text(file.text());
         }
-        read_from_file(file_name);
         checkValidity();
         return;
     }
 
-    auto getAvailableResources() const{
+    // The getters return references into the reader, which stay valid until it is read into again or destroyed
+    const std::pmr::vector<size_t>& getAvailableResources() const{
         return availableVector;
     }
 
-    auto getMaximumMatrix() const{
+    const ResourceMatrix& getMaximumMatrix() const{
         return maxMatrix;
     }
 
-    auto getAllocationMatrix() const{
+    const ResourceMatrix& getAllocationMatrix() const{
         return allocationMatrix;
     }
 
-    void setAvailableResources(auto availableVector) {
-        this->availableVector = availableVector;
+    // Move the datastructures out of the reader without copying them, leaving it empty
+    // The available vector is a single row, and is copied into a vector of the global allocator
+    vector<size_t> takeAvailableResources() {
+        vector<size_t> available(availableVector.begin(), availableVector.end());
+        availableVector.clear();
+        return available;
+    }
+
+    ResourceMatrix takeMaximumMatrix() {
+        return std::move(maxMatrix);
+    }
+
+    ResourceMatrix takeAllocationMatrix() {
+        return std::move(allocationMatrix);
+    }
+
+    // Narrowest count type the snapshot can be analyzed in, see snapshotCountWidth
+    CountWidth countWidth() const{
+        return snapshotCountWidth(availableVector, maxMatrix, allocationMatrix);
+    }
+
+    // The matrix setters move from their argument, so pass an rvalue to hand storage over without copying it
+    void setAvailableResources(std::span<const size_t> availableVector) {
+        this->availableVector.assign(availableVector.begin(), availableVector.end());
     }
 
     void setMaximumMatrix (auto maximumMatrix) {
-        this->maxMatrix = maximumMatrix;
+        this->maxMatrix = std::move(maximumMatrix);
     }
 
     void setallocationMatrix (auto allocationMatrix) {
-        this->allocationMatrix = allocationMatrix;
+        this->allocationMatrix = std::move(allocationMatrix);
     }
 
 private:
-    // Reads file from filename path and populates data using it
-    void read_from_file(const string &file_name)
+    // Parses the text of a memory-mapped file and populates data using it
+    // The text is parsed in a single pass: numbers are written straight into the matrices,
+    // row widths are checked as each row is read, and errors report the line (and column) they were found at
+    void read_from_text(std::string_view text)
     {
-        std::ifstream readFile(file_name);
 
         enum linereaderState
         {
@@ -71,12 +134,17 @@ private:
         };
 
         linereaderState state = NONE;
-        vector<string> lines = separateLines(readFile);
+        size_t position = 0;
+        size_t lineNumber = 0;
+        size_t tokens = 0;
 
-        for (const auto line : lines)
+        while (position < text.size())
         {
+            const std::string_view line = nextLine(text, position);
+            lineNumber++;
+
             // skip excess whitespace
-            if (line == "") 
+            if (isBlank(line))
             {
                 // skip
             }
@@ -103,88 +171,190 @@ private:
                 // put numbers belonging to each matrix/vector into their corresponding data structure
                 switch (state) {
                     case ALLOCATION:
-                        allocationMatrix.push_back(separateNumbers(line));
+                        tokens += parseMatrixRow(allocationMatrix, line, lineNumber, text.substr(position), "Allocation Matrix is Missing an Entry");
                         break;
                     case MAXIMUM:
-                        maxMatrix.push_back(separateNumbers(line));
+                        tokens += parseMatrixRow(maxMatrix, line, lineNumber, text.substr(position), "Maximum Matrix is Missing an Entry");
                         break;
                     case AVAILABLE:
-                        availableVector = separateNumbers(line);
+                        availableVector.clear();
+                        availableVector.reserve(maxNumbers(line));
+                        tokens += parseNumbers(line, lineNumber, [&](size_t value, size_t) {
+                            availableVector.push_back(value);
+                        });
                         break;
                     default:
-                        throw std::runtime_error("Invalid File Format");
+                        throw std::runtime_error("Invalid File Format" + atLine(lineNumber));
                         break;
                 }
             }
-            
+
         }
+
+        Stats::process().add(Stat::LINES_PARSED, lineNumber);
+        Stats::process().add(Stat::TOKENS_PARSED, tokens);
         return;
     }
 
-    // separates lines (text separated by '\n') in istream into a vector of strings
-    vector<string> separateLines(std::istream &textData) const {
-        vector<string> result;
-        string line;
+    // Copies the datastructures out of a memory-mapped binary snapshot
+    void read_from_binary(const BinarySnapshotView &snapshot)
+    {
+        auto available = snapshot.getAvailableResources();
+        availableVector.assign(available.begin(), available.end());
+        maxMatrix = ResourceMatrix(snapshot.getMaximumMatrix(), maxMatrix.memoryResource());
+        allocationMatrix = ResourceMatrix(snapshot.getAllocationMatrix(), allocationMatrix.memoryResource());
+    }
+
+    // Expands a sparse snapshot into the dense datastructures
+    void read_from_sparse(SparseSnapshotReader reader)
+    {
+        SparseSnapshot snapshot = reader.takeSnapshot();
+        availableVector.assign(snapshot.availableVector.begin(), snapshot.availableVector.end());
+        maxMatrix = snapshot.maxMatrix.toDense();
+        allocationMatrix = snapshot.allocationMatrix.toDense();
+    }
 
-        while (getline(textData, line)) {
-            result.push_back(line);
+    // Parses one row of a matrix section into matrix, throwing errorMessage if it does not match the width of the rows before it
+    // The first row of a section sets the width and reserves storage for the rows that follow it in remainingText
+    // Returns how many numbers the row holds
+    size_t parseMatrixRow(ResourceMatrix &matrix, std::string_view line, size_t lineNumber, std::string_view remainingText, std::string_view errorMessage) {
+        if (matrix.empty()) {
+            rowScratch.clear();
+            rowScratch.reserve(maxNumbers(line));
+            parseNumbers(line, lineNumber, [&](size_t value, size_t) {
+                rowScratch.push_back(value);
+            });
+            matrix.appendRow(rowScratch);
+            matrix.reserveRows(1 + countRows(remainingText));
+            return rowScratch.size();
         }
 
-        return result;
+        const size_t numCols = matrix.cols();
+        matrix.appendZeroRow();
+        std::span<size_t> row = matrix.row(matrix.rows() - 1);
+        const size_t count = parseNumbers(line, lineNumber, [&](size_t value, size_t index) {
+            if (index >= numCols) {
+                throw std::runtime_error(string(errorMessage) + atLine(lineNumber));
+            }
+            row[index] = value;
+        });
+        if (count != numCols) {
+            throw std::runtime_error(string(errorMessage) + atLine(lineNumber));
+        }
+        return count;
     }
 
-    // turns string with numbers separated by spaces into vector of numbers
-    vector<size_t> separateNumbers(const string &input) const {
-        vector<size_t> result;
-        string token;
-        int num;
-        char delimiter = ' ';
-        std::istringstream iss(input);
+    // Calls onNumber(value, index) for every number in a line of numbers separated by spaces or tabs
+    // Returns how many numbers the line holds
+    template <typename OnNumber>
+    static size_t parseNumbers(std::string_view line, size_t lineNumber, OnNumber onNumber) {
+        const char* cursor = line.data();
+        const char* const end = line.data() + line.size();
+        size_t count = 0;
 
-        while (getline(iss, token, delimiter)) {
-            try {
-                num = std::stoi(token);
-                if (num < 0) {
-                    throw std::runtime_error("Negative Value in Program Snapshot File.");
-                }
-                result.push_back(static_cast<size_t>(num));
-            } catch (const std::invalid_argument& e) {
-                throw std::invalid_argument("Invalid argument when converting number character to integer");
-            } catch (const std::out_of_range& e) {
-                throw std::out_of_range("Out of range error when converting number character to integer");
+        while (true) {
+            while (cursor < end && isSeparator(*cursor)) {
+                cursor++;
+            }
+            if (cursor == end) {
+                return count;
+            }
+
+            const size_t column = cursor - line.data() + 1;
+            const bool negative = *cursor == '-';
+            if (negative || *cursor == '+') {
+                cursor++;
+            }
+
+            size_t value = 0;
+            const auto [next, error] = std::from_chars(cursor, end, value);
+            if (error == std::errc::result_out_of_range) {
+                throw std::out_of_range("Out of range error when converting number" + atLine(lineNumber, column));
+            }
+            if (error != std::errc() || (next < end && !isSeparator(*next))) {
+                throw std::invalid_argument("Invalid argument when converting number" + atLine(lineNumber, column));
+            }
+            if (negative && value != 0) {
+                throw std::runtime_error("Negative Value in Program Snapshot File" + atLine(lineNumber, column) + ".");
+            }
+
+            onNumber(value, count++);
+            cursor = next;
+        }
+    }
+
+    // Returns the line starting at position without its line ending, and moves position to the start of the next line
+    static std::string_view nextLine(std::string_view text, size_t &position) {
+        const char* begin = text.data() + position;
+        const size_t remaining = text.size() - position;
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', remaining));
+
+        size_t length = (newline != nullptr) ? newline - begin : remaining;
+        position += (newline != nullptr) ? length + 1 : length;
+        if (length > 0 && begin[length - 1] == '\r') {
+            length--;
+        }
+        return std::string_view(begin, length);
+    }
+
+    // Number of lines at the start of text before the next blank line or section header
+    static size_t countRows(std::string_view text) {
+        size_t rows = 0;
+        size_t position = 0;
+        while (position < text.size()) {
+            const std::string_view line = nextLine(text, position);
+            if (isBlank(line) || line.front() == '/') {
+                break;
+            }
+            rows++;
+        }
+        return rows;
+    }
+
+    // Upper bound on the numbers a line can hold, each taking at least one digit and one separator
+    // Reserving it lets a row of unknown width be parsed with a single allocation
+    static size_t maxNumbers(std::string_view line) {
+        return (line.size() + 1) / 2;
+    }
+
+    static bool isSeparator(char c) {
+        return c == ' ' || c == '\t';
+    }
+
+    static bool isBlank(std::string_view line) {
+        for (char c: line) {
+            if (!isSeparator(c)) {
+                return false;
             }
         }
+        return true;
+    }
+
+    static string atLine(size_t lineNumber) {
+        return " at line " + std::to_string(lineNumber);
+    }
 
-        return result;
+    static string atLine(size_t lineNumber, size_t column) {
+        return atLine(lineNumber) + ", column " + std::to_string(column);
     }
 
     // Check if the table sizes are compatible
     // Returns false if there are any errors in the input data
     bool checkValidity() {
-        size_t numCol;
-        try {
-            numCol = allocationMatrix.at(0).size();
-        } catch (...) {
+        if (allocationMatrix.empty()) {
             throw std::runtime_error("No Allocation Data");
             return false;
         }
-        
-        // check if table is rectangular
-        for (auto vec: maxMatrix) {
-            if (vec.size() != numCol) {
-                throw std::runtime_error("Maximum Matrix is Missing an Entry");
-                return false;
-            }
-        }
+        size_t numCol = allocationMatrix.cols();
 
-        for (auto vec: allocationMatrix) {
-            if (vec.size() != numCol) {
-                throw std::runtime_error("Allocation Matrix is Missing an Entry");
-                return false;
-            }
+        // check if tables have the same width
+        // Rows within a table are already checked to be the same width as they are read
+        if (!maxMatrix.empty() && maxMatrix.cols() != numCol) {
+            throw std::runtime_error("Maximum Matrix is Missing an Entry");
+            return false;
         }
 
-        if (allocationMatrix.size() != maxMatrix.size()) {
+        if (allocationMatrix.rows() != maxMatrix.rows()) {
             throw std::runtime_error("Allocation Matrix and Maximum Matrix Processes Mismatched");
             return false;
         }
@@ -199,7 +369,10 @@ private:
     }
 
     // Program Snapshot datastructures
-    vector<size_t> availableVector;
-    vector<vector<size_t>> maxMatrix;
-    vector<vector<size_t>> allocationMatrix;
+    std::pmr::vector<size_t> availableVector;
+    ResourceMatrix maxMatrix;
+    ResourceMatrix allocationMatrix;
+
+    // Reused for the first row of each matrix, before its width is known
+    std::pmr::vector<size_t> rowScratch;
 };
\ No newline at end of file
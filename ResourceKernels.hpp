@@ -0,0 +1,385 @@
+// ResourceKernels.hpp
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESOURCE_KERNELS_X86 true
+#else
+#define RESOURCE_KERNELS_X86 false
+#endif
+
+// Instruction set used by a set of resource kernels, ordered from narrowest to widest
+enum class KernelLevel {
+    SCALAR,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+inline const char* kernelLevelName(KernelLevel level) {
+    switch (level) {
+        case KernelLevel::SSE2:
+            return "sse2";
+        case KernelLevel::AVX2:
+            return "avx2";
+        case KernelLevel::AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+// Scalar reference kernels
+// Every vectorized kernel must give exactly the same answer as these
+// T is the unsigned type of a resource count, see BasicResourceMatrix
+namespace scalar_kernels {
+    // Returns true if every element of lhs is less than or equal to the element in the same position of rhs
+    template <typename T>
+    inline bool lessEqual(const T* lhs, const T* rhs, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (lhs[i] > rhs[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Adds each element of source into the element in the same position of target
+    // Returns false if a sum did not fit into T, in which case target holds the wrapped sums
+    template <typename T>
+    inline bool addInto(T* target, const T* source, size_t count) {
+        bool overflow = false;
+        for (size_t i = 0; i < count; i++) {
+            const T sum = target[i] + source[i];
+            overflow |= sum < source[i];
+            target[i] = sum;
+        }
+        return !overflow;
+    }
+}
+
+#if RESOURCE_KERNELS_X86
+// SSE2 is part of the x86-64 baseline, so these kernels never need a feature check there
+// SSE2 only has signed compares. 8 and 16-bit lanes use unsigned saturating arithmetic instead, 32-bit lanes are biased by
+// the sign bit, and 64-bit lanes, which have no compare at all, find lhs > rhs from the borrow of rhs - lhs.
+namespace sse2_kernels {
+    // True if any lane of l is greater than the same lane of r
+    template <typename T>
+    __attribute__((target("sse2")))
+    inline bool anyGreater(__m128i l, __m128i r) {
+        if constexpr (sizeof(T) == 1) {
+            // l - r saturates to zero exactly when l <= r
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(l, r), _mm_setzero_si128())) != 0xFFFF;
+        } else if constexpr (sizeof(T) == 2) {
+            return _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(l, r), _mm_setzero_si128())) != 0xFFFF;
+        } else if constexpr (sizeof(T) == 4) {
+            const __m128i bias = _mm_set1_epi32(INT32_MIN);
+            return _mm_movemask_epi8(_mm_cmpgt_epi32(_mm_xor_si128(l, bias), _mm_xor_si128(r, bias))) != 0;
+        } else {
+            // The sign bit of borrow is set exactly when l > r
+            const __m128i borrow = _mm_or_si128(
+                _mm_andnot_si128(r, l),
+                _mm_andnot_si128(_mm_xor_si128(r, l), _mm_sub_epi64(r, l)));
+            return _mm_movemask_pd(_mm_castsi128_pd(borrow)) != 0;
+        }
+    }
+
+    // Lane-wise t + s, setting overflow if any lane carried out
+    template <typename T>
+    __attribute__((target("sse2")))
+    inline __m128i addChecked(__m128i t, __m128i s, bool& overflow) {
+        if constexpr (sizeof(T) == 1) {
+            // The saturating sum differs from the wrapping one exactly when it carried out
+            const __m128i sum = _mm_add_epi8(t, s);
+            overflow |= _mm_movemask_epi8(_mm_cmpeq_epi8(sum, _mm_adds_epu8(t, s))) != 0xFFFF;
+            return sum;
+        } else if constexpr (sizeof(T) == 2) {
+            const __m128i sum = _mm_add_epi16(t, s);
+            overflow |= _mm_movemask_epi8(_mm_cmpeq_epi16(sum, _mm_adds_epu16(t, s))) != 0xFFFF;
+            return sum;
+        } else if constexpr (sizeof(T) == 4) {
+            const __m128i bias = _mm_set1_epi32(INT32_MIN);
+            const __m128i sum = _mm_add_epi32(t, s);
+            overflow |= _mm_movemask_epi8(_mm_cmpgt_epi32(_mm_xor_si128(s, bias), _mm_xor_si128(sum, bias))) != 0;
+            return sum;
+        } else {
+            // The sign bit of carry is set exactly when t + s carried out
+            const __m128i sum = _mm_add_epi64(t, s);
+            const __m128i carry = _mm_or_si128(_mm_and_si128(t, s), _mm_andnot_si128(sum, _mm_or_si128(t, s)));
+            overflow |= _mm_movemask_pd(_mm_castsi128_pd(carry)) != 0;
+            return sum;
+        }
+    }
+
+    template <typename T>
+    __attribute__((target("sse2")))
+    inline bool lessEqual(const T* lhs, const T* rhs, size_t count) {
+        constexpr size_t lanes = 16 / sizeof(T);
+        size_t i = 0;
+        for (; i + lanes <= count; i += lanes) {
+            const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+            const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+            if (anyGreater<T>(l, r)) {
+                return false;
+            }
+        }
+        return scalar_kernels::lessEqual(lhs + i, rhs + i, count - i);
+    }
+
+    template <typename T>
+    __attribute__((target("sse2")))
+    inline bool addInto(T* target, const T* source, size_t count) {
+        constexpr size_t lanes = 16 / sizeof(T);
+        bool overflow = false;
+        size_t i = 0;
+        for (; i + lanes <= count; i += lanes) {
+            const __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), addChecked<T>(t, s, overflow));
+        }
+        return scalar_kernels::addInto(target + i, source + i, count - i) && !overflow;
+    }
+}
+
+// AVX2 still has no unsigned compare. 8 and 16-bit lanes use saturating arithmetic as with SSE2, and 32 and 64-bit lanes
+// are biased by the sign bit to compare them as unsigned.
+namespace avx2_kernels {
+    template <typename T>
+    __attribute__((target("avx2")))
+    inline __m256i biasedGreater(__m256i l, __m256i r) {
+        if constexpr (sizeof(T) == 4) {
+            const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+            return _mm256_cmpgt_epi32(_mm256_xor_si256(l, bias), _mm256_xor_si256(r, bias));
+        } else {
+            const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+            return _mm256_cmpgt_epi64(_mm256_xor_si256(l, bias), _mm256_xor_si256(r, bias));
+        }
+    }
+
+    template <typename T>
+    __attribute__((target("avx2")))
+    inline bool anyGreater(__m256i l, __m256i r) {
+        __m256i greater;
+        if constexpr (sizeof(T) == 1) {
+            greater = _mm256_subs_epu8(l, r);
+        } else if constexpr (sizeof(T) == 2) {
+            greater = _mm256_subs_epu16(l, r);
+        } else {
+            greater = biasedGreater<T>(l, r);
+        }
+        return !_mm256_testz_si256(greater, greater);
+    }
+
+    template <typename T>
+    __attribute__((target("avx2")))
+    inline __m256i addChecked(__m256i t, __m256i s, bool& overflow) {
+        if constexpr (sizeof(T) == 1) {
+            const __m256i sum = _mm256_add_epi8(t, s);
+            overflow |= _mm256_movemask_epi8(_mm256_cmpeq_epi8(sum, _mm256_adds_epu8(t, s))) != -1;
+            return sum;
+        } else if constexpr (sizeof(T) == 2) {
+            const __m256i sum = _mm256_add_epi16(t, s);
+            overflow |= _mm256_movemask_epi8(_mm256_cmpeq_epi16(sum, _mm256_adds_epu16(t, s))) != -1;
+            return sum;
+        } else {
+            // A sum smaller than one of its terms carried out
+            const __m256i sum = (sizeof(T) == 4) ? _mm256_add_epi32(t, s) : _mm256_add_epi64(t, s);
+            const __m256i carry = biasedGreater<T>(s, sum);
+            overflow |= !_mm256_testz_si256(carry, carry);
+            return sum;
+        }
+    }
+
+    template <typename T>
+    __attribute__((target("avx2")))
+    inline bool lessEqual(const T* lhs, const T* rhs, size_t count) {
+        constexpr size_t lanes = 32 / sizeof(T);
+        size_t i = 0;
+        for (; i + lanes <= count; i += lanes) {
+            const __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i));
+            const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i));
+            if (anyGreater<T>(l, r)) {
+                return false;
+            }
+        }
+        return sse2_kernels::lessEqual(lhs + i, rhs + i, count - i);
+    }
+
+    template <typename T>
+    __attribute__((target("avx2")))
+    inline bool addInto(T* target, const T* source, size_t count) {
+        constexpr size_t lanes = 32 / sizeof(T);
+        bool overflow = false;
+        size_t i = 0;
+        for (; i + lanes <= count; i += lanes) {
+            const __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + i));
+            const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), addChecked<T>(t, s, overflow));
+        }
+        return sse2_kernels::addInto(target + i, source + i, count - i) && !overflow;
+    }
+}
+
+// AVX-512 compares unsigned lanes of every width directly and finishes the tail of a row with a masked load
+// The 8 and 16-bit forms are part of AVX-512BW, which every CPU with AVX-512 on the desktop or server has
+namespace avx512_kernels {
+    template <typename T>
+    __attribute__((target("avx512f,avx512bw")))
+    inline __m512i maskedLoad(uint64_t mask, const T* source) {
+        if constexpr (sizeof(T) == 1) {
+            return _mm512_maskz_loadu_epi8(mask, source);
+        } else if constexpr (sizeof(T) == 2) {
+            return _mm512_maskz_loadu_epi16(static_cast<__mmask32>(mask), source);
+        } else if constexpr (sizeof(T) == 4) {
+            return _mm512_maskz_loadu_epi32(static_cast<__mmask16>(mask), source);
+        } else {
+            return _mm512_maskz_loadu_epi64(static_cast<__mmask8>(mask), source);
+        }
+    }
+
+    template <typename T>
+    __attribute__((target("avx512f,avx512bw")))
+    inline void maskedStore(T* target, uint64_t mask, __m512i value) {
+        if constexpr (sizeof(T) == 1) {
+            _mm512_mask_storeu_epi8(target, mask, value);
+        } else if constexpr (sizeof(T) == 2) {
+            _mm512_mask_storeu_epi16(target, static_cast<__mmask32>(mask), value);
+        } else if constexpr (sizeof(T) == 4) {
+            _mm512_mask_storeu_epi32(target, static_cast<__mmask16>(mask), value);
+        } else {
+            _mm512_mask_storeu_epi64(target, static_cast<__mmask8>(mask), value);
+        }
+    }
+
+    // Mask of the lanes where l > r
+    template <typename T>
+    __attribute__((target("avx512f,avx512bw")))
+    inline uint64_t greaterMask(__m512i l, __m512i r) {
+        if constexpr (sizeof(T) == 1) {
+            return _mm512_cmpgt_epu8_mask(l, r);
+        } else if constexpr (sizeof(T) == 2) {
+            return _mm512_cmpgt_epu16_mask(l, r);
+        } else if constexpr (sizeof(T) == 4) {
+            return _mm512_cmpgt_epu32_mask(l, r);
+        } else {
+            return _mm512_cmpgt_epu64_mask(l, r);
+        }
+    }
+
+    template <typename T>
+    __attribute__((target("avx512f,avx512bw")))
+    inline __m512i add(__m512i t, __m512i s) {
+        if constexpr (sizeof(T) == 1) {
+            return _mm512_add_epi8(t, s);
+        } else if constexpr (sizeof(T) == 2) {
+            return _mm512_add_epi16(t, s);
+        } else if constexpr (sizeof(T) == 4) {
+            return _mm512_add_epi32(t, s);
+        } else {
+            return _mm512_add_epi64(t, s);
+        }
+    }
+
+    template <typename T>
+    __attribute__((target("avx512f,avx512bw")))
+    inline bool lessEqual(const T* lhs, const T* rhs, size_t count) {
+        constexpr size_t lanes = 64 / sizeof(T);
+        size_t i = 0;
+        for (; i + lanes <= count; i += lanes) {
+            const __m512i l = _mm512_loadu_si512(lhs + i);
+            const __m512i r = _mm512_loadu_si512(rhs + i);
+            if (greaterMask<T>(l, r) != 0) {
+                return false;
+            }
+        }
+        if (i < count) {
+            // Lanes past the tail load as zero on both sides, so they never compare greater
+            const uint64_t tail = (uint64_t(1) << (count - i)) - 1;
+            if (greaterMask<T>(maskedLoad(tail, lhs + i), maskedLoad(tail, rhs + i)) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename T>
+    __attribute__((target("avx512f,avx512bw")))
+    inline bool addInto(T* target, const T* source, size_t count) {
+        constexpr size_t lanes = 64 / sizeof(T);
+        uint64_t carry = 0;
+        size_t i = 0;
+        for (; i + lanes <= count; i += lanes) {
+            const __m512i t = _mm512_loadu_si512(target + i);
+            const __m512i s = _mm512_loadu_si512(source + i);
+            const __m512i sum = add<T>(t, s);
+            carry |= greaterMask<T>(s, sum);
+            _mm512_storeu_si512(target + i, sum);
+        }
+        if (i < count) {
+            const uint64_t tail = (uint64_t(1) << (count - i)) - 1;
+            const __m512i s = maskedLoad(tail, source + i);
+            const __m512i sum = add<T>(maskedLoad(tail, target + i), s);
+            carry |= greaterMask<T>(s, sum);
+            maskedStore(target + i, tail, sum);
+        }
+        return carry == 0;
+    }
+}
+#endif
+
+// Table of the two innermost operations of Banker's Algorithm for one instruction set and count type
+// "need row <= available" and "available += allocation row", the latter returning false if a sum overflowed
+template <typename T>
+struct BasicResourceKernels {
+    bool (*lessEqual)(const T* lhs, const T* rhs, size_t count);
+    bool (*addInto)(T* target, const T* source, size_t count);
+    KernelLevel level;
+
+    // Kernels for a specific instruction set
+    // Falls back to the widest supported level below it if the CPU does not support the requested one
+    static BasicResourceKernels forLevel(KernelLevel level) {
+        if (level > detectLevel()) {
+            level = detectLevel();
+        }
+
+        switch (level) {
+#if RESOURCE_KERNELS_X86
+            case KernelLevel::AVX512:
+                return {avx512_kernels::lessEqual<T>, avx512_kernels::addInto<T>, KernelLevel::AVX512};
+            case KernelLevel::AVX2:
+                return {avx2_kernels::lessEqual<T>, avx2_kernels::addInto<T>, KernelLevel::AVX2};
+            case KernelLevel::SSE2:
+                return {sse2_kernels::lessEqual<T>, sse2_kernels::addInto<T>, KernelLevel::SSE2};
+#endif
+            default:
+                return {scalar_kernels::lessEqual<T>, scalar_kernels::addInto<T>, KernelLevel::SCALAR};
+        }
+    }
+
+    // Widest instruction set supported by the CPU running the program
+    static KernelLevel detectLevel() {
+#if RESOURCE_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+            return KernelLevel::AVX512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return KernelLevel::AVX2;
+        }
+        return KernelLevel::SSE2;
+#else
+        return KernelLevel::SCALAR;
+#endif
+    }
+
+    // Kernels for the widest instruction set of this CPU, detected once on first use
+    static const BasicResourceKernels& best() {
+        static const BasicResourceKernels kernels = forLevel(detectLevel());
+        return kernels;
+    }
+};
+
+using ResourceKernels = BasicResourceKernels<size_t>;
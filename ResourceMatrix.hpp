@@ -0,0 +1,339 @@
+// ResourceMatrix.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <new>
+#include <memory_resource>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+// Every matrix buffer and every row starts on a boundary of this many bytes
+// 64 bytes is one cache line and one full AVX-512 register
+#define RESOURCE_MATRIX_ALIGNMENT 64
+
+// Allocator handing out RESOURCE_MATRIX_ALIGNMENT aligned buffers so rows can be loaded with aligned vector instructions
+// The buffers come from the global allocator, or from a memory resource such as a SnapshotArena. Like
+// std::pmr::polymorphic_allocator, a container keeps the resource it was constructed with when assigned to, and a copy of
+// a container uses the global allocator, so nothing outlives an arena without asking for it.
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::false_type;
+    using propagate_on_container_swap = std::false_type;
+
+    AlignedAllocator() = default;
+
+    AlignedAllocator(std::pmr::memory_resource* resource) : resource(resource) {}
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>& other) : resource(other.resource) {}
+
+    T* allocate(size_t count) {
+        if (resource != nullptr) {
+            return static_cast<T*>(resource->allocate(count * sizeof(T), RESOURCE_MATRIX_ALIGNMENT));
+        }
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(RESOURCE_MATRIX_ALIGNMENT)));
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        if (resource != nullptr) {
+            resource->deallocate(pointer, count * sizeof(T), RESOURCE_MATRIX_ALIGNMENT);
+            return;
+        }
+        ::operator delete(pointer, std::align_val_t(RESOURCE_MATRIX_ALIGNMENT));
+    }
+
+    AlignedAllocator select_on_container_copy_construction() const {
+        return AlignedAllocator();
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>& other) const {
+        return resource == other.resource;
+    }
+
+    // Resource the buffers come from, null for the global allocator
+    std::pmr::memory_resource* resource = nullptr;
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Resource for std::pmr containers, which cannot take the null resource that stands for the global allocator elsewhere
+inline std::pmr::memory_resource* resourceOrDefault(std::pmr::memory_resource* resource) {
+    return resource != nullptr ? resource : std::pmr::new_delete_resource();
+}
+
+using std::vector;
+
+// Converts a resource count to the count type T, throwing if it does not fit
+template <typename T, typename U>
+T narrowCount(U value) {
+    if (value > std::numeric_limits<T>::max()) {
+        throw std::overflow_error("Resource count " + std::to_string(value) + " does not fit into " + std::to_string(sizeof(T) * 8) + " bits");
+    }
+    return static_cast<T>(value);
+}
+
+// Read-only view of a padded row-major matrix owned by someone else, such as a ResourceMatrix or a memory-mapped file
+// The rows must follow the layout of ResourceMatrix: aligned to RESOURCE_MATRIX_ALIGNMENT and zero padded up to stride
+template <typename T>
+class BasicResourceMatrixView {
+    public:
+        BasicResourceMatrixView() = default;
+
+        BasicResourceMatrixView(const T* base, size_t numRows, size_t numCols, size_t rowStride) :
+                                base(base), numRows(numRows), numCols(numCols), rowStride(rowStride) {}
+
+        size_t rows() const {
+            return numRows;
+        }
+
+        size_t cols() const {
+            return numCols;
+        }
+
+        size_t stride() const {
+            return rowStride;
+        }
+
+        bool empty() const {
+            return numRows == 0;
+        }
+
+        std::span<const T> row(size_t r) const {
+            return std::span<const T>(base + r * rowStride, numCols);
+        }
+
+        std::span<const T> paddedRow(size_t r) const {
+            return std::span<const T>(base + r * rowStride, rowStride);
+        }
+
+        T operator()(size_t r, size_t c) const {
+            return base[r * rowStride + c];
+        }
+
+        const T* data() const {
+            return base;
+        }
+
+    private:
+        const T* base = nullptr;
+        size_t numRows = 0;
+        size_t numCols = 0;
+        size_t rowStride = 0;
+};
+
+// Dense row-major matrix of resource counts stored in a single aligned buffer
+// Rows are padded with zeros up to a multiple of RESOURCE_MATRIX_ALIGNMENT bytes, so row r starts at data() + r * stride()
+// and a vector load may safely read the padding at the end of every row
+// T is the unsigned type of a resource count. A narrower type fits more counts into every cache line and vector register.
+template <typename T>
+class BasicResourceMatrix {
+    static_assert(std::is_unsigned_v<T>, "Resource counts must be unsigned");
+
+    public:
+        BasicResourceMatrix() = default;
+
+        // Construct an empty matrix whose storage comes from resource, null for the global allocator
+        explicit BasicResourceMatrix(std::pmr::memory_resource* resource) : storage(AlignedAllocator<T>(resource)) {}
+
+        // Construct a zero filled matrix with the given number of rows and columns
+        BasicResourceMatrix(size_t numRows, size_t numCols, std::pmr::memory_resource* resource = nullptr) :
+                            numRows(numRows), numCols(numCols), rowStride(paddedStride(numCols)),
+                            storage(numRows * rowStride, 0, AlignedAllocator<T>(resource)) {}
+
+        // Construct a copy of the matrix seen through a view, whose counts may be of another type
+        // Throws if a count does not fit into T
+        template <typename U>
+        explicit BasicResourceMatrix(BasicResourceMatrixView<U> source, std::pmr::memory_resource* resource = nullptr) :
+                                     BasicResourceMatrix(source.rows(), source.cols(), resource) {
+            for (size_t r = 0; r < numRows; r++) {
+                auto sourceRow = source.row(r);
+                auto targetRow = row(r);
+                for (size_t c = 0; c < numCols; c++) {
+                    targetRow[c] = narrowCount<T>(sourceRow[c]);
+                }
+            }
+        }
+
+        size_t rows() const {
+            return numRows;
+        }
+
+        size_t cols() const {
+            return numCols;
+        }
+
+        // Distance in elements between the start of two consecutive rows
+        size_t stride() const {
+            return rowStride;
+        }
+
+        bool empty() const {
+            return numRows == 0;
+        }
+
+        // View of the columns of a row, without the padding
+        std::span<T> row(size_t r) {
+            return std::span<T>(storage.data() + r * rowStride, numCols);
+        }
+
+        std::span<const T> row(size_t r) const {
+            return std::span<const T>(storage.data() + r * rowStride, numCols);
+        }
+
+        // View of a row including its zero padding, for kernels that process whole vector registers
+        std::span<const T> paddedRow(size_t r) const {
+            return std::span<const T>(storage.data() + r * rowStride, rowStride);
+        }
+
+        T& operator()(size_t r, size_t c) {
+            return storage[r * rowStride + c];
+        }
+
+        T operator()(size_t r, size_t c) const {
+            return storage[r * rowStride + c];
+        }
+
+        T* data() {
+            return storage.data();
+        }
+
+        const T* data() const {
+            return storage.data();
+        }
+
+        // Resource the storage comes from, null for the global allocator
+        std::pmr::memory_resource* memoryResource() const {
+            return storage.get_allocator().resource;
+        }
+
+        BasicResourceMatrixView<T> view() const {
+            return BasicResourceMatrixView<T>(storage.data(), numRows, numCols, rowStride);
+        }
+
+        operator BasicResourceMatrixView<T>() const {
+            return view();
+        }
+
+        // Reserve room for numRows rows so appending them does not reallocate
+        void reserveRows(size_t numRows) {
+            storage.reserve(numRows * rowStride);
+        }
+
+        // Append a row to the bottom of the matrix
+        // The first row appended to an empty matrix decides the number of columns
+        void appendRow(std::span<const T> values) {
+            if (numRows == 0 && numCols == 0) {
+                numCols = values.size();
+                rowStride = paddedStride(numCols);
+            }
+
+            if (values.size() != numCols) {
+                throw std::runtime_error(
+                    "Attempted to append a row of " + std::to_string(values.size()) +
+                    " entries to a matrix with " + std::to_string(numCols) + " columns.");
+            }
+
+            storage.resize((numRows + 1) * rowStride, 0);
+            std::copy(values.begin(), values.end(), storage.begin() + numRows * rowStride);
+            numRows++;
+        }
+
+        // Append a zero filled row to the bottom of the matrix, which must already know its number of columns
+        void appendZeroRow() {
+            storage.resize((numRows + 1) * rowStride, 0);
+            numRows++;
+        }
+
+        // Remove the rows at the given indices, which must be in increasing order, moving the rows after them up
+        void removeRows(std::span<const size_t> sortedRows) {
+            if (sortedRows.empty()) {
+                return;
+            }
+            size_t kept = sortedRows[0];
+            size_t next = 0;
+            for (size_t r = sortedRows[0]; r < numRows; r++) {
+                if (next < sortedRows.size() && sortedRows[next] == r) {
+                    next++;
+                    continue;
+                }
+                std::copy_n(storage.data() + r * rowStride, rowStride, storage.data() + kept * rowStride);
+                kept++;
+            }
+            storage.resize(kept * rowStride);
+            numRows = kept;
+        }
+
+        // Number of elements in a row once padded to the alignment boundary
+        static size_t paddedStride(size_t numCols) {
+            const size_t elementsPerBlock = RESOURCE_MATRIX_ALIGNMENT / sizeof(T);
+            return (numCols + elementsPerBlock - 1) / elementsPerBlock * elementsPerBlock;
+        }
+
+    private:
+        size_t numRows = 0;
+        size_t numCols = 0;
+        size_t rowStride = 0;
+        AlignedVector<T> storage;
+};
+
+using ResourceMatrixView = BasicResourceMatrixView<size_t>;
+using ResourceMatrix = BasicResourceMatrix<size_t>;
+
+// Width in bytes of the unsigned type used for resource counts
+enum class CountWidth {
+    U8 = 1,
+    U16 = 2,
+    U32 = 4,
+    U64 = 8
+};
+
+// Narrowest count width that holds value
+inline CountWidth countWidthFor(size_t value) {
+    if (value <= UINT8_MAX) {
+        return CountWidth::U8;
+    }
+    if (value <= UINT16_MAX) {
+        return CountWidth::U16;
+    }
+    if (value <= UINT32_MAX) {
+        return CountWidth::U32;
+    }
+    return CountWidth::U64;
+}
+
+// Narrowest count width a snapshot can be analyzed in
+// Besides every count of the snapshot, it must hold every sum a safety check can reach. Available resources only grow by
+// the allocations of finished processes, so per resource type the available count plus the allocations of every process
+// bounds them all.
+inline CountWidth snapshotCountWidth(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    size_t largest = 0;
+    vector<size_t> totals(availableVector.begin(), availableVector.end());
+    bool overflow = false;
+
+    for (size_t r = 0; r < maxMatrix.rows(); r++) {
+        for (auto value: maxMatrix.row(r)) {
+            largest = std::max(largest, value);
+        }
+    }
+    for (size_t r = 0; r < allocationMatrix.rows(); r++) {
+        auto allocation = allocationMatrix.row(r);
+        for (size_t c = 0; c < allocation.size() && c < totals.size(); c++) {
+            overflow |= __builtin_add_overflow(totals[c], allocation[c], &totals[c]);
+        }
+    }
+    for (auto total: totals) {
+        largest = std::max(largest, total);
+    }
+
+    return overflow ? CountWidth::U64 : countWidthFor(largest);
+}
@@ -0,0 +1,393 @@
+// ResultCache.hpp
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ResourceMatrix.hpp"
+#include "SafetyReport.hpp"
+#include "SparseSafety.hpp"
+#include "Stats.hpp"
+
+using std::vector, std::string;
+
+// Bump whenever the meaning of a cached report changes, so older cache files are treated as misses
+#define RESULT_CACHE_VERSION 1
+
+// Reports kept in memory by default, least recently used first to go
+#define RESULT_CACHE_MEMORY_ENTRIES 4096
+
+// Report files kept on disk by default, least recently used first to go
+#define RESULT_CACHE_DISK_ENTRIES 10000
+
+// Temporary report files older than this many seconds were left by a writer that died before renaming them, and are removed
+#define RESULT_CACHE_STALE_TEMPORARY_SECONDS 60
+
+// First bytes of every report file
+#define RESULT_CACHE_MAGIC "BNKRSLT1"
+
+// 128-bit hash of a snapshot, the key of its cached safety report
+struct SnapshotKey {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    bool operator==(const SnapshotKey&) const = default;
+
+    // 32 lowercase hex digits, the name of its report file
+    string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        string text(32, '0');
+        for (size_t i = 0; i < 16; i++) {
+            text[15 - i] = digits[(high >> (4 * i)) & 0xf];
+            text[31 - i] = digits[(low >> (4 * i)) & 0xf];
+        }
+        return text;
+    }
+};
+
+struct SnapshotKeyHash {
+    size_t operator()(const SnapshotKey& key) const {
+        return key.low;
+    }
+};
+
+// Fast non-cryptographic 128-bit hash, two lanes each folding a 64x64 to 128-bit multiply per 16 bytes
+// Good enough to tell snapshots apart, not to resist anyone crafting collisions.
+// The result depends on how the bytes are split into update calls, so keys are only comparable when built the same way.
+class SnapshotHasher {
+    public:
+        explicit SnapshotHasher(uint64_t seed) : lane0(seed ^ K0), lane1(~seed ^ K1) {}
+
+        void update(const void* data, size_t size) {
+            const char* bytes = static_cast<const char*>(data);
+            length += size;
+            while (size >= 16) {
+                uint64_t a, b;
+                std::memcpy(&a, bytes, 8);
+                std::memcpy(&b, bytes + 8, 8);
+                block(a, b);
+                bytes += 16;
+                size -= 16;
+            }
+            if (size > 0) {
+                // The tail is padded with zeros, its length goes into the final mix
+                uint64_t tail[2] = {0, 0};
+                std::memcpy(tail, bytes, size);
+                block(tail[0] ^ (size << 56), tail[1]);
+            }
+        }
+
+        void update(uint64_t word) {
+            update(&word, sizeof(word));
+        }
+
+        SnapshotKey finish() const {
+            const uint64_t high = mix(lane0 ^ length, K2 ^ lane1);
+            const uint64_t low = mix(lane1 ^ K3, high ^ length ^ K0);
+            return {high, low};
+        }
+
+    private:
+        static constexpr uint64_t K0 = 0xa0761d6478bd642full;
+        static constexpr uint64_t K1 = 0xe7037ed1a0b428dbull;
+        static constexpr uint64_t K2 = 0x8ebc6af09c88c6e3ull;
+        static constexpr uint64_t K3 = 0x589965cc75374cc3ull;
+
+        // Fold the full 128-bit product of a and b into 64 bits
+        static uint64_t mix(uint64_t a, uint64_t b) {
+            const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+            return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+        }
+
+        void block(uint64_t a, uint64_t b) {
+            lane0 = mix(a ^ lane0 ^ K1, b ^ K2);
+            lane1 = mix(b ^ lane1 ^ K3, a ^ K0) + lane0;
+        }
+
+        uint64_t lane0;
+        uint64_t lane1;
+        uint64_t length = 0;
+};
+
+// Everything that changes what checking a snapshot reports, so reports cached under other settings are never returned
+// All engines report the same diagnosis and FIFO sequence, so the engine is left out.
+inline uint64_t resultCacheStamp(SequenceOrder order) {
+    return (static_cast<uint64_t>(RESULT_CACHE_VERSION) << 8) | (static_cast<uint64_t>(RETURN_UNSAFE_SEQUENCES) << 1) |
+           (order == SequenceOrder::FIFO ? 0 : 1);
+}
+
+// Key of a snapshot file from its bytes, found without parsing anything
+inline SnapshotKey hashSnapshotBytes(std::string_view contents, uint64_t stamp) {
+    SnapshotHasher hasher(stamp);
+    hasher.update(uint64_t{'R'});
+    hasher.update(contents.data(), contents.size());
+    return hasher.finish();
+}
+
+// Key of a snapshot from its matrices, the same whatever format or layout of whitespace it was read from
+// Rows are hashed with their zero padding, which only depends on the number of resource types.
+inline SnapshotKey hashSnapshotMatrices(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix,
+                                        ResourceMatrixView allocationMatrix, uint64_t stamp) {
+    SnapshotHasher hasher(stamp);
+    hasher.update(uint64_t{'M'});
+    hasher.update(maxMatrix.rows());
+    hasher.update(maxMatrix.cols());
+    hasher.update(availableVector.data(), availableVector.size_bytes());
+    hasher.update(maxMatrix.data(), maxMatrix.rows() * maxMatrix.stride() * sizeof(size_t));
+    hasher.update(allocationMatrix.data(), allocationMatrix.rows() * allocationMatrix.stride() * sizeof(size_t));
+    return hasher.finish();
+}
+
+// Safety reports of snapshots already checked, by the key of the snapshot
+// Reports live in a bounded in-memory LRU list, and with a directory also in one report file per key that outlives the
+// process. Files are written to a unique temporary name and renamed into place, so concurrent threads and processes may
+// share a directory.
+// Opening a file on a hit refreshes its modification time, and once the directory holds more than diskEntries files the
+// least recently used are removed down to nine tenths of that. Opening the cache and evicting also remove temporary files
+// left behind by writers that died, see RESULT_CACHE_STALE_TEMPORARY_SECONDS.
+// Lookups and inserts are thread safe.
+class ResultCache {
+    public:
+        ResultCache(uint64_t stamp, size_t memoryEntries = RESULT_CACHE_MEMORY_ENTRIES, const string& directory = "",
+                    size_t diskEntries = RESULT_CACHE_DISK_ENTRIES)
+            : cacheStamp(stamp), memoryEntries(memoryEntries), directory(directory), diskEntries(diskEntries) {
+            if (!directory.empty()) {
+                std::filesystem::create_directories(directory);
+                diskCount = countFiles();
+            }
+        }
+
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+
+        uint64_t stamp() const {
+            return cacheStamp;
+        }
+
+        std::optional<SafetyReport> find(const SnapshotKey& key) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto found = index.find(key);
+                if (found != index.end()) {
+                    entries.splice(entries.begin(), entries, found->second);
+                    return hit(found->second->second);
+                }
+            }
+
+            std::optional<SafetyReport> report = readFile(key);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!report) {
+                misses++;
+                Stats::process().add(Stat::RESULT_CACHE_MISSES, 1);
+                return std::nullopt;
+            }
+            remember(key, *report);
+            return hit(*report);
+        }
+
+        void insert(const SnapshotKey& key, const SafetyReport& report) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                remember(key, report);
+            }
+            writeFile(key, report);
+        }
+
+        // Lookups that found a report, and those that did not
+        size_t hitCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return hits;
+        }
+
+        size_t missCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return misses;
+        }
+
+    private:
+        using Entry = std::pair<SnapshotKey, SafetyReport>;
+
+        // Called with the mutex held
+        SafetyReport hit(const SafetyReport& report) {
+            hits++;
+            Stats::process().add(Stat::RESULT_CACHE_HITS, 1);
+            return report;
+        }
+
+        // Called with the mutex held
+        void remember(const SnapshotKey& key, const SafetyReport& report) {
+            if (memoryEntries == 0) {
+                return;
+            }
+            auto found = index.find(key);
+            if (found != index.end()) {
+                found->second->second = report;
+                entries.splice(entries.begin(), entries, found->second);
+                return;
+            }
+            entries.emplace_front(key, report);
+            index[key] = entries.begin();
+            if (entries.size() > memoryEntries) {
+                index.erase(entries.back().first);
+                entries.pop_back();
+            }
+        }
+
+        string filePath(const SnapshotKey& key) const {
+            return directory + "/" + key.hex() + ".result";
+        }
+
+        // File layout: magic, stamp, number of words, words of encodeSafetyReport
+        // A file whose size does not match its number of words is truncated or corrupt, and treated as a miss
+        std::optional<SafetyReport> readFile(const SnapshotKey& key) {
+            if (directory.empty()) {
+                return std::nullopt;
+            }
+            const string path = filePath(key);
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                return std::nullopt;
+            }
+            std::error_code error;
+            const uintmax_t fileSize = std::filesystem::file_size(path, error);
+            const uintmax_t headerSize = 8 + 2 * sizeof(uint64_t);
+            if (error || fileSize < headerSize || (fileSize - headerSize) % sizeof(uint64_t) != 0) {
+                return std::nullopt;
+            }
+
+            char magic[8];
+            uint64_t header[2];
+            if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, RESULT_CACHE_MAGIC, sizeof(magic)) != 0 ||
+                !file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != cacheStamp ||
+                header[1] != (fileSize - headerSize) / sizeof(uint64_t)) {
+                return std::nullopt;
+            }
+            vector<uint64_t> words(header[1]);
+            if (!file.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(uint64_t))) {
+                return std::nullopt;
+            }
+
+            // Least recently used is judged by modification time
+            utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+            try {
+                return decodeSafetyReport(words, "Cached report " + path);
+            } catch (const std::runtime_error&) {
+                return std::nullopt;
+            }
+        }
+
+        // A cache that cannot be written only loses its hits, so failures are ignored
+        void writeFile(const SnapshotKey& key, const SafetyReport& report) {
+            if (directory.empty()) {
+                return;
+            }
+            const string path = filePath(key);
+            // mkstemp picks a name no other thread or process is using, the file is then rewritten through ofstream
+            string temporary = path + ".tmpXXXXXX";
+            const int fd = mkstemp(temporary.data());
+            if (fd == -1) {
+                return;
+            }
+            // mkstemp creates the file readable by its owner only, other processes sharing the directory read it too
+            fchmod(fd, 0644);
+            close(fd);
+            const vector<uint64_t> words = encodeSafetyReport(report);
+            const uint64_t header[2] = {cacheStamp, words.size()};
+            {
+                std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+                file.write(RESULT_CACHE_MAGIC, 8);
+                file.write(reinterpret_cast<const char*>(header), sizeof(header));
+                file.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+                if (!file) {
+                    std::error_code error;
+                    std::filesystem::remove(temporary, error);
+                    return;
+                }
+            }
+            std::error_code error;
+            const bool replaced = std::filesystem::exists(path, error);
+            std::filesystem::rename(temporary, path, error);
+            if (error) {
+                std::filesystem::remove(temporary, error);
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(diskMutex);
+            if (!replaced && ++diskCount > diskEntries) {
+                evictFiles();
+            }
+        }
+
+        // Counts report files, removing stale temporary ones on the way
+        size_t countFiles() const {
+            size_t count = 0;
+            std::error_code error;
+            for (const auto& entry: std::filesystem::directory_iterator(directory, error)) {
+                count += entry.path().extension() == ".result";
+                removeIfStaleTemporary(entry);
+            }
+            return count;
+        }
+
+        // Temporary files are named <key>.result.tmpXXXXXX by writeFile
+        static void removeIfStaleTemporary(const std::filesystem::directory_entry& entry) {
+            if (entry.path().filename().string().find(".result.tmp") == string::npos) {
+                return;
+            }
+            std::error_code error;
+            const auto modified = entry.last_write_time(error);
+            if (!error && std::filesystem::file_time_type::clock::now() - modified > std::chrono::seconds(RESULT_CACHE_STALE_TEMPORARY_SECONDS)) {
+                std::filesystem::remove(entry.path(), error);
+            }
+        }
+
+        // Called with diskMutex held
+        void evictFiles() {
+            vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> files;
+            std::error_code error;
+            for (const auto& entry: std::filesystem::directory_iterator(directory, error)) {
+                if (entry.path().extension() == ".result") {
+                    files.push_back({entry.last_write_time(error), entry.path()});
+                } else {
+                    removeIfStaleTemporary(entry);
+                }
+            }
+            std::sort(files.begin(), files.end());
+
+            const size_t keep = diskEntries - diskEntries / 10;
+            size_t removed = 0;
+            for (; removed + keep < files.size(); removed++) {
+                std::filesystem::remove(files[removed].second, error);
+            }
+            diskCount = files.size() - removed;
+        }
+
+        const uint64_t cacheStamp;
+        const size_t memoryEntries;
+        const string directory;
+        const size_t diskEntries;
+
+        mutable std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<SnapshotKey, std::list<Entry>::iterator, SnapshotKeyHash> index;
+        size_t hits = 0;
+        size_t misses = 0;
+
+        std::mutex diskMutex;
+        size_t diskCount = 0;
+};
@@ -0,0 +1,404 @@
+// SafeSequenceEnumerator.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "ResourceKernels.hpp"
+#include "BankerAlgorithm.hpp"
+#include "ThreadPool.hpp"
+
+using std::vector, std::string;
+
+// Number of safe sequences, which grows up to P! and so needs more than 64 bits from about 21 processes on
+// Counts saturate at the largest value instead of wrapping around
+using SequenceCount = unsigned __int128;
+
+#define SEQUENCE_COUNT_MAX (~SequenceCount(0))
+
+// Number of shards of the memo table, each with its own lock, so counting threads rarely wait for each other
+#define ENUMERATION_MEMO_SHARDS 64
+
+// Estimated bytes of memo table overhead per state besides the bitset itself, used for the memory limit
+#define ENUMERATION_MEMO_ENTRY_OVERHEAD 64
+
+inline string sequenceCountToString(SequenceCount count) {
+    if (count == 0) {
+        return "0";
+    }
+    string digits;
+    while (count > 0) {
+        digits.push_back(static_cast<char>('0' + static_cast<int>(count % 10)));
+        count /= 10;
+    }
+    return string(digits.rbegin(), digits.rend());
+}
+
+// Why an enumeration stopped
+enum class EnumerationStatus {
+    COMPLETE,
+    MEMORY_LIMIT,
+    TIME_LIMIT,
+    SEQUENCE_LIMIT,
+    // The callback asked to stop
+    STOPPED
+};
+
+inline const char* enumerationStatusName(EnumerationStatus status) {
+    switch (status) {
+        case EnumerationStatus::MEMORY_LIMIT: return "memory limit reached";
+        case EnumerationStatus::TIME_LIMIT: return "time limit reached";
+        case EnumerationStatus::SEQUENCE_LIMIT: return "sequence limit reached";
+        case EnumerationStatus::STOPPED: return "stopped";
+        default: return "complete";
+    }
+}
+
+// Limits of an enumeration, zero means unlimited
+struct EnumerationLimits {
+    // Memory used by the memo table of count()
+    size_t maxMemoryBytes = 0;
+    std::chrono::milliseconds timeLimit{0};
+    // Sequences passed to the callback of forEach()
+    size_t maxSequences = 0;
+};
+
+struct SequenceCountResult {
+    // Exact when status is COMPLETE, otherwise the sequences counted before stopping, a lower bound
+    SequenceCount count = 0;
+    bool saturated = false;
+    EnumerationStatus status = EnumerationStatus::COMPLETE;
+    size_t statesVisited = 0;
+    size_t statesMemoized = 0;
+};
+
+// Counts or lists every safe sequence of a snapshot instead of the single FIFO one
+//
+// Which processes can run next only depends on the set of finished processes, since the available vector is the initial
+// one plus their allocations. count() therefore searches the space of finished sets rather than of orderings and memoizes
+// the number of safe completions of every set it has seen, visiting each of at most 2^P sets once instead of walking up to
+// P! orderings. Sets are keyed by a bitset of finished processes.
+//
+// Dead states, from which no process order finishes everyone, are pruned up front: finishing a runnable process only ever
+// adds resources, so every set reachable from a safe state is safe again. One greedy pass decides whether the root is safe,
+// and when it is no search branch can dead-end, which is also what lets forEach() stream sequences without backtracking.
+class SafeSequenceEnumerator {
+    public:
+        // The allocation matrix must stay alive while the object is used
+        SafeSequenceEnumerator(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                               EnumerationLimits limits = {}) :
+                               allocationMatrix(allocationMatrix), limits(limits), kernels(ResourceKernels::best()) {
+            numProcesses = maxMatrix.rows();
+            numWords = (numProcesses + 63) / 64;
+            if (allocationMatrix.rows() != numProcesses || allocationMatrix.cols() != maxMatrix.cols() ||
+                availableVector.size() != maxMatrix.cols() || allocationMatrix.stride() != maxMatrix.stride()) {
+                throw std::runtime_error("Available Vector, Maximum Matrix and Allocation Matrix dimensions do not match.");
+            }
+
+            this->availableVector = AlignedVector<size_t>(maxMatrix.stride(), 0);
+            std::copy(availableVector.begin(), availableVector.end(), this->availableVector.begin());
+
+            needMatrix = ResourceMatrix(numProcesses, maxMatrix.cols());
+            for (size_t row = 0; row < numProcesses; row++) {
+                for (size_t col = 0; col < maxMatrix.cols(); col++) {
+                    if (maxMatrix(row, col) < allocationMatrix(row, col)) {
+                        throw allocationExceedsMaximum(row, col, maxMatrix(row, col), allocationMatrix(row, col));
+                    }
+                    needMatrix(row, col) = maxMatrix(row, col) - allocationMatrix(row, col);
+                }
+            }
+        }
+
+        // Count the safe sequences
+        // With a pool, the subtrees below each process that can run first are counted in parallel, sharing one memo table
+        SequenceCountResult count(ThreadPool* pool = nullptr) {
+            start();
+            SequenceCountResult result;
+            // With no processes the empty sequence is the one safe sequence, as the safety check reports
+            if (numProcesses == 0) {
+                result.count = 1;
+                return finish(result);
+            }
+            if (!rootIsSafe()) {
+                return finish(result);
+            }
+
+            vector<size_t> firsts;
+            for (size_t p = 0; p < numProcesses; p++) {
+                if (kernels.lessEqual(needMatrix.paddedRow(p).data(), availableVector.data(), stride())) {
+                    firsts.push_back(p);
+                }
+            }
+
+            vector<SequenceCount> subtreeCounts(firsts.size(), 0);
+            auto countSubtrees = [&](size_t begin, size_t end) {
+                Walker walker(*this);
+                for (size_t k = begin; k < end; k++) {
+                    walker.finish(firsts[k]);
+                    subtreeCounts[k] = countFrom(walker, 1, firsts[k]);
+                    walker.unfinish(firsts[k]);
+                }
+                visited += walker.nodes;
+            };
+            if (pool != nullptr && firsts.size() > 1) {
+                pool->parallelFor(0, firsts.size(), 1, countSubtrees);
+            } else {
+                countSubtrees(0, firsts.size());
+            }
+
+            for (auto subtree: subtreeCounts) {
+                result.count = saturatingAdd(result.count, subtree, result.saturated);
+            }
+            result.saturated |= saturated.load();
+            for (auto& shard: memo) {
+                result.statesMemoized += shard.entries.size();
+            }
+            return finish(result);
+        }
+
+        // Call onSequence(std::span<const size_t>) for every safe sequence, in lexicographic order of process numbers
+        // onSequence returns false to stop. Sequences are produced one at a time, so any number of them can be streamed.
+        template <typename OnSequence>
+        EnumerationStatus forEach(OnSequence onSequence) {
+            start();
+            if (!rootIsSafe()) {
+                return EnumerationStatus::COMPLETE;
+            }
+
+            Walker walker(*this);
+            vector<size_t> sequence;
+            sequence.reserve(numProcesses);
+            size_t produced = 0;
+            listFrom(walker, sequence, produced, onSequence);
+            return stopReason.load();
+        }
+
+    private:
+        using FinishedSet = vector<uint64_t>;
+
+        struct FinishedSetHash {
+            size_t operator()(const FinishedSet& set) const {
+                uint64_t hash = 0x9E3779B97F4A7C15ull;
+                for (auto word: set) {
+                    hash ^= word + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+                    hash *= 0xBF58476D1CE4E5B9ull;
+                }
+                return hash ^ (hash >> 31);
+            }
+        };
+
+        struct MemoShard {
+            std::mutex mutex;
+            std::unordered_map<FinishedSet, SequenceCount, FinishedSetHash> entries;
+        };
+
+        // Search state of one thread: the finished set and the available vector at every depth of the current path
+        struct Walker {
+            explicit Walker(const SafeSequenceEnumerator& enumerator) :
+                            finished(enumerator.numWords, 0), stride(enumerator.stride()),
+                            available((enumerator.numProcesses + 1) * stride, 0) {
+                std::copy(enumerator.availableVector.begin(), enumerator.availableVector.end(), available.begin());
+            }
+
+            size_t* availableAt(size_t depth) {
+                return available.data() + depth * stride;
+            }
+
+            bool isFinished(size_t process) const {
+                return (finished[process / 64] >> (process % 64)) & 1;
+            }
+
+            void finish(size_t process) {
+                finished[process / 64] |= uint64_t(1) << (process % 64);
+            }
+
+            void unfinish(size_t process) {
+                finished[process / 64] &= ~(uint64_t(1) << (process % 64));
+            }
+
+            FinishedSet finished;
+            size_t stride;
+            AlignedVector<size_t> available;
+            size_t nodes = 0;
+        };
+
+        size_t stride() const {
+            return needMatrix.stride();
+        }
+
+        void start() {
+            startTime = std::chrono::steady_clock::now();
+            stopReason = EnumerationStatus::COMPLETE;
+            stopping = false;
+            saturated = false;
+            visited = 0;
+            memoBytes = 0;
+            for (auto& shard: memo) {
+                shard.entries.clear();
+            }
+        }
+
+        SequenceCountResult& finish(SequenceCountResult& result) {
+            result.status = stopReason.load();
+            result.statesVisited = visited.load();
+            return result;
+        }
+
+        void stop(EnumerationStatus reason) {
+            EnumerationStatus expected = EnumerationStatus::COMPLETE;
+            stopReason.compare_exchange_strong(expected, reason);
+            stopping = true;
+        }
+
+        // Checked every few thousand states, reading the clock on every state would cost more than the state itself
+        void countNode(Walker& walker) {
+            if ((++walker.nodes & 4095) == 0 && limits.timeLimit.count() > 0 &&
+                std::chrono::steady_clock::now() - startTime > limits.timeLimit) {
+                stop(EnumerationStatus::TIME_LIMIT);
+            }
+        }
+
+        static SequenceCount saturatingAdd(SequenceCount lhs, SequenceCount rhs, bool& saturatedFlag) {
+            if (lhs > SEQUENCE_COUNT_MAX - rhs) {
+                saturatedFlag = true;
+                return SEQUENCE_COUNT_MAX;
+            }
+            return lhs + rhs;
+        }
+
+        // Greedy scan from the initial state, which finishes everyone exactly when a safe sequence exists
+        bool rootIsSafe() const {
+            AlignedVector<size_t> work(availableVector);
+            vector<char> finished(numProcesses, 0);
+            size_t numFinished = 0;
+            bool progress = true;
+            while (progress) {
+                progress = false;
+                for (size_t p = 0; p < numProcesses; p++) {
+                    if (!finished[p] && kernels.lessEqual(needMatrix.paddedRow(p).data(), work.data(), stride())) {
+                        if (!kernels.addInto(work.data(), allocationMatrix.paddedRow(p).data(), stride())) {
+                            throw std::overflow_error("Available resources overflowed when process " + std::to_string(p) + " released its allocation");
+                        }
+                        finished[p] = 1;
+                        numFinished++;
+                        progress = true;
+                    }
+                }
+            }
+            return numFinished == numProcesses;
+        }
+
+        // Fill in the available vector of depth from the one of depth - 1 and the process finished last
+        void advance(Walker& walker, size_t process, size_t depth) const {
+            size_t* next = walker.availableAt(depth);
+            std::copy(walker.availableAt(depth - 1), walker.availableAt(depth - 1) + stride(), next);
+            kernels.addInto(next, allocationMatrix.paddedRow(process).data(), stride());
+        }
+
+        // Number of safe completions of the walker's finished set, depth processes having finished with last the most recent
+        SequenceCount countFrom(Walker& walker, size_t depth, size_t last) {
+            advance(walker, last, depth);
+            const size_t remaining = numProcesses - depth;
+            // Every state reachable from a safe root is safe, so a single remaining process always finishes
+            if (remaining <= 1) {
+                return 1;
+            }
+            countNode(walker);
+            if (stopping) {
+                return 0;
+            }
+
+            MemoShard& shard = memo[FinishedSetHash()(walker.finished) % ENUMERATION_MEMO_SHARDS];
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto found = shard.entries.find(walker.finished);
+                if (found != shard.entries.end()) {
+                    return found->second;
+                }
+            }
+
+            SequenceCount total = 0;
+            bool totalSaturated = false;
+            const size_t* available = walker.availableAt(depth);
+            for (size_t p = 0; p < numProcesses && !stopping; p++) {
+                if (walker.isFinished(p) || !kernels.lessEqual(needMatrix.paddedRow(p).data(), available, stride())) {
+                    continue;
+                }
+                walker.finish(p);
+                total = saturatingAdd(total, countFrom(walker, depth + 1, p), totalSaturated);
+                walker.unfinish(p);
+            }
+            if (totalSaturated) {
+                saturated = true;
+            }
+
+            // A count cut short by a limit is only a lower bound and must not be reused
+            if (!stopping) {
+                remember(shard, walker.finished, total);
+            }
+            return total;
+        }
+
+        void remember(MemoShard& shard, const FinishedSet& finished, SequenceCount total) {
+            const size_t entryBytes = numWords * sizeof(uint64_t) + sizeof(SequenceCount) + ENUMERATION_MEMO_ENTRY_OVERHEAD;
+            if (limits.maxMemoryBytes > 0 && memoBytes.fetch_add(entryBytes) + entryBytes > limits.maxMemoryBytes) {
+                stop(EnumerationStatus::MEMORY_LIMIT);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.entries.emplace(finished, total);
+        }
+
+        template <typename OnSequence>
+        void listFrom(Walker& walker, vector<size_t>& sequence, size_t& produced, OnSequence& onSequence) {
+            const size_t depth = sequence.size();
+            if (depth > 0) {
+                advance(walker, sequence.back(), depth);
+            }
+            if (depth == numProcesses) {
+                if (!onSequence(std::span<const size_t>(sequence))) {
+                    stop(EnumerationStatus::STOPPED);
+                } else if (++produced == limits.maxSequences) {
+                    stop(EnumerationStatus::SEQUENCE_LIMIT);
+                }
+                return;
+            }
+            countNode(walker);
+
+            const size_t* available = walker.availableAt(depth);
+            for (size_t p = 0; p < numProcesses && !stopping; p++) {
+                if (walker.isFinished(p) || !kernels.lessEqual(needMatrix.paddedRow(p).data(), available, stride())) {
+                    continue;
+                }
+                walker.finish(p);
+                sequence.push_back(p);
+                listFrom(walker, sequence, produced, onSequence);
+                sequence.pop_back();
+                walker.unfinish(p);
+            }
+        }
+
+        AlignedVector<size_t> availableVector;
+        ResourceMatrix needMatrix;
+        ResourceMatrixView allocationMatrix;
+        size_t numProcesses;
+        size_t numWords;
+        EnumerationLimits limits;
+        ResourceKernels kernels;
+
+        MemoShard memo[ENUMERATION_MEMO_SHARDS];
+        std::atomic<size_t> memoBytes{0};
+        std::atomic<size_t> visited{0};
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> saturated{false};
+        std::atomic<EnumerationStatus> stopReason{EnumerationStatus::COMPLETE};
+        std::chrono::steady_clock::time_point startTime;
+};
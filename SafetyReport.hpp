@@ -0,0 +1,106 @@
+// SafetyReport.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+using std::vector, std::string;
+
+// Units of a resource type a blocked process needs beyond what was available once every other process had finished
+struct ResourceShortfall {
+    size_t resource;
+    size_t units;
+};
+
+// A process left unfinished when no other process could release enough resources for it
+struct BlockedProcess {
+    size_t process;
+    // Only the resource types the process is short of, in increasing order
+    vector<ResourceShortfall> shortfall;
+};
+
+// A blocked process whose allocation, if taken back, would let other blocked processes finish
+struct PreemptionCandidate {
+    size_t process;
+    // Number of the other blocked processes that could then finish, including those unblocked by their releases in turn
+    size_t unblocked;
+};
+
+// Outcome of a safety check, with a diagnosis of the deadlock when the state is unsafe
+struct SafetyReport {
+    bool safe = false;
+    // The safe sequence, or the processes that finished before the rest blocked
+    vector<size_t> sequence;
+    // Empty when the state is safe
+    vector<BlockedProcess> blocked;
+    // Ranked by unblocked, most first, and by process number between equals
+    vector<PreemptionCandidate> preemption;
+};
+
+// Flatten a safety report into 64-bit words, to be sent over a pipe or stored:
+//     safe, sequence length, sequence, blocked count, per blocked process its number, shortfall count and pairs of
+//     resource and units, candidate count, per preemption candidate its number and unblocked count
+inline vector<uint64_t> encodeSafetyReport(const SafetyReport& report) {
+    vector<uint64_t> words;
+    words.reserve(4 + report.sequence.size() + 2 * report.blocked.size() + 2 * report.preemption.size());
+    words.push_back(report.safe);
+    words.push_back(report.sequence.size());
+    words.insert(words.end(), report.sequence.begin(), report.sequence.end());
+    words.push_back(report.blocked.size());
+    for (const auto& blocked: report.blocked) {
+        words.push_back(blocked.process);
+        words.push_back(blocked.shortfall.size());
+        for (const auto& shortfall: blocked.shortfall) {
+            words.push_back(shortfall.resource);
+            words.push_back(shortfall.units);
+        }
+    }
+    words.push_back(report.preemption.size());
+    for (const auto& candidate: report.preemption) {
+        words.push_back(candidate.process);
+        words.push_back(candidate.unblocked);
+    }
+    return words;
+}
+
+// Rebuild a safety report from the words of encodeSafetyReport
+// Throws "<source> is truncated." if the words end early
+inline SafetyReport decodeSafetyReport(std::span<const uint64_t> words, const string& source) {
+    size_t next = 0;
+    auto take = [&](uint64_t count) {
+        if (count > words.size() - next) {
+            throw std::runtime_error(source + " is truncated.");
+        }
+        const uint64_t* first = words.data() + next;
+        next += count;
+        return first;
+    };
+
+    SafetyReport report;
+    report.safe = *take(1) != 0;
+    const uint64_t sequenceLength = *take(1);
+    const uint64_t* sequence = take(sequenceLength);
+    report.sequence.assign(sequence, sequence + sequenceLength);
+
+    const uint64_t numBlocked = *take(1);
+    for (uint64_t b = 0; b < numBlocked; b++) {
+        BlockedProcess blocked{*take(1), {}};
+        const uint64_t numShortfalls = *take(1);
+        for (uint64_t s = 0; s < numShortfalls; s++) {
+            const uint64_t* shortfall = take(2);
+            blocked.shortfall.push_back({shortfall[0], shortfall[1]});
+        }
+        report.blocked.push_back(std::move(blocked));
+    }
+
+    const uint64_t numCandidates = *take(1);
+    for (uint64_t c = 0; c < numCandidates; c++) {
+        const uint64_t* candidate = take(2);
+        report.preemption.push_back({candidate[0], candidate[1]});
+    }
+    return report;
+}
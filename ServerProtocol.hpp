@@ -0,0 +1,171 @@
+// ServerProtocol.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <span>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using std::vector, std::string;
+
+// Binary protocol spoken over the Unix socket of server mode, see BankerServer.hpp
+//
+// Every message in either direction is a MessageHeader followed by length bytes of payload. Numbers are 64 bit in the byte
+// order of the machine, as both ends run on it. A client may send any number of requests before reading the responses,
+// and a connection's responses come back in the order its requests were sent, each echoing the request's requestId.
+//
+// Request payloads:
+//     LOAD     u64 name length, name, path of a snapshot file   ->  OK: u64 handle, u64 processes, u64 resources
+//     OPEN     name of a loaded state                           ->  OK: u64 handle, u64 processes, u64 resources
+//     UNLOAD   u64 handle                                       ->  OK
+//     REQUEST  u64 handle, u64 pid, one u64 per resource type   ->  GRANTED, MUST_WAIT or UNSAFE
+//     RELEASE  u64 handle, u64 pid, one u64 per resource type   ->  OK
+//     CHECK    u64 handle                                       ->  SAFE: u64 safe sequence, or DEADLOCK
+// Any request can instead be answered with ERROR and a message as its payload.
+#define SERVER_PROTOCOL_MAX_PAYLOAD (64u << 20)
+
+enum class MessageType : uint16_t {
+    LOAD = 1,
+    OPEN,
+    UNLOAD,
+    REQUEST,
+    RELEASE,
+    CHECK
+};
+
+enum class ResponseStatus : uint16_t {
+    OK,
+    GRANTED,
+    MUST_WAIT,
+    UNSAFE,
+    SAFE,
+    DEADLOCK,
+    ERROR
+};
+
+inline const char* responseStatusName(ResponseStatus status) {
+    switch (status) {
+        case ResponseStatus::OK: return "ok";
+        case ResponseStatus::GRANTED: return "granted";
+        case ResponseStatus::MUST_WAIT: return "must wait";
+        case ResponseStatus::UNSAFE: return "unsafe";
+        case ResponseStatus::SAFE: return "safe";
+        case ResponseStatus::DEADLOCK: return "deadlock";
+        case ResponseStatus::ERROR: return "error";
+    }
+    return "unknown";
+}
+
+struct MessageHeader {
+    // Bytes of payload following the header
+    uint32_t length;
+    // MessageType of the request, echoed by the response
+    uint16_t type;
+    // ResponseStatus of a response, zero in a request
+    uint16_t status;
+    // Chosen by the client and echoed by the response
+    uint64_t requestId;
+};
+
+// Appends whole messages to a buffer
+class MessageWriter {
+    public:
+        explicit MessageWriter(vector<char>& buffer) : buffer(buffer) {}
+
+        // Start a message, the payload is everything appended until finish()
+        void begin(MessageType type, uint64_t requestId, ResponseStatus status = ResponseStatus::OK) {
+            start = buffer.size();
+            MessageHeader header = {0, static_cast<uint16_t>(type), static_cast<uint16_t>(status), requestId};
+            append(&header, sizeof(header));
+        }
+
+        void number(uint64_t value) {
+            append(&value, sizeof(value));
+        }
+
+        void numbers(std::span<const size_t> values) {
+            append(values.data(), values.size() * sizeof(size_t));
+        }
+
+        void text(std::string_view value) {
+            append(value.data(), value.size());
+        }
+
+        void finish() {
+            const uint32_t length = static_cast<uint32_t>(buffer.size() - start - sizeof(MessageHeader));
+            std::memcpy(buffer.data() + start, &length, sizeof(length));
+        }
+
+    private:
+        void append(const void* data, size_t bytes) {
+            const char* begin = static_cast<const char*>(data);
+            buffer.insert(buffer.end(), begin, begin + bytes);
+        }
+
+        vector<char>& buffer;
+        size_t start = 0;
+};
+
+// Reads the fields of a payload in order, throwing if the payload is too short
+class MessageReader {
+    public:
+        explicit MessageReader(std::span<const char> payload) : payload(payload) {}
+
+        uint64_t number() {
+            uint64_t value;
+            std::memcpy(&value, take(sizeof(value)), sizeof(value));
+            return value;
+        }
+
+        std::string_view text(size_t length) {
+            return std::string_view(take(length), length);
+        }
+
+        // Everything not read yet
+        std::span<const char> rest() {
+            auto result = payload.subspan(position);
+            position = payload.size();
+            return result;
+        }
+
+        // The rest of the payload as 64 bit numbers
+        vector<size_t> numbers() {
+            if ((payload.size() - position) % sizeof(size_t) != 0) {
+                throw std::runtime_error("Malformed message, payload is not a whole number of values");
+            }
+            vector<size_t> values((payload.size() - position) / sizeof(size_t));
+            std::memcpy(values.data(), take(values.size() * sizeof(size_t)), values.size() * sizeof(size_t));
+            return values;
+        }
+
+    private:
+        const char* take(size_t bytes) {
+            if (bytes > payload.size() - position) {
+                throw std::runtime_error("Malformed message, payload is too short");
+            }
+            const char* data = payload.data() + position;
+            position += bytes;
+            return data;
+        }
+
+        std::span<const char> payload;
+        size_t position = 0;
+};
+
+// If buffer starts with a complete message, returns its total size in bytes, otherwise zero
+// Throws if the header announces a payload larger than SERVER_PROTOCOL_MAX_PAYLOAD
+inline size_t completeMessageSize(std::span<const char> buffer) {
+    if (buffer.size() < sizeof(MessageHeader)) {
+        return 0;
+    }
+    MessageHeader header;
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    if (header.length > SERVER_PROTOCOL_MAX_PAYLOAD) {
+        throw std::runtime_error("Message payload of " + std::to_string(header.length) + " bytes is too large");
+    }
+    const size_t total = sizeof(MessageHeader) + header.length;
+    return buffer.size() >= total ? total : 0;
+}
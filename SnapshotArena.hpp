@@ -0,0 +1,87 @@
+// SnapshotArena.hpp
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <cstddef>
+
+// Size in bytes of the buffer a SnapshotArena starts with
+#define SNAPSHOT_ARENA_INITIAL_BYTES (1 << 20)
+
+// Monotonic arena for everything allocated while reading and checking one snapshot
+// Allocating bumps a pointer and freeing does nothing, until reset() frees everything at once. Allocations that do not fit
+// the buffer are passed on to the global allocator, and reset() then grows the buffer by as much, so a loop over snapshots
+// of similar size soon stops calling the global allocator at all.
+// An arena is not thread safe, give each thread its own.
+class SnapshotArena {
+    public:
+        explicit SnapshotArena(size_t initialBytes = SNAPSHOT_ARENA_INITIAL_BYTES) {
+            allocateBuffer(initialBytes);
+        }
+
+        // Objects using the arena point into it, so it cannot move
+        SnapshotArena(const SnapshotArena&) = delete;
+        SnapshotArena& operator=(const SnapshotArena&) = delete;
+
+        std::pmr::memory_resource* resource() {
+            return &*arena;
+        }
+
+        // Free everything allocated from the arena, which must no longer be in use
+        void reset() {
+            const size_t overflowBytes = overflow.bytes;
+            arena.reset();
+            if (overflowBytes > 0) {
+                allocateBuffer(bufferBytes + overflowBytes);
+            } else {
+                arena.emplace(buffer.get(), bufferBytes, &overflow);
+            }
+        }
+
+        // Size of the buffer allocations are currently served from
+        size_t capacity() const {
+            return bufferBytes;
+        }
+
+        // Allocations passed on to the global allocator since the arena was created
+        size_t overflowAllocations() const {
+            return overflow.allocations;
+        }
+
+    private:
+        // Upstream of the arena, counting the bytes it passes on to the global allocator since the last reset
+        class OverflowResource : public std::pmr::memory_resource {
+            public:
+                size_t bytes = 0;
+                size_t allocations = 0;
+
+            private:
+                void* do_allocate(size_t size, size_t alignment) override {
+                    bytes += size;
+                    allocations++;
+                    return std::pmr::new_delete_resource()->allocate(size, alignment);
+                }
+
+                void do_deallocate(void* pointer, size_t size, size_t alignment) override {
+                    std::pmr::new_delete_resource()->deallocate(pointer, size, alignment);
+                }
+
+                bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                    return this == &other;
+                }
+        };
+
+        void allocateBuffer(size_t size) {
+            buffer.reset();
+            buffer = std::make_unique_for_overwrite<std::byte[]>(size);
+            bufferBytes = size;
+            overflow.bytes = 0;
+            arena.emplace(buffer.get(), bufferBytes, &overflow);
+        }
+
+        OverflowResource overflow;
+        std::unique_ptr<std::byte[]> buffer;
+        size_t bufferBytes = 0;
+        std::optional<std::pmr::monotonic_buffer_resource> arena;
+};
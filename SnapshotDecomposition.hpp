@@ -0,0 +1,256 @@
+// SnapshotDecomposition.hpp
+#pragma once
+
+#include <vector>
+#include <span>
+#include <numeric>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "SafetyReport.hpp"
+#include "SparseSafety.hpp"
+#include "ThreadPool.hpp"
+
+using std::vector;
+
+// Processes and the resource types they hold or claim, sharing no resource type with any other component
+// Both lists are in increasing order. Processes that hold and claim nothing share the one component without resource types.
+struct SnapshotComponent {
+    vector<size_t> processes;
+    vector<size_t> resources;
+};
+
+// Safety of one component, numbered like the whole snapshot
+struct ComponentReport {
+    SnapshotComponent component;
+    SafetyReport report;
+};
+
+struct DecomposedSafetyReport {
+    // Result for the whole snapshot, as BankerAlgorithm::checkSafety would report it
+    SafetyReport merged;
+    // In order of their first process
+    vector<ComponentReport> components;
+};
+
+// Union-find over processes and resource types, with path halving and union by size
+class DisjointSets {
+    public:
+        explicit DisjointSets(size_t size) : parent(size), setSize(size, 1) {
+            std::iota(parent.begin(), parent.end(), 0);
+        }
+
+        size_t find(size_t element) {
+            while (parent[element] != element) {
+                parent[element] = parent[parent[element]];
+                element = parent[element];
+            }
+            return element;
+        }
+
+        void unite(size_t lhs, size_t rhs) {
+            lhs = find(lhs);
+            rhs = find(rhs);
+            if (lhs == rhs) {
+                return;
+            }
+            if (setSize[lhs] < setSize[rhs]) {
+                std::swap(lhs, rhs);
+            }
+            parent[rhs] = lhs;
+            setSize[lhs] += setSize[rhs];
+        }
+
+    private:
+        vector<size_t> parent;
+        vector<size_t> setSize;
+};
+
+// Throws the error of BankerAlgorithm if any allocation exceeds its maximum
+// Components only follow the maximum matrix, so an allocation beyond it would otherwise be dropped from every component
+inline void checkAllocationsWithinMaximum(ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    for (size_t i = 0; i < maxMatrix.rows(); i++) {
+        auto maxRow = maxMatrix.row(i);
+        auto allocationRow = allocationMatrix.row(i);
+        for (size_t j = 0; j < maxMatrix.cols(); j++) {
+            if (maxRow[j] < allocationRow[j]) {
+                throw allocationExceedsMaximum(i, j, maxRow[j], allocationRow[j]);
+            }
+        }
+    }
+}
+
+// Connected components of the bipartite graph linking every process to the resource types with a non-zero maximum
+// Once checkAllocationsWithinMaximum has passed, allocations and needs are at most the maximum, so processes in different
+// components never compete for a resource
+inline vector<SnapshotComponent> findSnapshotComponents(ResourceMatrixView maxMatrix) {
+    const size_t numProcesses = maxMatrix.rows();
+    const size_t numResources = maxMatrix.cols();
+
+    // Processes are elements 0 to P - 1, resource type j is element P + j
+    DisjointSets sets(numProcesses + numResources);
+    vector<char> usesResources(numProcesses, 0);
+    vector<char> resourceUsed(numResources, 0);
+    for (size_t i = 0; i < numProcesses; i++) {
+        auto row = maxMatrix.row(i);
+        for (size_t j = 0; j < numResources; j++) {
+            if (row[j] != 0) {
+                sets.unite(i, numProcesses + j);
+                usesResources[i] = 1;
+                resourceUsed[j] = 1;
+            }
+        }
+    }
+
+    // Number the components in order of their first process
+    vector<SnapshotComponent> components;
+    vector<size_t> componentOf(numProcesses + numResources, SIZE_MAX);
+    size_t idleComponent = SIZE_MAX;
+    for (size_t i = 0; i < numProcesses; i++) {
+        size_t& id = usesResources[i] ? componentOf[sets.find(i)] : idleComponent;
+        if (id == SIZE_MAX) {
+            id = components.size();
+            components.emplace_back();
+        }
+        components[id].processes.push_back(i);
+    }
+    for (size_t j = 0; j < numResources; j++) {
+        if (resourceUsed[j]) {
+            components[componentOf[sets.find(numProcesses + j)]].resources.push_back(j);
+        }
+    }
+    return components;
+}
+
+// Check one component as a snapshot of its own, returning a report numbered like the whole snapshot
+inline SafetyReport checkComponentSafety(const SnapshotComponent& component, std::span<const size_t> availableVector,
+                                         ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                                         SafetyEngine engine, SequenceOrder order) {
+    SafetyReport report;
+    if (component.resources.empty()) {
+        // Processes without any claim all finish in the first pass
+        report.safe = true;
+        report.sequence = component.processes;
+        return report;
+    }
+
+    const size_t numProcesses = component.processes.size();
+    const size_t numResources = component.resources.size();
+    vector<size_t> subAvailable(numResources);
+    ResourceMatrix subMax(numProcesses, numResources);
+    ResourceMatrix subAllocation(numProcesses, numResources);
+    for (size_t k = 0; k < numResources; k++) {
+        subAvailable[k] = availableVector[component.resources[k]];
+    }
+    for (size_t p = 0; p < numProcesses; p++) {
+        for (size_t k = 0; k < numResources; k++) {
+            subMax(p, k) = maxMatrix(component.processes[p], component.resources[k]);
+            subAllocation(p, k) = allocationMatrix(component.processes[p], component.resources[k]);
+        }
+    }
+
+    report = checkSafetyAuto(subAvailable, subMax.view(), subAllocation.view(), engine, order);
+
+    // Back to the numbers of the whole snapshot
+    for (auto& process: report.sequence) {
+        process = component.processes[process];
+    }
+    for (auto& blocked: report.blocked) {
+        blocked.process = component.processes[blocked.process];
+        for (auto& shortfall: blocked.shortfall) {
+            shortfall.resource = component.resources[shortfall.resource];
+        }
+    }
+    for (auto& candidate: report.preemption) {
+        candidate.process = component.processes[candidate.process];
+    }
+    return report;
+}
+
+// Merge the reports of independent components into the report of the whole snapshot
+// Within a FIFO sequence, a pass ends exactly where the process number drops, as a process after a higher one in the same
+// pass would have been finished by that pass. Components do not affect each other, so every process finishes in the same
+// pass in the whole snapshot as in its component, and sorting by pass and then process number gives the FIFO sequence of
+// the whole snapshot. Any other order concatenates the sequences.
+inline SafetyReport mergeComponentReports(const vector<ComponentReport>& components, SequenceOrder order) {
+    SafetyReport merged;
+    merged.safe = true;
+
+    vector<std::pair<size_t, size_t>> passAndProcess;
+    for (const auto& component: components) {
+        const SafetyReport& report = component.report;
+        merged.safe = merged.safe && report.safe;
+        size_t pass = 0;
+        for (size_t k = 0; k < report.sequence.size(); k++) {
+            if (k > 0 && report.sequence[k] < report.sequence[k - 1]) {
+                pass++;
+            }
+            passAndProcess.push_back({pass, report.sequence[k]});
+        }
+        merged.blocked.insert(merged.blocked.end(), report.blocked.begin(), report.blocked.end());
+        merged.preemption.insert(merged.preemption.end(), report.preemption.begin(), report.preemption.end());
+    }
+
+    if (order == SequenceOrder::FIFO) {
+        std::sort(passAndProcess.begin(), passAndProcess.end());
+    }
+    merged.sequence.reserve(passAndProcess.size());
+    for (const auto& [pass, process]: passAndProcess) {
+        merged.sequence.push_back(process);
+    }
+
+    std::sort(merged.blocked.begin(), merged.blocked.end(), [](const BlockedProcess& lhs, const BlockedProcess& rhs) {
+        return lhs.process < rhs.process;
+    });
+    std::sort(merged.preemption.begin(), merged.preemption.end(), [](const PreemptionCandidate& lhs, const PreemptionCandidate& rhs) {
+        return lhs.unblocked > rhs.unblocked || (lhs.unblocked == rhs.unblocked && lhs.process < rhs.process);
+    });
+    return merged;
+}
+
+// Check safety one independent component at a time, the components in parallel on pool
+// Components are handed to the pool largest first, so one large component does not start last and hold up the rest.
+inline DecomposedSafetyReport checkSafetyDecomposed(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                                                    SafetyEngine engine, SequenceOrder order, ThreadPool& pool) {
+    if (allocationMatrix.rows() != maxMatrix.rows() || allocationMatrix.cols() != maxMatrix.cols() || availableVector.size() != maxMatrix.cols()) {
+        throw std::runtime_error("Available Vector, Maximum Matrix and Allocation Matrix dimensions do not match.");
+    }
+    checkAllocationsWithinMaximum(maxMatrix, allocationMatrix);
+
+    DecomposedSafetyReport result;
+    vector<SnapshotComponent> components = findSnapshotComponents(maxMatrix);
+    result.components.resize(components.size());
+
+    vector<size_t> bySize(components.size());
+    std::iota(bySize.begin(), bySize.end(), 0);
+    std::stable_sort(bySize.begin(), bySize.end(), [&](size_t lhs, size_t rhs) {
+        return components[lhs].processes.size() * components[lhs].resources.size() >
+               components[rhs].processes.size() * components[rhs].resources.size();
+    });
+
+    // Pool tasks must not throw, so the first error is kept and thrown once every component is done
+    vector<std::exception_ptr> errors(components.size());
+    pool.parallelFor(0, bySize.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            const size_t id = bySize[k];
+            try {
+                result.components[id].report = checkComponentSafety(components[id], availableVector, maxMatrix, allocationMatrix, engine, order);
+            } catch (...) {
+                errors[id] = std::current_exception();
+            }
+        }
+    });
+    for (auto& error: errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    for (size_t id = 0; id < components.size(); id++) {
+        result.components[id].component = std::move(components[id]);
+    }
+    result.merged = mergeComponentReports(result.components, order);
+    return result;
+}
@@ -0,0 +1,169 @@
+// SnapshotDelta.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+
+using std::vector, std::string;
+
+// Kind of a frame of the delta transport
+enum class DeltaFrameKind : uint64_t {
+    // The whole snapshot
+    KEYFRAME,
+    // The changes from the snapshot of frame baseSequence
+    DELTA
+};
+
+// Written in front of every frame of the delta transport
+// A keyframe is followed by the available vector and both matrices with their row padding. A delta is followed by the
+// words of encodeSnapshotDelta.
+struct DeltaFrameHeader {
+    uint64_t kind;
+    // Frames are numbered from 1 by their sender, so a receiver can tell when it missed one
+    uint64_t sequence;
+    uint64_t baseSequence;
+    // Dimensions of the snapshot once the frame is applied
+    uint64_t numProcesses;
+    uint64_t numResources;
+    // Counts of the parts of a delta
+    uint64_t numRemovedRows;
+    uint64_t numAppendedRows;
+    uint64_t numChangedCells;
+};
+
+// Words following a delta frame header:
+//     available vector, removed rows numbered as in the base, appended rows of the maximum matrix, appended rows of the
+//     allocation matrix, then row, column, maximum and allocation of every changed cell, rows numbered as in the result
+inline size_t deltaPayloadWords(const DeltaFrameHeader& header) {
+    return header.numResources + header.numRemovedRows + 2 * header.numAppendedRows * header.numResources + 4 * header.numChangedCells;
+}
+
+// Words following a keyframe header
+inline size_t keyframePayloadWords(size_t numProcesses, size_t numResources) {
+    return numResources + 2 * numProcesses * ResourceMatrix::paddedStride(numResources);
+}
+
+// Encode the changes from the base snapshot to the next one into header and words, reusing the capacity of words
+// Rows are matched in order. A base row that differs from the next row while the two base rows after it match the next
+// two rows is taken as removed, which covers a process leaving from anywhere in the table, and rows beyond the base are
+// appended.
+// Returns false, leaving header and words unspecified, when the delta would be no smaller than a keyframe.
+inline bool encodeSnapshotDelta(std::span<const size_t> baseAvailable, ResourceMatrixView baseMax, ResourceMatrixView baseAllocation,
+                                std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                                DeltaFrameHeader& header, vector<uint64_t>& words) {
+    const size_t numResources = availableVector.size();
+    if (baseAvailable.size() != numResources || baseMax.cols() != numResources || maxMatrix.cols() != numResources) {
+        return false;
+    }
+    const size_t baseRows = baseMax.rows();
+    const size_t numRows = maxMatrix.rows();
+    const size_t limit = keyframePayloadWords(numRows, numResources);
+
+    auto sameRow = [&](size_t baseRow, size_t row) {
+        return std::memcmp(baseMax.row(baseRow).data(), maxMatrix.row(row).data(), numResources * sizeof(size_t)) == 0 &&
+               std::memcmp(baseAllocation.row(baseRow).data(), allocationMatrix.row(row).data(), numResources * sizeof(size_t)) == 0;
+    };
+
+    vector<uint64_t> removed;
+    vector<uint64_t> cells;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < baseRows && j < numRows) {
+        if (sameRow(i, j)) {
+            i++;
+            j++;
+        } else if (i + 1 < baseRows && sameRow(i + 1, j) && (i + 2 == baseRows || j + 1 == numRows || sameRow(i + 2, j + 1))) {
+            removed.push_back(i++);
+        } else {
+            auto baseMaxRow = baseMax.row(i);
+            auto baseAllocationRow = baseAllocation.row(i);
+            auto maxRow = maxMatrix.row(j);
+            auto allocationRow = allocationMatrix.row(j);
+            for (size_t c = 0; c < numResources; c++) {
+                if (baseMaxRow[c] != maxRow[c] || baseAllocationRow[c] != allocationRow[c]) {
+                    cells.insert(cells.end(), {j, c, maxRow[c], allocationRow[c]});
+                }
+            }
+            if (removed.size() + cells.size() > limit) {
+                return false;
+            }
+            i++;
+            j++;
+        }
+    }
+    while (i < baseRows) {
+        removed.push_back(i++);
+    }
+
+    header.kind = static_cast<uint64_t>(DeltaFrameKind::DELTA);
+    header.numProcesses = numRows;
+    header.numResources = numResources;
+    header.numRemovedRows = removed.size();
+    header.numAppendedRows = numRows - j;
+    header.numChangedCells = cells.size() / 4;
+    if (deltaPayloadWords(header) >= limit) {
+        return false;
+    }
+
+    words.clear();
+    words.insert(words.end(), availableVector.begin(), availableVector.end());
+    words.insert(words.end(), removed.begin(), removed.end());
+    for (size_t r = j; r < numRows; r++) {
+        words.insert(words.end(), maxMatrix.row(r).begin(), maxMatrix.row(r).end());
+    }
+    for (size_t r = j; r < numRows; r++) {
+        words.insert(words.end(), allocationMatrix.row(r).begin(), allocationMatrix.row(r).end());
+    }
+    words.insert(words.end(), cells.begin(), cells.end());
+    return true;
+}
+
+// Patch a snapshot in place with a delta, in time proportional to the size of the delta except for removed rows, which
+// move the rows after them
+// Throws if the delta does not fit the snapshot, which is then left unspecified
+inline void applySnapshotDelta(const DeltaFrameHeader& header, std::span<const uint64_t> words,
+                               vector<size_t>& availableVector, ResourceMatrix& maxMatrix, ResourceMatrix& allocationMatrix) {
+    const size_t numResources = header.numResources;
+    if (words.size() != deltaPayloadWords(header) || availableVector.size() != numResources || maxMatrix.cols() != numResources ||
+        allocationMatrix.cols() != numResources || allocationMatrix.rows() != maxMatrix.rows()) {
+        throw std::runtime_error("Snapshot delta does not fit the snapshot it was applied to.");
+    }
+
+    const uint64_t* next = words.data();
+    std::copy_n(next, numResources, availableVector.begin());
+    next += numResources;
+
+    std::span<const size_t> removed(next, header.numRemovedRows);
+    for (size_t k = 0; k < removed.size(); k++) {
+        if (removed[k] >= maxMatrix.rows() || (k > 0 && removed[k] <= removed[k - 1])) {
+            throw std::runtime_error("Snapshot delta removes an invalid row.");
+        }
+    }
+    maxMatrix.removeRows(removed);
+    allocationMatrix.removeRows(removed);
+    next += header.numRemovedRows;
+
+    for (uint64_t r = 0; r < header.numAppendedRows; r++) {
+        maxMatrix.appendRow(std::span<const size_t>(next + r * numResources, numResources));
+        allocationMatrix.appendRow(std::span<const size_t>(next + (header.numAppendedRows + r) * numResources, numResources));
+    }
+    next += 2 * header.numAppendedRows * numResources;
+
+    if (maxMatrix.rows() != header.numProcesses) {
+        throw std::runtime_error("Snapshot delta leaves " + std::to_string(maxMatrix.rows()) + " processes instead of " +
+                                 std::to_string(header.numProcesses) + ".");
+    }
+    for (uint64_t k = 0; k < header.numChangedCells; k++, next += 4) {
+        if (next[0] >= header.numProcesses || next[1] >= numResources) {
+            throw std::runtime_error("Snapshot delta changes a cell outside the snapshot.");
+        }
+        maxMatrix(next[0], next[1]) = next[2];
+        allocationMatrix(next[0], next[1]) = next[3];
+    }
+}
@@ -0,0 +1,156 @@
+// SnapshotGenerator.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+
+using std::vector, std::string;
+
+// How hard a generated snapshot is to prove safe
+enum class SnapshotShape {
+    // Every process fits the available resources from the start, so any order is safe
+    SAFE,
+    // Safe along a hidden order, with every process needing exactly what is available in one resource type when its turn
+    // comes, so it is blocked until at least its turn. It may still run later, and other sets of predecessors can free the
+    // same amount, so many safe orders usually exist as well.
+    BARELY_SAFE,
+    // BARELY_SAFE with one process needing one unit more than can ever become available
+    DEADLOCK,
+    // BARELY_SAFE along the reverse index order, so a FIFO scan finishes only one process per pass
+    CHAIN
+};
+
+inline const char* snapshotShapeName(SnapshotShape shape) {
+    switch (shape) {
+        case SnapshotShape::BARELY_SAFE: return "barely-safe";
+        case SnapshotShape::DEADLOCK: return "deadlock";
+        case SnapshotShape::CHAIN: return "chain";
+        default: return "safe";
+    }
+}
+
+inline SnapshotShape parseSnapshotShape(const string& name) {
+    for (SnapshotShape shape: {SnapshotShape::SAFE, SnapshotShape::BARELY_SAFE, SnapshotShape::DEADLOCK, SnapshotShape::CHAIN}) {
+        if (name == snapshotShapeName(shape)) {
+            return shape;
+        }
+    }
+    throw std::runtime_error("Unknown snapshot shape " + name + ", expected safe, barely-safe, deadlock or chain");
+}
+
+struct GeneratedSnapshot {
+    vector<size_t> availableVector;
+    ResourceMatrix maxMatrix;
+    ResourceMatrix allocationMatrix;
+};
+
+// Generates random Program Snapshots of a given size and shape
+// The same seed always generates the same snapshots, so benchmark runs on different builds see identical inputs
+class SnapshotGenerator {
+    public:
+        explicit SnapshotGenerator(uint64_t seed) : random(seed) {}
+
+        // Allocations and needs are drawn from [1, maxValue] and [0, maxValue]. Available counts grow with the number of
+        // processes in the tight shapes, as they must cover the sum of allocations released before the last process runs.
+        GeneratedSnapshot generate(size_t numProcesses, size_t numResources, SnapshotShape shape, size_t maxValue = 1000) {
+            if (numProcesses == 0 || numResources == 0 || maxValue == 0) {
+                throw std::runtime_error("Generated snapshots need at least one process, one resource type and a maximum value above zero");
+            }
+
+            GeneratedSnapshot snapshot;
+            snapshot.availableVector.assign(numResources, 0);
+            snapshot.allocationMatrix = ResourceMatrix(numProcesses, numResources);
+            snapshot.maxMatrix = ResourceMatrix(numProcesses, numResources);
+            ResourceMatrix needMatrix(numProcesses, numResources);
+
+            std::uniform_int_distribution<size_t> allocationDistribution(1, maxValue);
+            for (size_t i = 0; i < numProcesses; i++) {
+                for (auto& value: snapshot.allocationMatrix.row(i)) {
+                    value = allocationDistribution(random);
+                }
+            }
+
+            if (shape == SnapshotShape::SAFE) {
+                std::uniform_int_distribution<size_t> needDistribution(0, maxValue);
+                for (size_t i = 0; i < numProcesses; i++) {
+                    for (auto& value: needMatrix.row(i)) {
+                        value = needDistribution(random);
+                    }
+                }
+                // Enough of every resource type for the neediest process
+                for (size_t i = 0; i < numProcesses; i++) {
+                    auto need = needMatrix.row(i);
+                    for (size_t j = 0; j < numResources; j++) {
+                        snapshot.availableVector[j] = std::max(snapshot.availableVector[j], need[j]);
+                    }
+                }
+            } else {
+                generateTight(snapshot, needMatrix, shape, maxValue);
+            }
+
+            for (size_t i = 0; i < numProcesses; i++) {
+                auto allocation = snapshot.allocationMatrix.row(i);
+                auto need = needMatrix.row(i);
+                auto maximum = snapshot.maxMatrix.row(i);
+                for (size_t j = 0; j < numResources; j++) {
+                    maximum[j] = allocation[j] + need[j];
+                }
+            }
+            return snapshot;
+        }
+
+    private:
+        // Walks the processes in the hidden safe order, giving each a need that fits the resources available at its turn and
+        // exactly matches them in one resource type, which keeps it blocked before its turn
+        void generateTight(GeneratedSnapshot& snapshot, ResourceMatrix& needMatrix, SnapshotShape shape, size_t maxValue) {
+            const size_t numProcesses = needMatrix.rows();
+            const size_t numResources = needMatrix.cols();
+
+            vector<size_t> order(numProcesses);
+            std::iota(order.begin(), order.end(), 0);
+            if (shape == SnapshotShape::CHAIN) {
+                std::reverse(order.begin(), order.end());
+            } else {
+                std::shuffle(order.begin(), order.end(), random);
+            }
+
+            std::uniform_int_distribution<size_t> startDistribution(0, maxValue);
+            for (auto& value: snapshot.availableVector) {
+                value = startDistribution(random);
+            }
+
+            vector<size_t> running(snapshot.availableVector);
+            std::uniform_int_distribution<size_t> resourceDistribution(0, numResources - 1);
+            for (size_t k = 0; k < numProcesses; k++) {
+                const size_t process = order[k];
+                auto need = needMatrix.row(process);
+                for (size_t j = 0; j < numResources; j++) {
+                    need[j] = std::uniform_int_distribution<size_t>(0, running[j])(random);
+                }
+                // Every allocation is at least one, so a need equal to what is available at this turn is more than was
+                // available at any earlier turn
+                const size_t tight = resourceDistribution(random);
+                need[tight] = running[tight];
+
+                auto allocation = snapshot.allocationMatrix.row(process);
+                for (size_t j = 0; j < numResources; j++) {
+                    running[j] += allocation[j];
+                }
+            }
+
+            if (shape == SnapshotShape::DEADLOCK) {
+                // running now holds everything that can ever be available, one unit more can never be granted
+                const size_t stuck = order[numProcesses / 2];
+                const size_t resource = resourceDistribution(random);
+                needMatrix(stuck, resource) = running[resource] - snapshot.allocationMatrix(stuck, resource) + 1;
+            }
+        }
+
+        std::mt19937_64 random;
+};
@@ -0,0 +1,345 @@
+// SolverWorkerPool.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <memory>
+#include <optional>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "BankerAlgorithm.hpp"
+#include "FixedBankerAlgorithm.hpp"
+#include "SnapshotArena.hpp"
+#include "PipeTransport.hpp"
+
+using std::vector, std::string;
+
+// Outcome of a snapshot analyzed by a worker
+enum class SolverStatus : uint32_t {
+    SAFE,
+    DEADLOCK,
+    // The snapshot could not be analyzed or the worker crashed, message says why
+    ERROR
+};
+
+struct SolverResult {
+    uint64_t requestId = 0;
+    SolverStatus status = SolverStatus::ERROR;
+    vector<size_t> safeSequence;
+    string message;
+};
+
+// Fixed set of pre-forked solver processes that each analyze one snapshot at a time
+//
+// Every worker keeps a pair of pipes to the parent for its whole life. A request is the request ID followed by the snapshot
+// in the selected transport, and a response is a SolverResponseHeader followed by the safe sequence or the error message.
+// Responses arrive in whatever order the workers finish and are matched to their requests by ID. A worker that dies is
+// reaped, its request is reported as an error, and a new worker takes its place.
+// With Transport::DELTA every worker is sent deltas from the last snapshot it was sent. A worker that cannot apply one
+// answers NEED_KEYFRAME instead of a result, and is sent its request again as a keyframe.
+class SolverWorkerPool {
+    public:
+        SolverWorkerPool(size_t numWorkers, Transport transport, SafetyEngine engine, SequenceOrder order) :
+                         transport(transport), engine(engine), order(order) {
+            // A write to a worker that just died must fail with EPIPE instead of killing the parent
+            signal(SIGPIPE, SIG_IGN);
+
+            workers.resize(std::max<size_t>(1, numWorkers));
+            for (size_t i = 0; i < workers.size(); i++) {
+                startWorker(i);
+            }
+        }
+
+        // Closing the request pipes tells the workers to exit
+        ~SolverWorkerPool() {
+            for (size_t i = 0; i < workers.size(); i++) {
+                stopWorker(i);
+            }
+        }
+
+        SolverWorkerPool(const SolverWorkerPool&) = delete;
+        SolverWorkerPool& operator=(const SolverWorkerPool&) = delete;
+
+        size_t size() const {
+            return workers.size();
+        }
+
+        // Number of requests sent and not answered yet
+        size_t inFlight() const {
+            size_t busy = 0;
+            for (const auto& worker: workers) {
+                busy += worker.busy;
+            }
+            return busy;
+        }
+
+        bool hasIdleWorker() const {
+            return inFlight() < workers.size();
+        }
+
+        // Number of workers started again after crashing
+        size_t restarts() const {
+            return numRestarts;
+        }
+
+        // Send a snapshot to an idle worker, there must be one
+        // A worker found dead while sending is replaced and the request sent to its replacement
+        void submit(uint64_t requestId, std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            size_t index = 0;
+            while (index < workers.size() && workers[index].busy) {
+                index++;
+            }
+            if (index == workers.size()) {
+                throw std::runtime_error("No idle solver worker to submit to");
+            }
+
+            for (size_t attempt = 0; ; attempt++) {
+                try {
+                    Worker& worker = workers[index];
+                    writeFull(worker.toWorker[WRITE_END], &requestId, sizeof(requestId), "Request ID");
+                    worker.transport->send(worker.toWorker, availableVector, maxMatrix, allocationMatrix);
+                    worker.busy = true;
+                    worker.requestId = requestId;
+                    return;
+                } catch (const std::runtime_error&) {
+                    restartWorker(index);
+                    if (attempt > 0) {
+                        throw;
+                    }
+                }
+            }
+        }
+
+        // Block until a busy worker responds, and return its result
+        void nextResult(SolverResult& result) {
+            if (inFlight() == 0) {
+                throw std::runtime_error("No solver request in flight");
+            }
+
+            vector<pollfd> waiting;
+            vector<size_t> waitingWorker;
+            for (size_t i = 0; i < workers.size(); i++) {
+                if (workers[i].busy) {
+                    waiting.push_back({workers[i].fromWorker[READ_END], POLLIN, 0});
+                    waitingWorker.push_back(i);
+                }
+            }
+
+            while (true) {
+                while (poll(waiting.data(), waiting.size(), -1) == -1) {
+                    if (errno != EINTR) {
+                        throw std::runtime_error("Polling solver workers failed");
+                    }
+                }
+
+                for (size_t k = 0; k < waiting.size(); k++) {
+                    if (waiting[k].revents != 0) {
+                        if (receiveResult(waitingWorker[k], result)) {
+                            return;
+                        }
+                        waiting[k].revents = 0;
+                    }
+                }
+            }
+        }
+
+    private:
+        // Written by a worker in front of every response, followed by count sequence entries or count message bytes
+        struct SolverResponseHeader {
+            uint64_t requestId;
+            uint32_t status;
+            uint32_t reserved;
+            uint64_t count;
+        };
+
+        // Status of a response without a result, from a worker that could not apply the delta it was sent
+        static constexpr uint32_t NEED_KEYFRAME = UINT32_MAX;
+
+        struct Worker {
+            pid_t pid = -1;
+            int toWorker[2] = {-1, -1};
+            int fromWorker[2] = {-1, -1};
+            // Created before the worker is forked, so a shared memory region is inherited by it
+            std::unique_ptr<SnapshotTransport> transport;
+            bool busy = false;
+            uint64_t requestId = 0;
+        };
+
+        void startWorker(size_t index) {
+            Worker& worker = workers[index];
+            worker.transport = std::make_unique<SnapshotTransport>(transport);
+            if (pipe(worker.toWorker) == -1 || pipe(worker.fromWorker) == -1) {
+                throw std::runtime_error("Pipe Creation Failed");
+            }
+
+            worker.pid = fork();
+            if (worker.pid == -1) {
+                throw std::runtime_error("Fork Failed");
+            }
+
+            if (worker.pid == 0) {
+                // Drop the parent's ends of every other worker's pipes, otherwise they would never see the end of their requests
+                for (size_t i = 0; i < workers.size(); i++) {
+                    if (i != index && workers[i].pid > 0) {
+                        close(workers[i].toWorker[WRITE_END]);
+                        close(workers[i].fromWorker[READ_END]);
+                    }
+                }
+                close(worker.toWorker[WRITE_END]);
+                close(worker.fromWorker[READ_END]);
+                workerLoop(worker);
+                _exit(0);
+            }
+
+            close(worker.toWorker[READ_END]);
+            close(worker.fromWorker[WRITE_END]);
+            worker.busy = false;
+        }
+
+        // Returns the wait status of the worker
+        int stopWorker(size_t index) {
+            Worker& worker = workers[index];
+            int status = 0;
+            if (worker.pid > 0) {
+                close(worker.toWorker[WRITE_END]);
+                close(worker.fromWorker[READ_END]);
+                waitpid(worker.pid, &status, 0);
+                worker.pid = -1;
+            }
+            worker.transport.reset();
+            worker.busy = false;
+            return status;
+        }
+
+        int restartWorker(size_t index) {
+            const int status = stopWorker(index);
+            numRestarts++;
+            startWorker(index);
+            return status;
+        }
+
+        // Returns false if the worker asked for a keyframe instead of answering, which it has then been sent
+        bool receiveResult(size_t index, SolverResult& result) {
+            Worker& worker = workers[index];
+            result.requestId = worker.requestId;
+            result.safeSequence.clear();
+            result.message.clear();
+
+            try {
+                SolverResponseHeader header;
+                readFull(worker.fromWorker[READ_END], &header, sizeof(header), "Solver response");
+                if (header.requestId != worker.requestId) {
+                    throw std::runtime_error("Solver response for the wrong request");
+                }
+                if (header.status == NEED_KEYFRAME) {
+                    writeFull(worker.toWorker[WRITE_END], &worker.requestId, sizeof(worker.requestId), "Request ID");
+                    worker.transport->resendKeyframe(worker.toWorker);
+                    return false;
+                }
+
+                result.status = static_cast<SolverStatus>(header.status);
+                if (result.status == SolverStatus::ERROR) {
+                    result.message.resize(header.count);
+                    readFull(worker.fromWorker[READ_END], result.message.data(), header.count, "Solver error message");
+                } else {
+                    result.safeSequence.resize(header.count);
+                    readFull(worker.fromWorker[READ_END], result.safeSequence.data(), header.count * sizeof(size_t), "Solver safe sequence");
+                }
+                worker.busy = false;
+            } catch (const std::runtime_error& e) {
+                // The worker died or broke the protocol, either way its pipes can no longer be trusted
+                const int status = restartWorker(index);
+                result.status = SolverStatus::ERROR;
+                if (WIFSIGNALED(status)) {
+                    result.message = "Solver worker crashed with signal " + std::to_string(WTERMSIG(status));
+                } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+                    result.message = "Solver worker exited with status " + std::to_string(WEXITSTATUS(status));
+                } else {
+                    result.message = e.what();
+                }
+            }
+            return true;
+        }
+
+        // Runs in the worker process until the parent closes the request pipe
+        // The solver allocates from an arena that is reset after every snapshot
+        // Every snapshot is received into the same object, which the delta transport patches
+        void workerLoop(Worker& worker) {
+            SnapshotArena arena;
+            ReceivedSnapshot snapshot;
+            while (true) {
+                uint64_t requestId;
+                try {
+                    readFull(worker.toWorker[READ_END], &requestId, sizeof(requestId), "Request ID");
+                } catch (const std::runtime_error&) {
+                    return;
+                }
+                // A request that cannot be received leaves the pipe out of step, so the worker exits and gets replaced
+                try {
+                    worker.transport->receive(worker.toWorker, snapshot);
+                } catch (const SnapshotOutOfStep&) {
+                    const SolverResponseHeader header = {requestId, NEED_KEYFRAME, 0, 0};
+                    try {
+                        writeFull(worker.fromWorker[WRITE_END], &header, sizeof(header), "Solver response");
+                    } catch (const std::runtime_error&) {
+                        return;
+                    }
+                    continue;
+                } catch (const std::exception&) {
+                    _exit(1);
+                }
+
+                SolverResponseHeader header = {requestId, 0, 0, 0};
+                vector<size_t> safeSequence;
+                string message;
+                try {
+                    std::optional<SafetyReport> fixed;
+                    if (engine == SafetyEngine::SCAN && order == SequenceOrder::FIFO) {
+                        fixed = checkSafetyFixed(snapshot.getAvailableResources(), snapshot.getMaximumMatrix(), snapshot.getAllocationMatrix());
+                    }
+                    if (fixed) {
+                        safeSequence = std::move(fixed->sequence);
+                    } else {
+                        safeSequence = findSafeSequenceNarrowest(snapshot.getAvailableResources(), snapshot.getMaximumMatrix(), snapshot.getAllocationMatrix(),
+                                                                 engine, order, arena.resource());
+                    }
+                    // Only a sequence that finishes every process is safe, which for a snapshot with no processes is the empty one
+                    const bool safe = safeSequence.size() == snapshot.getMaximumMatrix().rows();
+                    if (!safe) {
+                        safeSequence.clear();
+                    }
+                    header.status = static_cast<uint32_t>(safe ? SolverStatus::SAFE : SolverStatus::DEADLOCK);
+                    header.count = safeSequence.size();
+                } catch (const std::exception& e) {
+                    message = e.what();
+                    header.status = static_cast<uint32_t>(SolverStatus::ERROR);
+                    header.count = message.size();
+                }
+                arena.reset();
+
+                try {
+                    writeFull(worker.fromWorker[WRITE_END], &header, sizeof(header), "Solver response");
+                    if (header.status == static_cast<uint32_t>(SolverStatus::ERROR)) {
+                        writeFull(worker.fromWorker[WRITE_END], message.data(), message.size(), "Solver error message");
+                    } else {
+                        writeFull(worker.fromWorker[WRITE_END], safeSequence.data(), safeSequence.size() * sizeof(size_t), "Solver safe sequence");
+                    }
+                } catch (const std::runtime_error&) {
+                    return;
+                }
+            }
+        }
+
+        vector<Worker> workers;
+        Transport transport;
+        SafetyEngine engine;
+        SequenceOrder order;
+        size_t numRestarts = 0;
+};
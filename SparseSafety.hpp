@@ -0,0 +1,248 @@
+// SparseSafety.hpp
+#pragma once
+
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+
+#include "SparseSnapshot.hpp"
+#include "SafetyReport.hpp"
+#include "BankerAlgorithm.hpp"
+
+using std::vector;
+
+// Snapshots with at most this fraction of non-zero maximum entries are checked by SparseWorkListSafety, set to 0 to always
+// use the dense engines unless the sparse engine is asked for
+#define SPARSE_DENSITY_THRESHOLD 0.05
+
+// Snapshots with fewer processes times resource types than this always use the dense engines, which are faster on small
+// inputs whatever their density
+#define SPARSE_MIN_ELEMENTS 65536
+
+// Safety check on a sparse snapshot whose cost grows with its non-zero entries rather than with processes times resources
+// It is the BlockedWorkLists algorithm of WorkListSafety.hpp on compressed sparse rows: only non-zero needs can block a process,
+// so only they are sorted into the per resource blocked lists, and a finished process only releases its non-zero
+// allocations. Zero entries are never visited, giving O(N log N + P + R) for N non-zero entries.
+class SparseWorkListSafety {
+    public:
+        // The snapshot must stay alive while the object is used
+        explicit SparseWorkListSafety(const SparseSnapshot& snapshot) : snapshot(snapshot), needMatrix(snapshot.maxMatrix.cols()) {
+            const SparseResourceMatrix& maxMatrix = snapshot.maxMatrix;
+            const SparseResourceMatrix& allocationMatrix = snapshot.allocationMatrix;
+            if (allocationMatrix.rows() != maxMatrix.rows() || allocationMatrix.cols() != maxMatrix.cols() ||
+                snapshot.availableVector.size() != maxMatrix.cols()) {
+                throw std::runtime_error("Available Vector, Maximum Matrix and Allocation Matrix dimensions do not match.");
+            }
+
+            // Need is max - allocation, merged row by row over the columns of both, keeping the non-zero differences
+            needMatrix.reserve(maxMatrix.rows(), maxMatrix.nonZeros());
+            for (size_t row = 0; row < maxMatrix.rows(); row++) {
+                auto maxCols = maxMatrix.rowColumns(row);
+                auto maxVals = maxMatrix.rowValues(row);
+                auto allocationCols = allocationMatrix.rowColumns(row);
+                auto allocationVals = allocationMatrix.rowValues(row);
+                size_t a = 0;
+                for (size_t m = 0; m < maxCols.size(); m++) {
+                    size_t allocated = 0;
+                    // An allocation before this column sits in a column whose maximum is zero
+                    if (a < allocationCols.size() && allocationCols[a] < maxCols[m]) {
+                        throw allocationExceedsMaximum<size_t>(row, allocationCols[a], 0, allocationVals[a]);
+                    }
+                    if (a < allocationCols.size() && allocationCols[a] == maxCols[m]) {
+                        allocated = allocationVals[a++];
+                    }
+                    if (maxVals[m] < allocated) {
+                        throw allocationExceedsMaximum<size_t>(row, maxCols[m], maxVals[m], allocated);
+                    }
+                    if (maxVals[m] > allocated) {
+                        needMatrix.appendEntry(maxCols[m], maxVals[m] - allocated);
+                    }
+                }
+                // Any allocation left over sits in a column whose maximum is zero
+                if (a < allocationCols.size()) {
+                    throw allocationExceedsMaximum<size_t>(row, allocationCols[a], 0, allocationVals[a]);
+                }
+                needMatrix.finishRow();
+            }
+        }
+
+        // Check safety, returning the sequence in the given order and a diagnosis of the deadlock when unsafe
+        // SequenceOrder::FIFO returns the sequence of BankerAlgorithm::findSafeSequence
+        SafetyReport checkSafety(SequenceOrder order) {
+            StatTimer timer(Stat::SAFETY_NANOSECONDS);
+            Stats::process().add(Stat::SAFETY_CHECKS, 1);
+
+            const size_t numProcesses = needMatrix.rows();
+            const size_t numResources = needMatrix.cols();
+            availableVector = snapshot.availableVector;
+
+            SafetyReport report;
+            report.sequence.reserve(numProcesses);
+
+            lists.build(numProcesses, numResources, [&](size_t i, auto onBlocked) {
+                auto columns = needMatrix.rowColumns(i);
+                auto values = needMatrix.rowValues(i);
+                for (size_t k = 0; k < columns.size(); k++) {
+                    if (values[k] > availableVector[columns[k]]) {
+                        onBlocked(columns[k], values[k]);
+                    }
+                }
+            });
+
+            auto finish = [&](size_t process, auto onRunnable) {
+                finishProcess(process, onRunnable);
+            };
+            if (order == SequenceOrder::FIFO) {
+                lists.runFifo(report.sequence, finish);
+            } else {
+                lists.runAny(report.sequence, finish);
+            }
+            Stats::process().add(Stat::PROCESSES_FINISHED, report.sequence.size());
+
+            report.safe = report.sequence.size() == numProcesses;
+            if (!report.safe) {
+                diagnoseDeadlock(lists.blockingCounts(), report);
+            }
+            return report;
+        }
+
+    private:
+        // Adds the allocation of a process to available, throwing if a sum overflows
+        void release(size_t process, vector<size_t>& available) const {
+            auto columns = snapshot.allocationMatrix.rowColumns(process);
+            auto values = snapshot.allocationMatrix.rowValues(process);
+            for (size_t k = 0; k < columns.size(); k++) {
+                if (__builtin_add_overflow(available[columns[k]], values[k], &available[columns[k]])) {
+                    throw std::overflow_error("Available resources overflowed when process " + std::to_string(process) + " released its allocation");
+                }
+            }
+        }
+
+        // Frees the resources of a finished process and reports every process that became runnable because of it
+        template <typename OnRunnable>
+        void finishProcess(size_t process, OnRunnable onRunnable) {
+            release(process, availableVector);
+
+            // Only resource types this process actually released can unblock anything
+            for (auto j: snapshot.allocationMatrix.rowColumns(process)) {
+                lists.release(j, availableVector[j], onRunnable);
+            }
+        }
+
+        bool fits(size_t process, const vector<size_t>& available) const {
+            auto columns = needMatrix.rowColumns(process);
+            auto values = needMatrix.rowValues(process);
+            for (size_t k = 0; k < columns.size(); k++) {
+                if (values[k] > available[columns[k]]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Same diagnosis as BasicBankerAlgorithm::diagnoseDeadlock, touching only non-zero entries
+        // Each preemption is simulated on availableVector itself and undone afterwards, rather than on a dense copy
+        void diagnoseDeadlock(const vector<size_t>& blockingCount, SafetyReport& report) {
+            vector<size_t> blocked;
+            for (size_t i = 0; i < blockingCount.size(); i++) {
+                if (blockingCount[i] > 0) {
+                    blocked.push_back(i);
+                }
+            }
+
+            for (auto process: blocked) {
+                BlockedProcess entry{process, {}};
+                auto columns = needMatrix.rowColumns(process);
+                auto values = needMatrix.rowValues(process);
+                for (size_t k = 0; k < columns.size(); k++) {
+                    if (values[k] > availableVector[columns[k]]) {
+                        entry.shortfall.push_back({columns[k], values[k] - availableVector[columns[k]]});
+                    }
+                }
+                report.blocked.push_back(std::move(entry));
+            }
+
+            vector<char> done(blocked.size());
+            vector<size_t> released;
+            for (size_t b = 0; b < blocked.size(); b++) {
+                std::fill(done.begin(), done.end(), 0);
+                done[b] = 1;
+                released.assign(1, blocked[b]);
+                release(blocked[b], availableVector);
+
+                bool progress = true;
+                while (progress) {
+                    progress = false;
+                    for (size_t k = 0; k < blocked.size(); k++) {
+                        if (!done[k] && fits(blocked[k], availableVector)) {
+                            release(blocked[k], availableVector);
+                            released.push_back(blocked[k]);
+                            done[k] = 1;
+                            progress = true;
+                        }
+                    }
+                }
+
+                for (auto process: released) {
+                    auto columns = snapshot.allocationMatrix.rowColumns(process);
+                    auto values = snapshot.allocationMatrix.rowValues(process);
+                    for (size_t k = 0; k < columns.size(); k++) {
+                        availableVector[columns[k]] -= values[k];
+                    }
+                }
+                if (released.size() > 1) {
+                    report.preemption.push_back({blocked[b], released.size() - 1});
+                }
+            }
+            std::stable_sort(report.preemption.begin(), report.preemption.end(), [](const PreemptionCandidate& lhs, const PreemptionCandidate& rhs) {
+                return lhs.unblocked > rhs.unblocked;
+            });
+        }
+
+        const SparseSnapshot& snapshot;
+        SparseResourceMatrix needMatrix;
+        vector<size_t> availableVector;
+
+        BlockedWorkLists<size_t> lists;
+};
+
+// Whether a snapshot of this size and number of non-zero maximum entries is better checked by SparseWorkListSafety
+inline bool preferSparseEngine(size_t numProcesses, size_t numResources, size_t nonZeros, SafetyEngine engine) {
+    if (engine == SafetyEngine::SPARSE) {
+        return true;
+    }
+    const double elements = static_cast<double>(numProcesses) * numResources;
+    return elements >= SPARSE_MIN_ELEMENTS && nonZeros <= SPARSE_DENSITY_THRESHOLD * elements;
+}
+
+// Check the safety of a dense snapshot with the sparse engine when it is sparse enough, otherwise with checkSafetyNarrowest
+// Counting the non-zero entries is one pass over the maximum matrix, less than computing the need matrix costs
+// A dense check allocates from resource when one is given, see BasicBankerAlgorithm
+inline SafetyReport checkSafetyAuto(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                                    SafetyEngine engine, SequenceOrder order = SequenceOrder::FIFO, std::pmr::memory_resource* resource = nullptr) {
+    size_t nonZeros = 0;
+    if (engine != SafetyEngine::SPARSE && static_cast<double>(maxMatrix.rows()) * maxMatrix.cols() >= SPARSE_MIN_ELEMENTS) {
+        for (size_t row = 0; row < maxMatrix.rows(); row++) {
+            for (auto value: maxMatrix.row(row)) {
+                nonZeros += value != 0;
+            }
+        }
+    }
+    if (preferSparseEngine(maxMatrix.rows(), maxMatrix.cols(), nonZeros, engine)) {
+        SparseSnapshot snapshot{vector<size_t>(availableVector.begin(), availableVector.end()), SparseResourceMatrix(maxMatrix), SparseResourceMatrix(allocationMatrix)};
+        return SparseWorkListSafety(snapshot).checkSafety(order);
+    }
+    return checkSafetyNarrowest(availableVector, maxMatrix, allocationMatrix, engine, order, resource);
+}
+
+// Check the safety of a sparse snapshot with the sparse engine, or with checkSafetyNarrowest when it is too dense
+inline SafetyReport checkSafetyAuto(const SparseSnapshot& snapshot, SafetyEngine engine, SequenceOrder order = SequenceOrder::FIFO) {
+    if (preferSparseEngine(snapshot.maxMatrix.rows(), snapshot.maxMatrix.cols(), snapshot.maxMatrix.nonZeros(), engine)) {
+        return SparseWorkListSafety(snapshot).checkSafety(order);
+    }
+    const ResourceMatrix maxMatrix = snapshot.maxMatrix.toDense();
+    const ResourceMatrix allocationMatrix = snapshot.allocationMatrix.toDense();
+    return checkSafetyNarrowest(snapshot.availableVector, maxMatrix.view(), allocationMatrix.view(), engine, order);
+}
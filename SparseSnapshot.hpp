@@ -0,0 +1,537 @@
+// SparseSnapshot.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <charconv>
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+#include "ResourceMatrix.hpp"
+#include "MappedFile.hpp"
+#include "Stats.hpp"
+
+using std::vector, std::string;
+
+// Sparse Program Snapshot formats, for snapshots where each process holds and claims only a few of many resource types
+//
+// Text: a "// Dimensions" section giving the number of processes and resource types, then the usual sections with one line
+// per process of column:value pairs in increasing column order, or "-" for a process without any. Columns count from zero
+// and entries that are not listed are zero. The available resources stay one dense line.
+//     // Dimensions
+//     3 2000
+//
+//     // Allocation Matrix
+//     4:1 1873:2
+//     -
+//     12:1
+//
+//     // Maximum Matrix
+//     ...
+//
+// Binary: a SparseSnapshotHeader followed by the available vector and, for the maximum and then the allocation matrix,
+// the row starts, columns and values of its compressed sparse rows, see SparseResourceMatrix. Every block starts at a
+// multiple of 8 bytes, and numbers are stored in the byte order of the machine that wrote the file.
+#define SPARSE_SNAPSHOT_MAGIC "BNKSPRS"
+#define SPARSE_SNAPSHOT_VERSION 1
+#define SPARSE_SNAPSHOT_BYTE_ORDER_MARK 0x01020304u
+
+struct SparseSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint64_t numProcesses;
+    uint64_t numResources;
+    uint64_t maximumNonZeros;
+    uint64_t allocationNonZeros;
+};
+
+// Matrix of resource counts in compressed sparse rows: the columns and values of every non-zero entry, row after row,
+// and where each row starts among them. Columns within a row are in increasing order.
+class SparseResourceMatrix {
+    public:
+        SparseResourceMatrix() = default;
+
+        explicit SparseResourceMatrix(size_t numCols) : numCols(numCols) {
+            if (numCols > UINT32_MAX) {
+                throw std::runtime_error("Sparse matrices hold at most " + std::to_string(UINT32_MAX) + " resource types");
+            }
+        }
+
+        // Keeps the non-zero entries of a dense matrix
+        explicit SparseResourceMatrix(ResourceMatrixView dense) : SparseResourceMatrix(dense.cols()) {
+            size_t nonZeros = 0;
+            for (size_t r = 0; r < dense.rows(); r++) {
+                for (auto value: dense.row(r)) {
+                    nonZeros += value != 0;
+                }
+            }
+            reserve(dense.rows(), nonZeros);
+            for (size_t r = 0; r < dense.rows(); r++) {
+                auto row = dense.row(r);
+                for (size_t c = 0; c < row.size(); c++) {
+                    if (row[c] != 0) {
+                        appendEntry(c, row[c]);
+                    }
+                }
+                finishRow();
+            }
+        }
+
+        void reserve(size_t numRows, size_t nonZeros) {
+            rowStart.reserve(numRows + 1);
+            columns.reserve(nonZeros);
+            values.reserve(nonZeros);
+        }
+
+        // Add an entry to the row being built, at a column after every column added to it so far
+        void appendEntry(size_t col, size_t value) {
+            if (col >= numCols || (columns.size() > rowStart.back() && col <= columns.back())) {
+                throw std::runtime_error("Sparse matrix column " + std::to_string(col) + " is out of range or out of order");
+            }
+            columns.push_back(static_cast<uint32_t>(col));
+            values.push_back(value);
+        }
+
+        // Close the row being built, which may have no entries
+        void finishRow() {
+            rowStart.push_back(columns.size());
+        }
+
+        size_t rows() const {
+            return rowStart.size() - 1;
+        }
+
+        size_t cols() const {
+            return numCols;
+        }
+
+        size_t nonZeros() const {
+            return values.size();
+        }
+
+        std::span<const uint32_t> rowColumns(size_t r) const {
+            return std::span<const uint32_t>(columns.data() + rowStart[r], rowStart[r + 1] - rowStart[r]);
+        }
+
+        std::span<const size_t> rowValues(size_t r) const {
+            return std::span<const size_t>(values.data() + rowStart[r], rowStart[r + 1] - rowStart[r]);
+        }
+
+        // Entry at (r, c), found by binary search of the row
+        size_t operator()(size_t r, size_t c) const {
+            auto rowCols = rowColumns(r);
+            auto found = std::lower_bound(rowCols.begin(), rowCols.end(), c);
+            return (found != rowCols.end() && *found == c) ? values[rowStart[r] + (found - rowCols.begin())] : 0;
+        }
+
+        ResourceMatrix toDense() const {
+            ResourceMatrix dense(rows(), numCols);
+            for (size_t r = 0; r < rows(); r++) {
+                auto rowCols = rowColumns(r);
+                auto rowVals = rowValues(r);
+                for (size_t k = 0; k < rowCols.size(); k++) {
+                    dense(r, rowCols[k]) = rowVals[k];
+                }
+            }
+            return dense;
+        }
+
+        // Raw arrays, as stored in a binary sparse snapshot
+        const vector<size_t>& rowStarts() const {
+            return rowStart;
+        }
+
+        const vector<uint32_t>& columnIndices() const {
+            return columns;
+        }
+
+        const vector<size_t>& entryValues() const {
+            return values;
+        }
+
+        // Build a matrix from raw arrays, checking that they describe valid compressed sparse rows
+        static SparseResourceMatrix fromArrays(size_t numCols, vector<size_t> rowStart, vector<uint32_t> columns, vector<size_t> values) {
+            if (rowStart.empty() || rowStart.front() != 0 || rowStart.back() != columns.size() || columns.size() != values.size()) {
+                throw std::runtime_error("Invalid sparse matrix row starts");
+            }
+            for (size_t r = 0; r + 1 < rowStart.size(); r++) {
+                if (rowStart[r] > rowStart[r + 1]) {
+                    throw std::runtime_error("Invalid sparse matrix row starts");
+                }
+                for (size_t k = rowStart[r]; k < rowStart[r + 1]; k++) {
+                    if (columns[k] >= numCols || (k > rowStart[r] && columns[k] <= columns[k - 1])) {
+                        throw std::runtime_error("Sparse matrix column " + std::to_string(columns[k]) + " is out of range or out of order");
+                    }
+                }
+            }
+            SparseResourceMatrix matrix(numCols);
+            matrix.rowStart = std::move(rowStart);
+            matrix.columns = std::move(columns);
+            matrix.values = std::move(values);
+            return matrix;
+        }
+
+    private:
+        size_t numCols = 0;
+        vector<size_t> rowStart = {0};
+        vector<uint32_t> columns;
+        vector<size_t> values;
+};
+
+// Program Snapshot with sparse matrices
+struct SparseSnapshot {
+    vector<size_t> availableVector;
+    SparseResourceMatrix maxMatrix;
+    SparseResourceMatrix allocationMatrix;
+
+    // Fraction of the entries of the maximum matrix that are non-zero
+    // Every process holds and needs at most its maximum, so this bounds the density of the allocation and need matrices
+    double density() const {
+        const double elements = static_cast<double>(maxMatrix.rows()) * maxMatrix.cols();
+        return elements > 0 ? maxMatrix.nonZeros() / elements : 0;
+    }
+};
+
+// Returns true if the contents of a file start with the sparse binary snapshot magic
+inline bool hasSparseBinarySnapshotMagic(std::string_view contents) {
+    return contents.size() >= sizeof(SparseSnapshotHeader::magic) &&
+           std::memcmp(contents.data(), SPARSE_SNAPSHOT_MAGIC, sizeof(SparseSnapshotHeader::magic)) == 0;
+}
+
+// Returns true if the contents of a file are a sparse snapshot, binary or text, like isSparseSnapshot
+inline bool isSparseSnapshotContents(std::string_view contents) {
+    if (hasSparseBinarySnapshotMagic(contents)) {
+        return true;
+    }
+
+    size_t position = 0;
+    while (position < contents.size()) {
+        const size_t newline = std::min(contents.find('\n', position), contents.size());
+        std::string_view line = contents.substr(position, newline - position);
+        position = newline + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.find_first_not_of(" \t") != std::string_view::npos) {
+            return line == "// Dimensions";
+        }
+    }
+    return false;
+}
+
+// Returns true if the file is a sparse snapshot, binary or text
+inline bool isSparseSnapshot(const string& file_name) {
+    MappedFile file(file_name);
+    return isSparseSnapshotContents(file.text());
+}
+
+// Reads sparse snapshots, text or binary
+class SparseSnapshotReader {
+    public:
+        explicit SparseSnapshotReader(const string& file_name) {
+            MappedFile file(file_name);
+            read(file.text(), file_name);
+        }
+
+        // Reads the contents of a file the caller has already mapped, source names it in error messages
+        SparseSnapshotReader(std::string_view contents, const string& source) {
+            read(contents, source);
+        }
+
+        const SparseSnapshot& getSnapshot() const {
+            return snapshot;
+        }
+
+        // Move the snapshot out of the reader without copying it, leaving it empty
+        SparseSnapshot takeSnapshot() {
+            return std::move(snapshot);
+        }
+
+    private:
+        void read(std::string_view contents, const string& source) {
+            StatTimer timer(Stat::PARSE_NANOSECONDS);
+            if (hasSparseBinarySnapshotMagic(contents)) {
+                readBinary(contents, source);
+            } else {
+                readText(contents);
+            }
+            checkValidity();
+        }
+
+        void readText(std::string_view text) {
+            enum linereaderState {
+                NONE,
+                DIMENSIONS,
+                ALLOCATION,
+                MAXIMUM,
+                AVAILABLE
+            };
+
+            linereaderState state = NONE;
+            size_t position = 0;
+            size_t lineNumber = 0;
+            size_t tokens = 0;
+            bool haveDimensions = false;
+            size_t numResources = 0;
+
+            while (position < text.size()) {
+                const std::string_view line = nextLine(text, position);
+                lineNumber++;
+
+                if (line.find_first_not_of(" \t") == std::string_view::npos) {
+                    // skip
+                } else if (line == "// Dimensions") {
+                    state = DIMENSIONS;
+                } else if (line == "// Allocation Matrix") {
+                    state = ALLOCATION;
+                } else if (line == "// Maximum Matrix") {
+                    state = MAXIMUM;
+                } else if (line == "// Available Resources") {
+                    state = AVAILABLE;
+                } else if (state == DIMENSIONS) {
+                    vector<size_t> dimensions;
+                    tokens += parseTokens(line, [&](std::string_view token, size_t column) {
+                        dimensions.push_back(parseNumber(token, lineNumber, column));
+                    });
+                    if (dimensions.size() != 2 || haveDimensions) {
+                        throw std::runtime_error("Dimensions must be one line of the number of processes and resource types" + atLine(lineNumber));
+                    }
+                    declaredProcesses = dimensions[0];
+                    numResources = dimensions[1];
+                    haveDimensions = true;
+                    snapshot.maxMatrix = SparseResourceMatrix(numResources);
+                    snapshot.allocationMatrix = SparseResourceMatrix(numResources);
+                } else if (!haveDimensions) {
+                    throw std::runtime_error("Sparse snapshot is missing its Dimensions before" + atLine(lineNumber));
+                } else if (state == ALLOCATION || state == MAXIMUM) {
+                    SparseResourceMatrix& matrix = (state == ALLOCATION) ? snapshot.allocationMatrix : snapshot.maxMatrix;
+                    if (matrix.rows() == declaredProcesses) {
+                        throw std::runtime_error(string(state == ALLOCATION ? "Allocation" : "Maximum") + " Matrix has more rows than Dimensions" + atLine(lineNumber));
+                    }
+                    tokens += parseRow(matrix, line, lineNumber);
+                } else if (state == AVAILABLE) {
+                    snapshot.availableVector.clear();
+                    snapshot.availableVector.reserve(numResources);
+                    tokens += parseTokens(line, [&](std::string_view token, size_t column) {
+                        snapshot.availableVector.push_back(parseNumber(token, lineNumber, column));
+                    });
+                } else {
+                    throw std::runtime_error("Invalid File Format" + atLine(lineNumber));
+                }
+            }
+
+            if (!haveDimensions) {
+                throw std::runtime_error("Sparse snapshot is missing its Dimensions");
+            }
+            Stats::process().add(Stat::LINES_PARSED, lineNumber);
+            Stats::process().add(Stat::TOKENS_PARSED, tokens);
+        }
+
+        // Parses one line of column:value pairs, or "-", as the next row of matrix
+        // Columns must strictly increase along the line, zero values included even though they are not stored
+        size_t parseRow(SparseResourceMatrix& matrix, std::string_view line, size_t lineNumber) {
+            size_t firstAllowedColumn = 0;
+            const size_t tokens = parseTokens(line, [&](std::string_view token, size_t column) {
+                if (token == "-") {
+                    return;
+                }
+                const size_t colon = token.find(':');
+                if (colon == std::string_view::npos) {
+                    throw std::invalid_argument("Expected column:value" + atLine(lineNumber, column));
+                }
+                const size_t col = parseNumber(token.substr(0, colon), lineNumber, column);
+                const size_t value = parseNumber(token.substr(colon + 1), lineNumber, column + colon + 1);
+                if (col >= matrix.cols()) {
+                    throw std::runtime_error("Column " + std::to_string(col) + " is beyond the resource types in Dimensions" + atLine(lineNumber, column));
+                }
+                if (col < firstAllowedColumn) {
+                    throw std::runtime_error("Columns must be in increasing order" + atLine(lineNumber, column));
+                }
+                firstAllowedColumn = col + 1;
+                if (value != 0) {
+                    matrix.appendEntry(col, value);
+                }
+            });
+            matrix.finishRow();
+            return tokens;
+        }
+
+        // Calls onToken(token, column) for every token of a line separated by spaces or tabs, returns how many there are
+        template <typename OnToken>
+        static size_t parseTokens(std::string_view line, OnToken onToken) {
+            size_t count = 0;
+            size_t cursor = 0;
+            while (true) {
+                cursor = line.find_first_not_of(" \t", cursor);
+                if (cursor == std::string_view::npos) {
+                    return count;
+                }
+                const size_t end = std::min(line.find_first_of(" \t", cursor), line.size());
+                onToken(line.substr(cursor, end - cursor), cursor + 1);
+                count++;
+                cursor = end;
+            }
+        }
+
+        static size_t parseNumber(std::string_view token, size_t lineNumber, size_t column) {
+            if (!token.empty() && token.front() == '-') {
+                throw std::runtime_error("Negative Value in Program Snapshot File" + atLine(lineNumber, column) + ".");
+            }
+            size_t value = 0;
+            const auto [next, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+            if (error == std::errc::result_out_of_range) {
+                throw std::out_of_range("Out of range error when converting number" + atLine(lineNumber, column));
+            }
+            if (error != std::errc() || next != token.data() + token.size()) {
+                throw std::invalid_argument("Invalid argument when converting number" + atLine(lineNumber, column));
+            }
+            return value;
+        }
+
+        static std::string_view nextLine(std::string_view text, size_t& position) {
+            const size_t newline = text.find('\n', position);
+            size_t end = (newline == std::string_view::npos) ? text.size() : newline;
+            std::string_view line = text.substr(position, end - position);
+            position = (newline == std::string_view::npos) ? text.size() : newline + 1;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            return line;
+        }
+
+        static string atLine(size_t lineNumber) {
+            return " at line " + std::to_string(lineNumber);
+        }
+
+        static string atLine(size_t lineNumber, size_t column) {
+            return atLine(lineNumber) + ", column " + std::to_string(column);
+        }
+
+        void readBinary(std::string_view contents, const string& source) {
+            size_t offset = 0;
+            auto take = [&](void* destination, uint64_t bytes) {
+                if (bytes > contents.size() || offset > contents.size() - bytes) {
+                    throw std::runtime_error("Sparse binary snapshot is truncated or corrupt, " + source);
+                }
+                std::memcpy(destination, contents.data() + offset, bytes);
+                offset += (bytes + 7) / 8 * 8;
+            };
+
+            SparseSnapshotHeader header;
+            take(&header, sizeof(header));
+            if (header.version != SPARSE_SNAPSHOT_VERSION) {
+                throw std::runtime_error("Unsupported sparse binary snapshot version " + std::to_string(header.version) + ", " + source);
+            }
+            if (header.byteOrderMark != SPARSE_SNAPSHOT_BYTE_ORDER_MARK) {
+                throw std::runtime_error("Sparse binary snapshot was written on a machine with a different byte order, " + source);
+            }
+            if (header.numProcesses > contents.size() || header.numResources > contents.size() ||
+                header.maximumNonZeros > contents.size() || header.allocationNonZeros > contents.size()) {
+                throw std::runtime_error("Sparse binary snapshot is truncated or corrupt, " + source);
+            }
+
+            declaredProcesses = header.numProcesses;
+            snapshot.availableVector.resize(header.numResources);
+            take(snapshot.availableVector.data(), header.numResources * sizeof(size_t));
+
+            auto takeMatrix = [&](uint64_t nonZeros) {
+                vector<size_t> rowStart(header.numProcesses + 1);
+                vector<uint32_t> columns(nonZeros);
+                vector<size_t> values(nonZeros);
+                take(rowStart.data(), rowStart.size() * sizeof(size_t));
+                take(columns.data(), nonZeros * sizeof(uint32_t));
+                take(values.data(), nonZeros * sizeof(size_t));
+                return SparseResourceMatrix::fromArrays(header.numResources, std::move(rowStart), std::move(columns), std::move(values));
+            };
+            snapshot.maxMatrix = takeMatrix(header.maximumNonZeros);
+            snapshot.allocationMatrix = takeMatrix(header.allocationNonZeros);
+        }
+
+        void checkValidity() const {
+            if (snapshot.allocationMatrix.rows() != snapshot.maxMatrix.rows()) {
+                throw std::runtime_error("Allocation Matrix and Maximum Matrix Processes Mismatched");
+            }
+            if (snapshot.maxMatrix.rows() != declaredProcesses) {
+                throw std::runtime_error("Matrices have " + std::to_string(snapshot.maxMatrix.rows()) + " rows but Dimensions declares " +
+                                         std::to_string(declaredProcesses) + " processes");
+            }
+            if (snapshot.availableVector.size() != snapshot.maxMatrix.cols()) {
+                throw std::runtime_error("Available Vector is Incomplete");
+            }
+        }
+
+        SparseSnapshot snapshot;
+        // Number of processes given by the Dimensions of the file
+        size_t declaredProcesses = 0;
+};
+
+// Write a snapshot in the sparse text format
+inline void writeSparseTextSnapshot(const string& file_name, const SparseSnapshot& snapshot) {
+    std::ofstream file(file_name, std::ios::trunc);
+
+    auto writeMatrix = [&](const SparseResourceMatrix& matrix) {
+        for (size_t r = 0; r < matrix.rows(); r++) {
+            auto columns = matrix.rowColumns(r);
+            auto values = matrix.rowValues(r);
+            if (columns.empty()) {
+                file << "-";
+            }
+            for (size_t k = 0; k < columns.size(); k++) {
+                file << columns[k] << ':' << values[k] << (k + 1 < columns.size() ? " " : "");
+            }
+            file << '\n';
+        }
+    };
+
+    file << "// Dimensions\n" << snapshot.maxMatrix.rows() << ' ' << snapshot.maxMatrix.cols() << "\n\n";
+    file << "// Allocation Matrix\n";
+    writeMatrix(snapshot.allocationMatrix);
+    file << "\n// Maximum Matrix\n";
+    writeMatrix(snapshot.maxMatrix);
+    file << "\n// Available Resources\n";
+    for (size_t col = 0; col < snapshot.availableVector.size(); col++) {
+        file << snapshot.availableVector[col] << (col + 1 < snapshot.availableVector.size() ? " " : "");
+    }
+    file << '\n';
+
+    if (!file) {
+        throw std::runtime_error("Failed to write sparse text snapshot " + file_name);
+    }
+}
+
+// Write a snapshot in the sparse binary format
+inline void writeSparseBinarySnapshot(const string& file_name, const SparseSnapshot& snapshot) {
+    std::ofstream file(file_name, std::ios::binary | std::ios::trunc);
+    auto put = [&](const void* data, uint64_t bytes) {
+        static const char padding[8] = {};
+        file.write(static_cast<const char*>(data), bytes);
+        file.write(padding, (8 - bytes % 8) % 8);
+    };
+
+    SparseSnapshotHeader header = {};
+    std::memcpy(header.magic, SPARSE_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SPARSE_SNAPSHOT_VERSION;
+    header.byteOrderMark = SPARSE_SNAPSHOT_BYTE_ORDER_MARK;
+    header.numProcesses = snapshot.maxMatrix.rows();
+    header.numResources = snapshot.maxMatrix.cols();
+    header.maximumNonZeros = snapshot.maxMatrix.nonZeros();
+    header.allocationNonZeros = snapshot.allocationMatrix.nonZeros();
+    put(&header, sizeof(header));
+    put(snapshot.availableVector.data(), snapshot.availableVector.size() * sizeof(size_t));
+
+    for (const SparseResourceMatrix* matrix: {&snapshot.maxMatrix, &snapshot.allocationMatrix}) {
+        put(matrix->rowStarts().data(), matrix->rowStarts().size() * sizeof(size_t));
+        put(matrix->columnIndices().data(), matrix->nonZeros() * sizeof(uint32_t));
+        put(matrix->entryValues().data(), matrix->nonZeros() * sizeof(size_t));
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write sparse binary snapshot " + file_name);
+    }
+}
@@ -0,0 +1,158 @@
+// Stats.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <span>
+#include <cstdint>
+
+using std::vector, std::string;
+
+// Set to false to compile every counter and timer out of the hot paths
+#ifndef ENABLE_STATS
+#define ENABLE_STATS true
+#endif
+
+// Counters kept for the whole process
+// Hot loops count into locals and add them here once, so a counter costs one relaxed atomic add per call, not per element
+enum class Stat : size_t {
+    // Pipe transfer, counting every read, write and writev system call
+    PIPE_WRITE_CALLS,
+    PIPE_BYTES_WRITTEN,
+    PIPE_READ_CALLS,
+    PIPE_BYTES_READ,
+    // Text snapshot parsing
+    LINES_PARSED,
+    TOKENS_PARSED,
+    // Safety checks
+    SAFETY_CHECKS,
+    SAFETY_ROUNDS,
+    VECTOR_COMPARISONS,
+    PROCESSES_FINISHED,
+    // Time spent in each stage
+    PARSE_NANOSECONDS,
+    TRANSFER_NANOSECONDS,
+    SAFETY_NANOSECONDS,
+    // Lookups of ResultCache.hpp
+    RESULT_CACHE_HITS,
+    RESULT_CACHE_MISSES,
+    COUNT
+};
+
+#define STAT_COUNT static_cast<size_t>(Stat::COUNT)
+
+// Longest list of per-round finish counts kept for a report, later rounds are only counted in SAFETY_ROUNDS
+#define STATS_MAX_ROUNDS 1024
+
+inline const char* statName(Stat stat) {
+    switch (stat) {
+        case Stat::PIPE_WRITE_CALLS: return "pipe_write_calls";
+        case Stat::PIPE_BYTES_WRITTEN: return "pipe_bytes_written";
+        case Stat::PIPE_READ_CALLS: return "pipe_read_calls";
+        case Stat::PIPE_BYTES_READ: return "pipe_bytes_read";
+        case Stat::LINES_PARSED: return "lines_parsed";
+        case Stat::TOKENS_PARSED: return "tokens_parsed";
+        case Stat::SAFETY_CHECKS: return "safety_checks";
+        case Stat::SAFETY_ROUNDS: return "safety_rounds";
+        case Stat::VECTOR_COMPARISONS: return "vector_comparisons";
+        case Stat::PROCESSES_FINISHED: return "processes_finished";
+        case Stat::PARSE_NANOSECONDS: return "parse_ns";
+        case Stat::TRANSFER_NANOSECONDS: return "transfer_ns";
+        case Stat::SAFETY_NANOSECONDS: return "safety_ns";
+        case Stat::RESULT_CACHE_HITS: return "result_cache_hits";
+        case Stat::RESULT_CACHE_MISSES: return "result_cache_misses";
+        default: return "unknown";
+    }
+}
+
+// Copy of the counters of a process at one point in time, which can be sent over a pipe and printed
+struct StatsReport {
+    std::array<uint64_t, STAT_COUNT> counters = {};
+    // Processes finished in each of the first STATS_MAX_ROUNDS rounds of the most recent scan
+    vector<uint64_t> finishedPerRound;
+
+    uint64_t operator[](Stat stat) const {
+        return counters[static_cast<size_t>(stat)];
+    }
+
+    string toJson() const {
+        string json = "{";
+        for (size_t i = 0; i < STAT_COUNT; i++) {
+            json += "\"" + string(statName(static_cast<Stat>(i))) + "\": " + std::to_string(counters[i]) + ", ";
+        }
+        json += "\"finished_per_round\": [";
+        for (size_t i = 0; i < finishedPerRound.size(); i++) {
+            json += (i > 0 ? ", " : "") + std::to_string(finishedPerRound[i]);
+        }
+        return json + "]}";
+    }
+};
+
+class Stats {
+    public:
+        // Counters of this process
+        // A forked child starts with the counters of its parent at the time of the fork
+        static Stats& process() {
+            static Stats stats;
+            return stats;
+        }
+
+        void add(Stat stat, uint64_t amount) {
+            if (ENABLE_STATS) {
+                counters[static_cast<size_t>(stat)].fetch_add(amount, std::memory_order_relaxed);
+            }
+        }
+
+        // Copied into a buffer that keeps its capacity, so recording rounds after every scan does not allocate
+        void recordRounds(std::span<const uint64_t> finishedPerRound) {
+            if (ENABLE_STATS) {
+                std::lock_guard<std::mutex> lock(roundsMutex);
+                lastRounds.assign(finishedPerRound.begin(), finishedPerRound.end());
+            }
+        }
+
+        StatsReport report() const {
+            StatsReport result;
+            for (size_t i = 0; i < STAT_COUNT; i++) {
+                result.counters[i] = counters[i].load(std::memory_order_relaxed);
+            }
+            std::lock_guard<std::mutex> lock(roundsMutex);
+            result.finishedPerRound = lastRounds;
+            return result;
+        }
+
+    private:
+        Stats() = default;
+
+        std::array<std::atomic<uint64_t>, STAT_COUNT> counters = {};
+        mutable std::mutex roundsMutex;
+        vector<uint64_t> lastRounds;
+};
+
+// Adds the time from construction to destruction to a nanosecond counter
+class StatTimer {
+    public:
+        explicit StatTimer(Stat stat) : stat(stat) {
+            if (ENABLE_STATS) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~StatTimer() {
+            if (ENABLE_STATS) {
+                const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+                Stats::process().add(stat, elapsed.count());
+            }
+        }
+
+        StatTimer(const StatTimer&) = delete;
+        StatTimer& operator=(const StatTimer&) = delete;
+
+    private:
+        Stat stat;
+        std::chrono::steady_clock::time_point start;
+};
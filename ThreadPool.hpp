@@ -0,0 +1,198 @@
+// ThreadPool.hpp
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+using std::vector;
+
+// Fixed set of worker threads with one task queue per worker
+// A worker takes the newest task from its own queue, and when that is empty steals the oldest task from another worker,
+// so long tasks on one queue do not hold up the others. Tasks submitted from inside a task go to the current worker's queue.
+class ThreadPool {
+    public:
+        // Start numThreads workers, or one per hardware thread if numThreads is zero
+        explicit ThreadPool(size_t numThreads = 0) {
+            if (numThreads == 0) {
+                numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+            }
+
+            for (size_t i = 0; i < numThreads; i++) {
+                queues.push_back(std::make_unique<WorkerQueue>());
+            }
+            for (size_t i = 0; i < numThreads; i++) {
+                workers.emplace_back([this, i] { workerLoop(i); });
+            }
+        }
+
+        // Runs every submitted task before the workers are joined
+        ~ThreadPool() {
+            wait();
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            wakeUp.notify_all();
+            for (auto& worker: workers) {
+                worker.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Queue a task to run on one of the workers
+        // Tasks must not throw, an exception escaping a task terminates the program
+        void submit(std::function<void()> task) {
+            const size_t index = (currentPool == this) ? currentWorker : nextQueue++ % queues.size();
+            unfinished++;
+            {
+                std::lock_guard<std::mutex> lock(queues[index]->mutex);
+                queues[index]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                queued++;
+            }
+            wakeUp.notify_one();
+        }
+
+        // Block until every submitted task has finished
+        // Must not be called from inside a task
+        void wait() {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            allDone.wait(lock, [this] { return unfinished == 0; });
+        }
+
+        size_t size() const {
+            return workers.size();
+        }
+
+        // Call body(chunkBegin, chunkEnd) for consecutive chunks of at most grain items covering [begin, end)
+        // Chunks run on the workers and on the calling thread, which returns once every chunk is done.
+        // Because the caller takes part, this may also be called from inside a task. body must not throw.
+        template <typename Body>
+        void parallelFor(size_t begin, size_t end, size_t grain, const Body& body) {
+            if (begin >= end) {
+                return;
+            }
+            grain = std::max<size_t>(1, grain);
+            const size_t numChunks = (end - begin + grain - 1) / grain;
+
+            // Helpers that only start after every chunk is taken return without touching body,
+            // so the shared counters are the only state that has to outlive this call
+            struct ChunkCounters {
+                std::atomic<size_t> next{0};
+                std::atomic<size_t> done{0};
+                std::mutex mutex;
+                std::condition_variable allDone;
+            };
+            auto counters = std::make_shared<ChunkCounters>();
+
+            auto runChunks = [counters, numChunks, begin, end, grain, &body] {
+                size_t chunk;
+                while ((chunk = counters->next++) < numChunks) {
+                    const size_t chunkBegin = begin + chunk * grain;
+                    body(chunkBegin, std::min(end, chunkBegin + grain));
+                    if (++counters->done == numChunks) {
+                        std::lock_guard<std::mutex> lock(counters->mutex);
+                        counters->allDone.notify_all();
+                    }
+                }
+            };
+
+            const size_t numHelpers = std::min(numChunks - 1, workers.size());
+            for (size_t i = 0; i < numHelpers; i++) {
+                submit(runChunks);
+            }
+            runChunks();
+
+            std::unique_lock<std::mutex> lock(counters->mutex);
+            counters->allDone.wait(lock, [&] { return counters->done == numChunks; });
+        }
+
+        // Pool shared by everything in the process that needs one, started on first use with one worker per core
+        static ThreadPool& shared() {
+            static ThreadPool pool;
+            return pool;
+        }
+
+    private:
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        void workerLoop(size_t index) {
+            currentPool = this;
+            currentWorker = index;
+
+            while (true) {
+                std::function<void()> task;
+                if (popOwn(index, task) || steal(index, task)) {
+                    queued--;
+                    task();
+                    if (--unfinished == 0) {
+                        std::lock_guard<std::mutex> lock(sleepMutex);
+                        allDone.notify_all();
+                    }
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wakeUp.wait(lock, [this] { return stopping || queued > 0; });
+                if (stopping && queued == 0) {
+                    return;
+                }
+            }
+        }
+
+        // Newest task of the worker's own queue, which is the most likely to still be in cache
+        bool popOwn(size_t index, std::function<void()>& task) {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            if (queues[index]->tasks.empty()) {
+                return false;
+            }
+            task = std::move(queues[index]->tasks.back());
+            queues[index]->tasks.pop_back();
+            return true;
+        }
+
+        // Oldest task of the first other worker that has one
+        bool steal(size_t index, std::function<void()>& task) {
+            for (size_t offset = 1; offset < queues.size(); offset++) {
+                auto& victim = *queues[(index + offset) % queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        vector<std::unique_ptr<WorkerQueue>> queues;
+        vector<std::thread> workers;
+        std::atomic<size_t> nextQueue{0};
+
+        // Tasks waiting in a queue, and tasks submitted but not finished yet
+        std::atomic<size_t> queued{0};
+        std::atomic<size_t> unfinished{0};
+
+        std::mutex sleepMutex;
+        std::condition_variable wakeUp;
+        std::condition_variable allDone;
+        bool stopping = false;
+
+        // Pool and queue of the worker running on this thread, if any
+        static inline thread_local ThreadPool* currentPool = nullptr;
+        static inline thread_local size_t currentWorker = 0;
+};
@@ -0,0 +1,247 @@
+// WorkListSafety.hpp
+#pragma once
+
+#include <vector>
+#include <span>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <stdexcept>
+
+#include "ResourceMatrix.hpp"
+#include "ResourceKernels.hpp"
+
+using std::vector;
+
+// Which safe sequence is returned when more than one exists
+enum class SequenceOrder {
+    // The sequence found by scanning the processes FIFO in repeated passes, the order BankerAlgorithm::findSafeSequence uses
+    FIFO,
+    // Any valid safe sequence, whichever is cheapest to produce
+    ANY
+};
+
+// Per resource lists of the processes blocked on each resource type, the core of the work list engines
+// For every resource type, the processes blocked on it are kept sorted by their need of that resource, and every process
+// counts the resource types still blocking it. When a finished process releases resource j, only the front of resource j's
+// list that now fits into the available vector is visited, and a process becomes runnable once its count reaches zero.
+// Shared by BasicWorkListSafety on dense rows and SparseWorkListSafety on compressed sparse rows, which differ only in
+// how they find the blocked entries of a process and release its allocation.
+// N is the unsigned type of a need
+template <typename N>
+class BlockedWorkLists {
+    public:
+        // Count the resource types blocking each process and fill the sorted lists
+        // forEachBlocked(process, onBlocked) must call onBlocked(resource, need) for every resource type whose need exceeds
+        // the available count, in the same order every time, as it is called twice per process
+        template <typename ForEachBlocked>
+        void build(size_t numProcesses, size_t numResources, ForEachBlocked forEachBlocked) {
+            // Count the resource types blocking each process, and size the blocked list of each resource type
+            blockingCount.assign(numProcesses, 0);
+            listStart.assign(numResources + 1, 0);
+            for (size_t i = 0; i < numProcesses; i++) {
+                forEachBlocked(i, [&](size_t j, N) {
+                    blockingCount[i]++;
+                    listStart[j + 1]++;
+                });
+            }
+            for (size_t j = 0; j < numResources; j++) {
+                listStart[j + 1] += listStart[j];
+            }
+
+            // Fill the blocked lists of all resource types into one buffer, then sort each by need
+            blockedEntries.resize(listStart[numResources]);
+            listFront.assign(listStart.begin(), listStart.end() - 1);
+            for (size_t i = 0; i < numProcesses; i++) {
+                forEachBlocked(i, [&](size_t j, N need) {
+                    blockedEntries[listFront[j]++] = BlockedEntry{need, i};
+                });
+            }
+            for (size_t j = 0; j < numResources; j++) {
+                if (listStart[j + 1] - listStart[j] > 1) {
+                    std::sort(blockedEntries.begin() + listStart[j], blockedEntries.begin() + listStart[j + 1]);
+                }
+            }
+
+            // Position of the first entry of each list that is still blocked
+            listFront.assign(listStart.begin(), listStart.end() - 1);
+        }
+
+        // Visit the entries of resource j's list that fit into available units of it, and report every process that became
+        // runnable because of it
+        template <typename OnRunnable>
+        void release(size_t resource, N available, OnRunnable onRunnable) {
+            size_t& front = listFront[resource];
+            while (front < listStart[resource + 1] && blockedEntries[front].need <= available) {
+                const size_t unblocked = blockedEntries[front].process;
+                if (--blockingCount[unblocked] == 0) {
+                    onRunnable(unblocked);
+                }
+                front++;
+            }
+        }
+
+        // Reproduces the sequence of repeated FIFO passes
+        // A pass visits processes in increasing index order. A process that becomes runnable after the pass has gone past it
+        // waits for the next pass, so runnable processes are split into the current pass and the next pass by the index
+        // of the process that finished last.
+        // finish(process, onRunnable) must free the resources of the process and call release for every resource type it
+        // released.
+        template <typename Finish>
+        void runFifo(vector<size_t>& safeSequence, Finish finish) {
+            // Both heaps start with room for every process, so pushing never reallocates
+            using MinHeap = std::priority_queue<size_t, vector<size_t>, std::greater<size_t>>;
+            vector<size_t> currentStorage;
+            vector<size_t> nextStorage;
+            currentStorage.reserve(blockingCount.size());
+            nextStorage.reserve(blockingCount.size());
+            MinHeap currentPass(std::greater<size_t>(), std::move(currentStorage));
+            MinHeap nextPass(std::greater<size_t>(), std::move(nextStorage));
+
+            for (size_t i = 0; i < blockingCount.size(); i++) {
+                if (blockingCount[i] == 0) {
+                    currentPass.push(i);
+                }
+            }
+
+            while (!currentPass.empty()) {
+                const size_t process = currentPass.top();
+                currentPass.pop();
+                safeSequence.push_back(process);
+
+                finish(process, [&](size_t runnable) {
+                    if (runnable > process) {
+                        currentPass.push(runnable);
+                    } else {
+                        nextPass.push(runnable);
+                    }
+                });
+
+                if (currentPass.empty()) {
+                    std::swap(currentPass, nextPass);
+                }
+            }
+        }
+
+        // Finishes runnable processes in whatever order they are found, see runFifo for finish
+        template <typename Finish>
+        void runAny(vector<size_t>& safeSequence, Finish finish) {
+            vector<size_t> runnable;
+            runnable.reserve(blockingCount.size());
+            for (size_t i = 0; i < blockingCount.size(); i++) {
+                if (blockingCount[i] == 0) {
+                    runnable.push_back(i);
+                }
+            }
+
+            while (!runnable.empty()) {
+                const size_t process = runnable.back();
+                runnable.pop_back();
+                safeSequence.push_back(process);
+
+                finish(process, [&](size_t unblocked) {
+                    runnable.push_back(unblocked);
+                });
+            }
+        }
+
+        // Resource types still blocking each process, non-zero for the processes left when a run stops
+        const vector<size_t>& blockingCounts() const {
+            return blockingCount;
+        }
+
+    private:
+        struct BlockedEntry {
+            N need;
+            size_t process;
+
+            bool operator<(const BlockedEntry& other) const {
+                return need < other.need || (need == other.need && process < other.process);
+            }
+        };
+
+        // Blocked lists of all resource types, stored back to back
+        vector<BlockedEntry> blockedEntries;
+        vector<size_t> blockingCount;
+        vector<size_t> listStart;
+        vector<size_t> listFront;
+};
+
+// Safety check that only visits a process again when a release could have unblocked it, see BlockedWorkLists
+// This costs O(P * R * log P) for the sort instead of the O(P^2 * R) of repeated FIFO passes.
+// T is the unsigned type of a resource count, see BasicResourceMatrix
+template <typename T>
+class BasicWorkListSafety {
+    public:
+        // The matrices must stay alive while the object is used
+        // availableVector must be padded to the stride of the matrices
+        BasicWorkListSafety(std::span<const T> availableVector, BasicResourceMatrixView<T> needMatrix,
+                            BasicResourceMatrixView<T> allocationMatrix, const BasicResourceKernels<T>& kernels) :
+                       availableVector(availableVector.begin(), availableVector.end()),
+                       needMatrix(needMatrix), allocationMatrix(allocationMatrix), kernels(kernels) {}
+
+        // Returns the processes in the order they finished
+        // If a deadlock stops some processes from finishing, allFinished() is false afterwards
+        vector<size_t> findSafeSequence(SequenceOrder order) {
+            const size_t numProcesses = needMatrix.rows();
+            const size_t numResources = needMatrix.cols();
+
+            vector<size_t> safeSequence;
+            safeSequence.reserve(numProcesses);
+
+            lists.build(numProcesses, numResources, [&](size_t i, auto onBlocked) {
+                auto need = needMatrix.row(i);
+                for (size_t j = 0; j < numResources; j++) {
+                    if (need[j] > availableVector[j]) {
+                        onBlocked(j, need[j]);
+                    }
+                }
+            });
+
+            auto finish = [&](size_t process, auto onRunnable) {
+                finishProcess(process, onRunnable);
+            };
+            if (order == SequenceOrder::FIFO) {
+                lists.runFifo(safeSequence, finish);
+            } else {
+                lists.runAny(safeSequence, finish);
+            }
+
+            finishedAll = safeSequence.size() == numProcesses;
+            return safeSequence;
+        }
+
+        bool allFinished() const {
+            return finishedAll;
+        }
+
+    private:
+        // Frees the resources of a finished process and reports every process that became runnable because of it
+        template <typename OnRunnable>
+        void finishProcess(size_t process, OnRunnable onRunnable) {
+            if (!kernels.addInto(availableVector.data(), allocationMatrix.paddedRow(process).data(), allocationMatrix.stride())) {
+                throw std::overflow_error("Available resources overflowed when process " + std::to_string(process) + " released its allocation");
+            }
+
+            // Only resource types this process actually released can unblock anything
+            auto allocation = allocationMatrix.row(process);
+            for (size_t j = 0; j < allocation.size(); j++) {
+                if (allocation[j] != 0) {
+                    lists.release(j, availableVector[j], onRunnable);
+                }
+            }
+        }
+
+        // Datastructures used for calculating safe sequence
+        AlignedVector<T> availableVector;
+        BasicResourceMatrixView<T> needMatrix;
+        BasicResourceMatrixView<T> allocationMatrix;
+        const BasicResourceKernels<T>& kernels;
+
+        BlockedWorkLists<T> lists;
+
+        bool finishedAll = false;
+};
+
+using WorkListSafety = BasicWorkListSafety<size_t>;
@@ -0,0 +1,444 @@
+// WorkloadSimulator.hpp
+#pragma once
+
+#include <vector>
+#include <string>
+#include <span>
+#include <array>
+#include <queue>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#include "BankerEngine.hpp"
+#include "Stats.hpp"
+
+using std::vector, std::string;
+
+// Workload generated by WorkloadSimulator::run, rates and times are in simulated seconds
+struct WorkloadConfig {
+    uint64_t seed = 42;
+    // Number of request decisions to simulate
+    size_t decisions = 100000;
+    // New processes per second, arriving as a Poisson process
+    double arrivalRate = 20;
+    // Requests per second of each process that still needs resources, also a Poisson process
+    // A request that is not granted is retried after a wait drawn the same way, at half the rate after each further denial
+    double requestRate = 50;
+    // Once granted everything it claimed, a process holds it for a Pareto distributed time, then releases it all and leaves
+    // Shapes at or below 2 give holding times an infinite variance, so a few processes hold their resources for very long
+    double holdingShape = 1.5;
+    double holdingScale = 0.01;
+    // Share of the resource types that are hot, and the chance that each type a process claims is one of the hot ones
+    double hotspotFraction = 0.1;
+    double hotspotWeight = 0.8;
+    // Most resource types one process claims, and the largest share of the total units of a type it claims
+    size_t claimTypes = 4;
+    double claimShare = 0.05;
+    // Processes arriving while this many are active are turned away
+    size_t maxProcesses = 1000;
+};
+
+enum class WorkloadEvent {
+    // A process arrives with the maximum claim that follows it, and is expected to get the pid that precedes the claim
+    ARRIVE,
+    // A process requests the amounts that follow
+    REQUEST,
+    // A process releases the amounts that follow
+    RELEASE,
+    // A process releases everything it holds and leaves
+    DEPART
+};
+
+inline const char* workloadEventName(WorkloadEvent event) {
+    switch (event) {
+        case WorkloadEvent::ARRIVE: return "arrive";
+        case WorkloadEvent::REQUEST: return "request";
+        case WorkloadEvent::RELEASE: return "release";
+        case WorkloadEvent::DEPART: return "depart";
+    }
+    return "unknown";
+}
+
+inline WorkloadEvent parseWorkloadEvent(const string& name) {
+    for (WorkloadEvent event: {WorkloadEvent::ARRIVE, WorkloadEvent::REQUEST, WorkloadEvent::RELEASE, WorkloadEvent::DEPART}) {
+        if (name == workloadEventName(event)) {
+            return event;
+        }
+    }
+    throw std::runtime_error("Unknown workload event " + name + ", expected arrive, request, release or depart");
+}
+
+// Outcome of a simulated or replayed workload
+struct WorkloadReport {
+    size_t requests = 0;
+    // Requests by RequestStatus
+    std::array<size_t, 3> decisions = {};
+    size_t arrivals = 0;
+    size_t turnedAway = 0;
+    size_t departures = 0;
+    size_t activeAtEnd = 0;
+
+    // Wall clock time of every request decision in increasing order, in total and by RequestStatus
+    vector<uint64_t> decisionNanoseconds;
+    std::array<vector<uint64_t>, 3> statusNanoseconds;
+
+    // Full safety checks the engine ran, for requests its cached safe sequence did not allow and to rebuild that sequence
+    // after departures, and the time they took
+    // Both stay 0 if ENABLE_STATS is false
+    uint64_t safetyChecks = 0;
+    uint64_t safetyNanoseconds = 0;
+
+    // Simulated time covered by the workload, and wall clock time taken to run it
+    uint64_t simulatedMicroseconds = 0;
+    uint64_t wallNanoseconds = 0;
+
+    size_t count(RequestStatus status) const {
+        return decisions[static_cast<size_t>(status)];
+    }
+
+    double grantsPerSecond() const {
+        return wallNanoseconds == 0 ? 0.0 : count(RequestStatus::GRANTED) * 1e9 / wallNanoseconds;
+    }
+
+    // Share of requests that were not granted, because the resources were not available or the state would have become unsafe
+    double denialRate() const {
+        return requests == 0 ? 0.0 : static_cast<double>(requests - count(RequestStatus::GRANTED)) / requests;
+    }
+
+    uint64_t decisionTotalNanoseconds() const {
+        return std::accumulate(decisionNanoseconds.begin(), decisionNanoseconds.end(), uint64_t(0));
+    }
+
+    // Latency below which a share p of the decisions finished, out of sorted
+    static uint64_t percentile(const vector<uint64_t>& sorted, double p) {
+        return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+    }
+};
+
+// Drives a BankerEngine as an admission controller with a stream of process arrivals, requests and departures
+// Events happen in simulated time, which only orders them. The simulator runs them as fast as it can and times each
+// request decision on the wall clock, so the report shows what the engine itself sustains. The same seed and starting
+// state always give the same stream, and a stream written to a trace replays the same decisions from the same state.
+//
+// Traces are text with one event per line, "#" starts a comment:
+//     simulated microseconds <space> arrive|request|release|depart <space> pid [<space> one amount per resource type]
+class WorkloadSimulator {
+    public:
+        // The engine has to start in a safe state, otherwise no request could ever be granted
+        explicit WorkloadSimulator(BankerEngine& engine) : engine(engine) {
+            if (!engine.isSafe()) {
+                throw std::runtime_error("The starting state of the workload is unsafe, no request could be granted");
+            }
+        }
+
+        // Generate a workload with config and run it until config.decisions requests were decided or no event is left
+        // Every event run is written to trace if one is given
+        WorkloadReport run(const WorkloadConfig& config, std::ostream* trace = nullptr) {
+            if (config.arrivalRate < 0 || config.requestRate <= 0 || config.holdingShape <= 0 || config.holdingScale < 0) {
+                throw std::runtime_error("Workload rates and the holding time shape must be above zero");
+            }
+            random.seed(config.seed);
+            const size_t numResources = engine.resourceCount();
+
+            // Total units of each type, which claims are drawn against so every claim fits once all others are released
+            totalResources.assign(engine.getAvailableResources().begin(), engine.getAvailableResources().end());
+            for (size_t pid = 0; pid < engine.processCapacity(); pid++) {
+                if (engine.isActive(pid)) {
+                    auto allocation = engine.getAllocation(pid);
+                    for (size_t j = 0; j < numResources; j++) {
+                        totalResources[j] += allocation[j];
+                    }
+                }
+            }
+
+            // The hot resource types are a random subset of them
+            vector<size_t> types(numResources);
+            std::iota(types.begin(), types.end(), 0);
+            std::shuffle(types.begin(), types.end(), random);
+            const size_t numHot = std::clamp<size_t>(static_cast<size_t>(std::lround(config.hotspotFraction * numResources)), 1, numResources);
+            hotTypes.assign(types.begin(), types.begin() + numHot);
+
+            WorkloadReport report;
+            report.decisionNanoseconds.reserve(config.decisions);
+            const StatsReport statsBefore = Stats::process().report();
+            const auto start = std::chrono::steady_clock::now();
+
+            // Processes of the starting state are already active
+            events = {};
+            order = 0;
+            denials.assign(engine.processCapacity(), 0);
+            for (size_t pid = 0; pid < engine.processCapacity(); pid++) {
+                if (engine.isActive(pid)) {
+                    scheduleNext(pid, 0, config);
+                }
+            }
+            if (config.arrivalRate > 0) {
+                schedule(exponential(config.arrivalRate), WorkloadEvent::ARRIVE, 0);
+            }
+
+            while (report.requests < config.decisions && !events.empty()) {
+                const Pending event = events.top();
+                events.pop();
+                report.simulatedMicroseconds = event.time;
+
+                switch (event.kind) {
+                    case WorkloadEvent::ARRIVE: {
+                        schedule(event.time + exponential(config.arrivalRate), WorkloadEvent::ARRIVE, 0);
+                        if (engine.processCount() >= config.maxProcesses || !drawClaim(config)) {
+                            report.turnedAway++;
+                            break;
+                        }
+                        const size_t pid = engine.addProcess(amounts);
+                        denials.resize(engine.processCapacity(), 0);
+                        denials[pid] = 0;
+                        report.arrivals++;
+                        writeEvent(trace, event.time, WorkloadEvent::ARRIVE, pid, amounts);
+                        scheduleNext(pid, event.time, config);
+                        break;
+                    }
+                    case WorkloadEvent::REQUEST: {
+                        drawRequest(event.process);
+                        writeEvent(trace, event.time, WorkloadEvent::REQUEST, event.process, amounts);
+                        const RequestStatus status = decide(event.process, report);
+                        if (status == RequestStatus::GRANTED) {
+                            denials[event.process] = 0;
+                            scheduleNext(event.process, event.time, config);
+                        } else {
+                            const double backoff = std::ldexp(1.0, -static_cast<int>(std::min<size_t>(denials[event.process]++, MAX_BACKOFF_DOUBLINGS)));
+                            schedule(event.time + exponential(config.requestRate * backoff), WorkloadEvent::REQUEST, event.process);
+                        }
+                        break;
+                    }
+                    default: {
+                        // Generated processes release everything at once when they leave
+                        writeEvent(trace, event.time, WorkloadEvent::DEPART, event.process, {});
+                        engine.removeProcess(event.process);
+                        report.departures++;
+                        break;
+                    }
+                }
+            }
+
+            finish(report, statsBefore, start);
+            return report;
+        }
+
+        // Replay a trace written by run, or by hand, against the state the engine starts in
+        // Throws with the line number if a line is malformed or does not fit the state, such as a trace recorded from another snapshot
+        WorkloadReport replay(std::istream& trace) {
+            const size_t numResources = engine.resourceCount();
+            WorkloadReport report;
+            const StatsReport statsBefore = Stats::process().report();
+            const auto start = std::chrono::steady_clock::now();
+
+            string line;
+            size_t lineNumber = 0;
+            while (getline(trace, line)) {
+                lineNumber++;
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                const size_t first = line.find_first_not_of(" \t");
+                if (first == string::npos || line[first] == '#') {
+                    continue;
+                }
+
+                try {
+                    std::istringstream fields(line);
+                    uint64_t time;
+                    string name;
+                    size_t pid;
+                    if (!(fields >> time >> name >> pid)) {
+                        throw std::runtime_error("expected a time, an event and a pid");
+                    }
+                    const WorkloadEvent event = parseWorkloadEvent(name);
+                    amounts.clear();
+                    size_t amount;
+                    while (fields >> amount) {
+                        amounts.push_back(amount);
+                    }
+                    if (!fields.eof()) {
+                        throw std::runtime_error("amounts must be non-negative integers");
+                    }
+                    if (event != WorkloadEvent::DEPART && amounts.size() != numResources) {
+                        throw std::runtime_error("expected " + std::to_string(numResources) + " amounts, found " + std::to_string(amounts.size()));
+                    }
+                    report.simulatedMicroseconds = time;
+
+                    switch (event) {
+                        case WorkloadEvent::ARRIVE: {
+                            const size_t assigned = engine.addProcess(amounts);
+                            if (assigned != pid) {
+                                throw std::runtime_error("process arrived as pid " + std::to_string(assigned) + " instead of " + std::to_string(pid) +
+                                                         ", the trace was recorded from another starting state");
+                            }
+                            report.arrivals++;
+                            break;
+                        }
+                        case WorkloadEvent::REQUEST:
+                            decide(pid, report);
+                            break;
+                        case WorkloadEvent::RELEASE:
+                            engine.release(pid, amounts);
+                            break;
+                        case WorkloadEvent::DEPART:
+                            engine.removeProcess(pid);
+                            report.departures++;
+                            break;
+                    }
+                } catch (const std::exception& e) {
+                    throw std::runtime_error("Workload trace line " + std::to_string(lineNumber) + ": " + e.what());
+                }
+            }
+
+            finish(report, statsBefore, start);
+            return report;
+        }
+
+    private:
+        // Longest retry wait of a process, as a number of times its request rate is halved
+        static constexpr size_t MAX_BACKOFF_DOUBLINGS = 6;
+
+        // Event waiting in simulated time, ties run in the order they were scheduled
+        struct Pending {
+            uint64_t time;
+            uint64_t order;
+            WorkloadEvent kind;
+            size_t process;
+
+            bool operator>(const Pending& other) const {
+                return time > other.time || (time == other.time && order > other.order);
+            }
+        };
+
+        void schedule(uint64_t time, WorkloadEvent kind, size_t process) {
+            events.push(Pending{time, order++, kind, process});
+        }
+
+        // A process that still needs resources requests more after a while, one that has everything holds it and then leaves
+        void scheduleNext(size_t pid, uint64_t now, const WorkloadConfig& config) {
+            auto need = engine.getNeed(pid);
+            if (std::any_of(need.begin(), need.end(), [](size_t value) { return value > 0; })) {
+                schedule(now + exponential(config.requestRate), WorkloadEvent::REQUEST, pid);
+            } else {
+                schedule(now + pareto(config.holdingShape, config.holdingScale), WorkloadEvent::DEPART, pid);
+            }
+        }
+
+        // Exponential wait of a Poisson process with rate events per second, in microseconds
+        uint64_t exponential(double rate) {
+            return toMicroseconds(std::exponential_distribution<double>(rate)(random));
+        }
+
+        uint64_t pareto(double shape, double scale) {
+            const double uniform = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+            return toMicroseconds(scale * std::pow(1.0 - uniform, -1.0 / shape));
+        }
+
+        static uint64_t toMicroseconds(double seconds) {
+            return static_cast<uint64_t>(std::min(seconds * 1e6, 1e18));
+        }
+
+        // Draw the maximum claim of an arriving process into amounts, mostly on the hot resource types
+        // Returns false if there is nothing to claim
+        bool drawClaim(const WorkloadConfig& config) {
+            const size_t numResources = totalResources.size();
+            amounts.assign(numResources, 0);
+            std::bernoulli_distribution hot(config.hotspotWeight);
+            std::uniform_int_distribution<size_t> numTypes(1, std::clamp<size_t>(config.claimTypes, 1, numResources));
+            std::uniform_int_distribution<size_t> anyType(0, numResources - 1);
+            std::uniform_int_distribution<size_t> hotType(0, hotTypes.size() - 1);
+
+            bool claimed = false;
+            for (size_t k = numTypes(random); k > 0; k--) {
+                const size_t j = hot(random) ? hotTypes[hotType(random)] : anyType(random);
+                if (totalResources[j] == 0) {
+                    continue;
+                }
+                const size_t largest = std::clamp<size_t>(static_cast<size_t>(config.claimShare * totalResources[j]), 1, totalResources[j]);
+                amounts[j] = std::uniform_int_distribution<size_t>(1, largest)(random);
+                claimed = true;
+            }
+            return claimed;
+        }
+
+        // Draw a request into amounts, asking for part of the remaining need of about half of the types pid still needs
+        void drawRequest(size_t pid) {
+            auto need = engine.getNeed(pid);
+            amounts.assign(need.size(), 0);
+            needed.clear();
+            std::bernoulli_distribution ask(0.5);
+            for (size_t j = 0; j < need.size(); j++) {
+                if (need[j] > 0) {
+                    needed.push_back(j);
+                    if (ask(random)) {
+                        amounts[j] = std::uniform_int_distribution<size_t>(1, need[j])(random);
+                    }
+                }
+            }
+            if (std::all_of(amounts.begin(), amounts.end(), [](size_t value) { return value == 0; })) {
+                const size_t j = needed[std::uniform_int_distribution<size_t>(0, needed.size() - 1)(random)];
+                amounts[j] = std::uniform_int_distribution<size_t>(1, need[j])(random);
+            }
+        }
+
+        // Ask the engine to grant amounts to pid, timing the decision
+        RequestStatus decide(size_t pid, WorkloadReport& report) {
+            const auto start = std::chrono::steady_clock::now();
+            const RequestStatus status = engine.request(pid, amounts);
+            const uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+            report.requests++;
+            report.decisions[static_cast<size_t>(status)]++;
+            report.decisionNanoseconds.push_back(nanoseconds);
+            report.statusNanoseconds[static_cast<size_t>(status)].push_back(nanoseconds);
+            return status;
+        }
+
+        void writeEvent(std::ostream* trace, uint64_t time, WorkloadEvent event, size_t pid, std::span<const size_t> values) {
+            if (trace == nullptr) {
+                return;
+            }
+            *trace << time << ' ' << workloadEventName(event) << ' ' << pid;
+            for (auto value: values) {
+                *trace << ' ' << value;
+            }
+            *trace << '\n';
+        }
+
+        void finish(WorkloadReport& report, const StatsReport& statsBefore, std::chrono::steady_clock::time_point start) {
+            report.wallNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            const StatsReport statsAfter = Stats::process().report();
+            report.safetyChecks = statsAfter[Stat::SAFETY_CHECKS] - statsBefore[Stat::SAFETY_CHECKS];
+            report.safetyNanoseconds = statsAfter[Stat::SAFETY_NANOSECONDS] - statsBefore[Stat::SAFETY_NANOSECONDS];
+            report.activeAtEnd = engine.processCount();
+
+            std::sort(report.decisionNanoseconds.begin(), report.decisionNanoseconds.end());
+            for (auto& latencies: report.statusNanoseconds) {
+                std::sort(latencies.begin(), latencies.end());
+            }
+        }
+
+        BankerEngine& engine;
+        std::mt19937_64 random;
+
+        std::priority_queue<Pending, vector<Pending>, std::greater<Pending>> events;
+        uint64_t order = 0;
+
+        // Requests of each pid denied in a row
+        vector<size_t> denials;
+
+        vector<size_t> totalResources;
+        vector<size_t> hotTypes;
+
+        // Claim or request being drawn or replayed, and the types the requesting process still needs
+        vector<size_t> amounts;
+        vector<size_t> needed;
+};
@@ -0,0 +1,382 @@
+// bench.cpp
+// Benchmark suite: generates seeded snapshots of several sizes and shapes, then separately times parsing them, sending them
+// to a child process with every transport and finding a safe sequence with every engine
+// Every engine's answer is checked against the scalar scan, so a kernel or engine that disagrees fails the run.
+// Results can be written as JSON and compared against a saved run, failing the run if a stage got slower than the tolerance.
+// Every stage also reports its calls to the global allocator per round, counted by the operator new below. The arena
+// stage must make none once warmed up, or the run fails.
+// Usage: bench.out [--sizes PxR,...] [--shapes safe,barely-safe,deadlock,chain] [--rounds N] [--seed N]
+//                  [--json results.json] [--baseline baseline.json] [--tolerance 0.10]
+#include "../BankerAlgorithm.hpp"
+#include "../ProgramSnapshotReader.hpp"
+#include "../PipeTransport.hpp"
+#include "../SnapshotGenerator.hpp"
+#include "../SnapshotArena.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <map>
+#include <functional>
+#include <filesystem>
+#include <atomic>
+#include <cstdlib>
+#include <sys/wait.h>
+
+using std::cout, std::endl;
+
+// Calls to the global allocator made by this process, in any thread
+std::atomic<uint64_t> globalAllocations{0};
+
+// The replacements below pair malloc and aligned_alloc with free on purpose. GCC cannot tell they replace the global
+// operators and warns wherever a new and a delete are inlined together, so the warning is silenced around them.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    globalAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size > 0 ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    globalAllocations.fetch_add(1, std::memory_order_relaxed);
+    const size_t align = static_cast<size_t>(alignment);
+    if (void* pointer = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+#pragma GCC diagnostic pop
+
+// Timings of one stage of one benchmark case
+struct BenchResult {
+    string name;
+    double medianMilliseconds;
+    double p99Milliseconds;
+    // Millions of matrix elements processed per second at the median
+    double elementsPerSecond;
+    // Median calls to the global allocator per round
+    uint64_t allocations;
+};
+
+// Milliseconds and calls to the global allocator of every round of a stage, both sorted
+struct RoundTimes {
+    vector<double> milliseconds;
+    vector<uint64_t> allocations;
+};
+
+// Differences under this many milliseconds are timer noise and never count as a regression
+#define BENCH_NOISE_FLOOR_MS 0.05
+
+// Milliseconds and allocations of every round of body, sorted
+RoundTimes timeRounds(size_t rounds, const std::function<void()>& body) {
+    RoundTimes times;
+    times.milliseconds.reserve(rounds);
+    times.allocations.reserve(rounds);
+    for (size_t round = 0; round < rounds; round++) {
+        const uint64_t allocationsBefore = globalAllocations.load(std::memory_order_relaxed);
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        times.milliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        times.allocations.push_back(globalAllocations.load(std::memory_order_relaxed) - allocationsBefore);
+    }
+    std::sort(times.milliseconds.begin(), times.milliseconds.end());
+    std::sort(times.allocations.begin(), times.allocations.end());
+    return times;
+}
+
+BenchResult summarize(const string& name, const RoundTimes& times, size_t elements) {
+    const vector<double>& milliseconds = times.milliseconds;
+    const double median = milliseconds[milliseconds.size() / 2];
+    const size_t p99Rank = std::min(milliseconds.size() - 1, static_cast<size_t>(0.99 * milliseconds.size()));
+    return {name, median, milliseconds[p99Rank], elements / 1e6 / (median / 1000), times.allocations[times.allocations.size() / 2]};
+}
+
+// Median and p99 round trip of sending the snapshot to a forked child, which reads every count before answering
+RoundTimes timeTransport(Transport kind, size_t rounds, const GeneratedSnapshot& snapshot) {
+    int childToParentFD[2], parentToChildFD[2];
+    if (pipe(childToParentFD) == -1 || pipe(parentToChildFD) == -1) {
+        throw std::runtime_error("Pipe Creation Failed");
+    }
+    SnapshotTransport transport(kind);
+
+    const pid_t cpid = fork();
+    if (cpid == -1) {
+        throw std::runtime_error("Fork Failed");
+    }
+
+    if (cpid == 0) {
+        close(childToParentFD[READ_END]);
+        close(parentToChildFD[WRITE_END]);
+        for (size_t round = 0; round < rounds; round++) {
+            ReceivedSnapshot received;
+            transport.receive(parentToChildFD, received);
+            const auto width = snapshotCountWidth(received.getAvailableResources(), received.getMaximumMatrix(), received.getAllocationMatrix());
+            writeFull(childToParentFD[WRITE_END], &width, sizeof(width), "Acknowledgement");
+        }
+        _exit(0);
+    }
+
+    close(childToParentFD[WRITE_END]);
+    close(parentToChildFD[READ_END]);
+
+    auto times = timeRounds(rounds, [&] {
+        transport.send(parentToChildFD, snapshot.availableVector, snapshot.maxMatrix, snapshot.allocationMatrix);
+        CountWidth width;
+        readFull(childToParentFD[READ_END], &width, sizeof(width), "Acknowledgement");
+    });
+
+    close(parentToChildFD[WRITE_END]);
+    close(childToParentFD[READ_END]);
+    waitpid(cpid, nullptr, 0);
+    return times;
+}
+
+// Median milliseconds of every result in a JSON file written by this program, by name
+std::map<string, double> readBaseline(const string& file_name) {
+    std::ifstream file(file_name);
+    if (!file) {
+        throw std::runtime_error("Could not open baseline " + file_name);
+    }
+
+    // Every result is written on a line of its own, so the file is read line by line instead of with a JSON parser
+    std::map<string, double> baseline;
+    string line;
+    while (std::getline(file, line)) {
+        const string nameKey = "\"name\": \"";
+        const string medianKey = "\"median_ms\": ";
+        const size_t name = line.find(nameKey);
+        const size_t median = line.find(medianKey);
+        if (name == string::npos || median == string::npos) {
+            continue;
+        }
+        const size_t nameStart = name + nameKey.size();
+        baseline[line.substr(nameStart, line.find('"', nameStart) - nameStart)] = std::stod(line.substr(median + medianKey.size()));
+    }
+    return baseline;
+}
+
+void writeResults(const string& file_name, uint64_t seed, size_t rounds, const vector<BenchResult>& results) {
+    std::ofstream file(file_name, std::ios::trunc);
+    file << std::setprecision(6);
+    file << "{\n  \"seed\": " << seed << ",\n  \"rounds\": " << rounds << ",\n  \"kernels\": \""
+         << kernelLevelName(ResourceKernels::best().level) << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        file << "    {\"name\": \"" << result.name << "\", \"median_ms\": " << result.medianMilliseconds
+             << ", \"p99_ms\": " << result.p99Milliseconds << ", \"melements_per_s\": " << result.elementsPerSecond
+             << ", \"allocations\": " << result.allocations << "}"
+             << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    if (!file) {
+        throw std::runtime_error("Failed to write results to " + file_name);
+    }
+}
+
+vector<string> splitList(const string& list) {
+    vector<string> items;
+    std::stringstream stream(list);
+    string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+int main(int argc, char *argv[]) {
+    string sizes = "100x10,2000x50,10000x20";
+    string shapes = "safe,barely-safe,deadlock,chain";
+    size_t rounds = 5;
+    uint64_t seed = 42;
+    string jsonFile;
+    string baselineFile;
+    double tolerance = 0.10;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const string option = argv[i];
+        if (option == "--sizes") {
+            sizes = argv[i + 1];
+        } else if (option == "--shapes") {
+            shapes = argv[i + 1];
+        } else if (option == "--rounds") {
+            rounds = std::max<size_t>(1, std::stoul(argv[i + 1]));
+        } else if (option == "--seed") {
+            seed = std::stoull(argv[i + 1]);
+        } else if (option == "--json") {
+            jsonFile = argv[i + 1];
+        } else if (option == "--baseline") {
+            baselineFile = argv[i + 1];
+        } else if (option == "--tolerance") {
+            tolerance = std::stod(argv[i + 1]);
+        } else {
+            throw std::runtime_error("Unknown option " + option);
+        }
+    }
+
+    const auto directory = std::filesystem::temp_directory_path();
+    const string textFile = (directory / ("bankers-bench-" + std::to_string(getpid()) + ".txt")).string();
+    const string binaryFile = (directory / ("bankers-bench-" + std::to_string(getpid()) + ".bin")).string();
+
+    cout << "kernels " << kernelLevelName(ResourceKernels::best().level) << ", seed " << seed << ", " << rounds << " rounds" << endl;
+    cout << std::left << std::setw(44) << "case" << std::right << std::setw(12) << "median ms" << std::setw(12) << "p99 ms"
+         << std::setw(12) << "Melem/s" << std::setw(10) << "allocs" << endl;
+
+    vector<BenchResult> results;
+    bool mismatch = false;
+    bool allocated = false;
+    for (const string& size: splitList(sizes)) {
+        const size_t separator = size.find('x');
+        if (separator == string::npos) {
+            throw std::runtime_error("Sizes are given as processes x resources, such as 2000x50, not " + size);
+        }
+        const size_t numProcesses = std::stoul(size.substr(0, separator));
+        const size_t numResources = std::stoul(size.substr(separator + 1));
+
+        for (const string& shapeName: splitList(shapes)) {
+            const SnapshotShape shape = parseSnapshotShape(shapeName);
+            SnapshotGenerator generator(seed);
+            const GeneratedSnapshot snapshot = generator.generate(numProcesses, numResources, shape);
+            const string prefix = size + "/" + snapshotShapeName(shape) + "/";
+            const size_t elements = 2 * numProcesses * numResources;
+
+            auto record = [&](const string& stage, const RoundTimes& times) {
+                results.push_back(summarize(prefix + stage, times, elements));
+                const auto& result = results.back();
+                cout << std::left << std::setw(44) << result.name << std::right << std::fixed << std::setprecision(3)
+                     << std::setw(12) << result.medianMilliseconds << std::setw(12) << result.p99Milliseconds
+                     << std::setprecision(1) << std::setw(12) << result.elementsPerSecond << std::setw(10) << result.allocations << endl;
+                cout.unsetf(std::ios::fixed);
+            };
+
+            // Parsing
+            writeTextSnapshot(textFile, snapshot.availableVector, snapshot.maxMatrix, snapshot.allocationMatrix);
+            writeBinarySnapshot(binaryFile, snapshot.availableVector, snapshot.maxMatrix, snapshot.allocationMatrix);
+            record("parse-text", timeRounds(rounds, [&] {
+                ProgramSnapshotReader reader(textFile);
+            }));
+            record("load-binary", timeRounds(rounds, [&] {
+                MappedSnapshot mapped(binaryFile);
+                snapshotCountWidth(mapped.getAvailableResources(), mapped.getMaximumMatrix(), mapped.getAllocationMatrix());
+            }));
+
+            // Reading and checking a snapshot as batch mode does, on the global heap and in an arena reset after every round
+            record("read-check-heap", timeRounds(rounds, [&] {
+                ProgramSnapshotReader reader(textFile);
+                BankerAlgorithm bankers(reader.getAvailableResources(), reader.getMaximumMatrix().view(), reader.getAllocationMatrix().view());
+                vector<size_t> safeSequence;
+                bankers.findSafeSequenceInto(safeSequence);
+            }));
+            SnapshotArena arena;
+            auto readCheckArena = [&] {
+                {
+                    ProgramSnapshotReader reader(textFile, arena.resource());
+                    BankerAlgorithm bankers(reader.getAvailableResources(), reader.getMaximumMatrix().view(), reader.getAllocationMatrix().view(),
+                                            arena.resource());
+                    std::pmr::vector<size_t> safeSequence(arena.resource());
+                    bankers.findSafeSequenceInto(safeSequence);
+                }
+                arena.reset();
+            };
+            // One untimed round grows the arena to fit the snapshot, after which no round may touch the global allocator
+            readCheckArena();
+            const RoundTimes arenaTimes = timeRounds(rounds, readCheckArena);
+            record("read-check-arena", arenaTimes);
+            if (arenaTimes.allocations.back() > 0) {
+                cout << "ALLOCATION " << prefix << "read-check-arena made " << arenaTimes.allocations.back()
+                     << " global allocations in a round after warm-up" << endl;
+                allocated = true;
+            }
+
+            // Transfer to a child process
+            for (Transport kind: {Transport::ELEMENT, Transport::FRAMED, Transport::SHARED_MEMORY}) {
+                record(string("ipc-") + transportName(kind), timeTransport(kind, rounds, snapshot));
+            }
+
+            // Safety checks, each checked against the scalar scan
+            vector<size_t> expected;
+            record("solve-scan-scalar", timeRounds(rounds, [&] {
+                BankerAlgorithm bankers(snapshot.availableVector, snapshot.maxMatrix, snapshot.allocationMatrix);
+                bankers.useKernels(ResourceKernels::forLevel(KernelLevel::SCALAR));
+                expected = bankers.findSafeSequence();
+            }));
+            if (expected.empty() != (shape == SnapshotShape::DEADLOCK)) {
+                cout << "MISMATCH " << prefix << " generated a " << (expected.empty() ? "deadlocked" : "safe") << " snapshot" << endl;
+                mismatch = true;
+            }
+
+            auto solve = [&](const string& stage, const std::function<vector<size_t>()> run) {
+                vector<size_t> safeSequence;
+                record(stage, timeRounds(rounds, [&] {
+                    safeSequence = run();
+                }));
+                if (safeSequence != expected) {
+                    cout << "MISMATCH " << prefix << stage << " disagrees with the scalar scan" << endl;
+                    mismatch = true;
+                }
+            };
+            for (auto [stage, engine]: {std::pair{"scan", SafetyEngine::SCAN}, std::pair{"worklist", SafetyEngine::WORK_LIST},
+                                        std::pair{"parallel", SafetyEngine::PARALLEL}}) {
+                solve(string("solve-") + stage, [&, engine = engine] {
+                    BankerAlgorithm bankers(snapshot.availableVector, snapshot.maxMatrix, snapshot.allocationMatrix);
+                    return bankers.findSafeSequence(engine);
+                });
+                solve(string("solve-") + stage + "-narrow", [&, engine = engine] {
+                    return findSafeSequenceNarrowest(snapshot.availableVector, snapshot.maxMatrix, snapshot.allocationMatrix, engine);
+                });
+            }
+        }
+    }
+    std::filesystem::remove(textFile);
+    std::filesystem::remove(binaryFile);
+
+    if (!jsonFile.empty()) {
+        writeResults(jsonFile, seed, rounds, results);
+        cout << "Wrote " << results.size() << " results to " << jsonFile << endl;
+    }
+
+    bool regressed = false;
+    if (!baselineFile.empty()) {
+        const auto baseline = readBaseline(baselineFile);
+        size_t compared = 0;
+        for (const auto& result: results) {
+            auto found = baseline.find(result.name);
+            if (found == baseline.end()) {
+                continue;
+            }
+            compared++;
+            const double before = found->second;
+            if (result.medianMilliseconds > before * (1 + tolerance) && result.medianMilliseconds - before > BENCH_NOISE_FLOOR_MS) {
+                cout << "REGRESSION " << result.name << ": " << before << " ms -> " << result.medianMilliseconds << " ms" << endl;
+                regressed = true;
+            }
+        }
+        cout << "Compared " << compared << " results against " << baselineFile << ", "
+             << (regressed ? "found regressions" : "no regressions") << " beyond " << tolerance * 100 << "%" << endl;
+    }
+
+    return (mismatch || allocated || regressed) ? 1 : 0;
+}
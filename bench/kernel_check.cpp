@@ -0,0 +1,129 @@
+// kernel_check.cpp
+// Checks that every vectorized level of BasicResourceKernels gives exactly the answers of KernelLevel::SCALAR
+// Covers every count type, row lengths from empty to several vectors wide with every tail length, rows that start off
+// vector alignment, compares decided by a single lane, and additions that overflow in a single lane or in many.
+// Levels the CPU running the check does not support are reported as skipped.
+// Exits with status 1 if any answer differs.
+// Usage: kernel_check.out [seed]
+#include "../ResourceKernels.hpp"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+
+using std::cout, std::endl, std::vector, std::string;
+
+// Longest row checked, three AVX-512 vectors of bytes and then some
+constexpr size_t MAX_LENGTH = 3 * 64 + 7;
+
+// Random count of type T, drawn near zero, near the maximum or anywhere, so sums overflow often
+template <typename T>
+T randomCount(std::mt19937_64& random) {
+    const T max = std::numeric_limits<T>::max();
+    switch (random() % 3) {
+        case 0:
+            return static_cast<T>(random() % 4);
+        case 1:
+            return static_cast<T>(max - random() % 4);
+        default:
+            return static_cast<T>(random());
+    }
+}
+
+// Compare the kernels of level against the scalar kernels for count type T, returns the number of mismatches
+template <typename T>
+size_t checkLevel(KernelLevel level, std::mt19937_64& random) {
+    const BasicResourceKernels<T> scalar = BasicResourceKernels<T>::forLevel(KernelLevel::SCALAR);
+    const BasicResourceKernels<T> kernels = BasicResourceKernels<T>::forLevel(level);
+    const string name = string(kernelLevelName(level)) + " u" + std::to_string(8 * sizeof(T));
+    size_t mismatches = 0;
+    size_t cases = 0;
+
+    auto report = [&](const char* kernel, size_t length, size_t offset) {
+        if (mismatches++ < 10) {
+            cout << "  " << name << " " << kernel << " differs at length " << length << ", offset " << offset << endl;
+        }
+    };
+
+    // One spare element in front, so rows can start off vector alignment
+    vector<T> lhs(MAX_LENGTH + 1);
+    vector<T> rhs(MAX_LENGTH + 1);
+    vector<T> scalarTarget(MAX_LENGTH + 1);
+    for (size_t length = 0; length <= MAX_LENGTH; length++) {
+        for (size_t offset = 0; offset <= 1; offset++) {
+            for (size_t trial = 0; trial < 16; trial++) {
+                T* l = lhs.data() + offset;
+                T* r = rhs.data() + offset;
+
+                // lessEqual: random rows, then equal rows, then equal rows with a single lane raised on the left
+                for (size_t i = 0; i < length; i++) {
+                    l[i] = randomCount<T>(random);
+                    r[i] = (trial % 4 == 0) ? randomCount<T>(random) : l[i];
+                }
+                if (trial % 4 >= 2 && length > 0) {
+                    const size_t lane = (trial % 4 == 2) ? length - 1 : random() % length;
+                    if (l[lane] == std::numeric_limits<T>::max()) {
+                        r[lane]--;
+                    } else {
+                        l[lane]++;
+                    }
+                }
+                cases++;
+                if (kernels.lessEqual(l, r, length) != scalar.lessEqual(l, r, length)) {
+                    report("lessEqual", length, offset);
+                }
+
+                // addInto: random rows overflow somewhere most of the time, small rows with a single maximum lane overflow
+                // only there
+                for (size_t i = 0; i < length; i++) {
+                    l[i] = randomCount<T>(random);
+                    r[i] = (trial % 2 == 0) ? randomCount<T>(random) : static_cast<T>(random() % 2);
+                    if (trial % 2 == 1) {
+                        l[i] = static_cast<T>(l[i] % 2);
+                    }
+                }
+                if (trial % 2 == 1 && length > 0) {
+                    const size_t lane = (trial % 4 == 1) ? length - 1 : random() % length;
+                    l[lane] = std::numeric_limits<T>::max();
+                    r[lane] = 1;
+                }
+                std::copy(l, l + length, scalarTarget.begin());
+                cases++;
+                const bool expected = scalar.addInto(scalarTarget.data(), r, length);
+                if (kernels.addInto(l, r, length) != expected || !std::equal(l, l + length, scalarTarget.begin())) {
+                    report("addInto", length, offset);
+                }
+            }
+        }
+    }
+
+    cout << name << ": " << cases << " cases, " << mismatches << " mismatches" << endl;
+    return mismatches;
+}
+
+int main(int argc, char *argv[]) {
+    const uint64_t seed = argc > 1 ? std::stoull(argv[1]) : 1;
+    std::mt19937_64 random(seed);
+    size_t mismatches = 0;
+
+    for (KernelLevel level: {KernelLevel::SSE2, KernelLevel::AVX2, KernelLevel::AVX512}) {
+        if (level > ResourceKernels::detectLevel()) {
+            cout << kernelLevelName(level) << ": not supported by this CPU, skipped" << endl;
+            continue;
+        }
+        mismatches += checkLevel<uint8_t>(level, random);
+        mismatches += checkLevel<uint16_t>(level, random);
+        mismatches += checkLevel<uint32_t>(level, random);
+        mismatches += checkLevel<uint64_t>(level, random);
+    }
+
+    if (mismatches > 0) {
+        cout << "FAILED: " << mismatches << " mismatches with the scalar kernels" << endl;
+        return 1;
+    }
+    cout << "All kernels match the scalar kernels" << endl;
+    return 0;
+}
@@ -0,0 +1,267 @@
+// load_client.cpp
+// Load generator for server mode: loads a snapshot into a running server, then has several connections send a stream of
+// pipelined requests, releases and safety checks against it, and reports throughput and latency
+// Usage: load_client.out socket snapshot [--connections N] [--requests N] [--pipeline N] [--name state]
+#include "../ServerProtocol.hpp"
+#include "../PipeTransport.hpp"
+#include "../ProgramSnapshotReader.hpp"
+
+#include <iostream>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <tuple>
+#include <algorithm>
+#include <filesystem>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using std::cout, std::endl;
+using Clock = std::chrono::steady_clock;
+
+int connectToServer(const string& socketPath) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path is too long, " + socketPath);
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        throw std::runtime_error("Failed to connect to " + socketPath);
+    }
+    return fd;
+}
+
+// Read one response, its payload goes into payload
+MessageHeader receiveResponse(int fd, vector<char>& payload) {
+    MessageHeader header;
+    readFull(fd, &header, sizeof(header), "Response header");
+    payload.resize(header.length);
+    readFull(fd, payload.data(), header.length, "Response payload");
+    return header;
+}
+
+// Counts and latencies collected by one connection
+struct LoadStatistics {
+    size_t byStatus[static_cast<size_t>(ResponseStatus::ERROR) + 1] = {};
+    vector<double> microseconds;
+    string firstError;
+};
+
+// Send requests messages over one connection, keeping up to pipeline of them in flight
+// The connection works on the processes whose number leaves remainder connection when divided by connections, so
+// connections never request on behalf of the same process. Every message asks for one unit of a resource one of those
+// processes still declares a need for, gives back a unit granted earlier, or checks the whole state. needMatrix is the
+// need of every process when the state was loaded, and the connection keeps its part of it up to date.
+void generateLoad(const string& socketPath, uint64_t handle, const ResourceMatrix& needMatrix, size_t connection, size_t connections,
+                  size_t requests, size_t pipeline, uint64_t seed, LoadStatistics& statistics) {
+    const int fd = connectToServer(socketPath);
+    std::mt19937_64 random(seed);
+    const size_t numResources = needMatrix.cols();
+
+    // Units of each resource each process may still request, counting requests in flight as granted
+    ResourceMatrix remaining(needMatrix.rows(), numResources);
+    // Cells of remaining that are above zero, in no particular order
+    vector<std::pair<size_t, size_t>> requestable;
+    for (size_t pid = connection; pid < needMatrix.rows(); pid += connections) {
+        for (size_t resource = 0; resource < numResources; resource++) {
+            remaining(pid, resource) = needMatrix(pid, resource);
+            if (remaining(pid, resource) > 0) {
+                requestable.push_back({pid, resource});
+            }
+        }
+    }
+    auto giveBack = [&](size_t pid, size_t resource) {
+        if (remaining(pid, resource)++ == 0) {
+            requestable.push_back({pid, resource});
+        }
+    };
+
+    struct InFlight {
+        Clock::time_point sent;
+        size_t pid;
+        size_t resource;
+    };
+    std::unordered_map<uint64_t, InFlight> inFlight;
+    vector<std::pair<size_t, size_t>> granted;
+    vector<size_t> amount(numResources, 0);
+    vector<char> buffer;
+    vector<char> payload;
+    MessageWriter writer(buffer);
+
+    size_t sent = 0;
+    size_t answered = 0;
+    while (answered < requests) {
+        buffer.clear();
+        while (inFlight.size() < pipeline && sent < requests) {
+            const uint64_t requestId = sent++;
+            const size_t choice = random() % 100;
+            InFlight message{Clock::now(), SIZE_MAX, SIZE_MAX};
+
+            if (choice < 40 && !granted.empty()) {
+                const size_t index = random() % granted.size();
+                std::swap(granted[index], granted.back());
+                auto [pid, resource] = granted.back();
+                granted.pop_back();
+                giveBack(pid, resource);
+
+                amount[resource] = 1;
+                writer.begin(MessageType::RELEASE, requestId);
+                writer.number(handle);
+                writer.number(pid);
+                writer.numbers(amount);
+                amount[resource] = 0;
+            } else if (choice >= 2 && !requestable.empty()) {
+                const size_t index = random() % requestable.size();
+                std::tie(message.pid, message.resource) = requestable[index];
+                if (--remaining(message.pid, message.resource) == 0) {
+                    std::swap(requestable[index], requestable.back());
+                    requestable.pop_back();
+                }
+
+                amount[message.resource] = 1;
+                writer.begin(MessageType::REQUEST, requestId);
+                writer.number(handle);
+                writer.number(message.pid);
+                writer.numbers(amount);
+                amount[message.resource] = 0;
+            } else {
+                writer.begin(MessageType::CHECK, requestId);
+                writer.number(handle);
+            }
+            writer.finish();
+            inFlight[requestId] = message;
+        }
+        if (!buffer.empty()) {
+            writeFull(fd, buffer.data(), buffer.size(), "Requests");
+        }
+
+        const MessageHeader header = receiveResponse(fd, payload);
+        auto found = inFlight.find(header.requestId);
+        if (found == inFlight.end()) {
+            throw std::runtime_error("Response to unknown request " + std::to_string(header.requestId));
+        }
+        statistics.microseconds.push_back(std::chrono::duration<double, std::micro>(Clock::now() - found->second.sent).count());
+
+        const auto status = static_cast<ResponseStatus>(header.status);
+        statistics.byStatus[header.status]++;
+        if (status == ResponseStatus::GRANTED) {
+            granted.push_back({found->second.pid, found->second.resource});
+        } else if (found->second.pid != SIZE_MAX) {
+            // A request that was not granted leaves the need as it was
+            giveBack(found->second.pid, found->second.resource);
+        }
+        if (status == ResponseStatus::ERROR && statistics.firstError.empty()) {
+            statistics.firstError.assign(payload.begin(), payload.end());
+        }
+        inFlight.erase(found);
+        answered++;
+    }
+
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: load_client.out socket snapshot [--connections N] [--requests N] [--pipeline N] [--name state]" << endl;
+        return 1;
+    }
+    const string socketPath = argv[1];
+    const string snapshotPath = std::filesystem::absolute(argv[2]).string();
+    size_t connections = 4;
+    size_t requests = 100000;
+    size_t pipeline = 32;
+    string name = "load";
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const string option = argv[i];
+        if (option == "--connections") {
+            connections = std::stoul(argv[i + 1]);
+        } else if (option == "--requests") {
+            requests = std::stoul(argv[i + 1]);
+        } else if (option == "--pipeline") {
+            pipeline = std::max<size_t>(1, std::stoul(argv[i + 1]));
+        } else if (option == "--name") {
+            name = argv[i + 1];
+        } else {
+            throw std::runtime_error("Unknown option " + option);
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // Load the snapshot once, every connection then works on the same named state
+    const int fd = connectToServer(socketPath);
+    vector<char> buffer;
+    MessageWriter writer(buffer);
+    writer.begin(MessageType::LOAD, 0);
+    writer.number(name.size());
+    writer.text(name);
+    writer.text(snapshotPath);
+    writer.finish();
+    writeFull(fd, buffer.data(), buffer.size(), "Load request");
+
+    vector<char> payload;
+    const MessageHeader header = receiveResponse(fd, payload);
+    if (static_cast<ResponseStatus>(header.status) != ResponseStatus::OK) {
+        throw std::runtime_error("Load failed: " + string(payload.begin(), payload.end()));
+    }
+    MessageReader reader(payload);
+    const uint64_t handle = reader.number();
+    const size_t numProcesses = reader.number();
+    const size_t numResources = reader.number();
+    close(fd);
+
+    // Needs are not part of the protocol, so they are read from the snapshot the server just loaded
+    ProgramSnapshotReader snapshot(snapshotPath);
+    ResourceMatrix needMatrix(snapshot.getMaximumMatrix());
+    for (size_t pid = 0; pid < needMatrix.rows(); pid++) {
+        for (size_t resource = 0; resource < needMatrix.cols(); resource++) {
+            needMatrix(pid, resource) -= snapshot.getAllocationMatrix()(pid, resource);
+        }
+    }
+    cout << "Loaded " << snapshotPath << " as " << name << ": " << numProcesses << " processes, " << numResources << " resources" << endl;
+
+    vector<LoadStatistics> statistics(connections);
+    vector<std::thread> threads;
+    const auto start = Clock::now();
+    for (size_t c = 0; c < connections; c++) {
+        threads.emplace_back([&, c] {
+            generateLoad(socketPath, handle, needMatrix, c, connections, requests / connections, pipeline, 42 + c, statistics[c]);
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    LoadStatistics total;
+    for (auto& connection: statistics) {
+        for (size_t s = 0; s <= static_cast<size_t>(ResponseStatus::ERROR); s++) {
+            total.byStatus[s] += connection.byStatus[s];
+        }
+        total.microseconds.insert(total.microseconds.end(), connection.microseconds.begin(), connection.microseconds.end());
+        if (total.firstError.empty()) {
+            total.firstError = connection.firstError;
+        }
+    }
+    std::sort(total.microseconds.begin(), total.microseconds.end());
+    auto percentile = [&](double p) {
+        return total.microseconds.empty() ? 0.0 : total.microseconds[std::min(total.microseconds.size() - 1, static_cast<size_t>(p * total.microseconds.size()))];
+    };
+
+    cout << total.microseconds.size() << " messages over " << connections << " connections, pipeline " << pipeline << ", in "
+         << seconds << "s: " << static_cast<size_t>(total.microseconds.size() / seconds) << " messages/s" << endl;
+    cout << "latency p50 " << percentile(0.5) << "us, p99 " << percentile(0.99) << "us, max " << percentile(1.0) << "us" << endl;
+    for (size_t s = 0; s <= static_cast<size_t>(ResponseStatus::ERROR); s++) {
+        if (total.byStatus[s] > 0) {
+            cout << "  " << responseStatusName(static_cast<ResponseStatus>(s)) << ": " << total.byStatus[s] << endl;
+        }
+    }
+    if (!total.firstError.empty()) {
+        cout << "first error: " << total.firstError << endl;
+    }
+    return 0;
+}
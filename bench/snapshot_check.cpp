@@ -0,0 +1,157 @@
+// snapshot_check.cpp
+// Checks that binary snapshots written by writeBinarySnapshot read back unchanged, and that BinarySnapshotView rejects
+// corrupt images instead of handing out views past their end.
+// The corrupt cases cover a bad magic, a truncated image, a misaligned block, non-zero row padding, and headers whose row
+// size in bytes wraps around 64 bits.
+// Exits with status 1 if any check fails.
+// Usage: snapshot_check.out
+#include "../BinarySnapshot.hpp"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <functional>
+#include <unistd.h>
+
+using std::cout, std::endl, std::vector, std::string;
+
+using ImageBuffer = vector<char, AlignedAllocator<char>>;
+
+// Image of a snapshot with the given dimensions, every count set from its position so rows differ
+ImageBuffer makeImage(size_t numProcesses, size_t numResources) {
+    const BinarySnapshotHeader header = makeBinarySnapshotHeader(numProcesses, numResources);
+    ImageBuffer image(header.fileSize, 0);
+    std::memcpy(image.data(), &header, sizeof(header));
+
+    auto fill = [&](uint64_t offset, size_t rows, size_t base) {
+        size_t* block = reinterpret_cast<size_t*>(image.data() + offset);
+        for (size_t row = 0; row < rows; row++) {
+            for (size_t col = 0; col < numResources; col++) {
+                block[row * header.stride + col] = base + row * numResources + col;
+            }
+        }
+    };
+    fill(header.availableOffset, 1, 1000);
+    fill(header.maximumOffset, numProcesses, 2000);
+    fill(header.allocationOffset, numProcesses, 0);
+    return image;
+}
+
+BinarySnapshotHeader& headerOf(ImageBuffer& image) {
+    return *reinterpret_cast<BinarySnapshotHeader*>(image.data());
+}
+
+// Returns true if BinarySnapshotView refuses the image
+bool rejects(const ImageBuffer& image, size_t imageSize) {
+    try {
+        BinarySnapshotView view(image.data(), imageSize, "snapshot_check");
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    size_t failures = 0;
+    auto check = [&](const string& name, bool passed) {
+        cout << (passed ? "ok      " : "FAILED  ") << name << endl;
+        failures += passed ? 0 : 1;
+    };
+
+    // Round trip through a file, with a matrix whose stride does not match the file so rows get re-padded
+    {
+        const size_t numProcesses = 5;
+        const size_t numResources = 3;
+        vector<size_t> available = {3, 3, 2};
+        ResourceMatrix maximum(numProcesses, numResources);
+        ResourceMatrix allocation(numProcesses, numResources);
+        for (size_t row = 0; row < numProcesses; row++) {
+            for (size_t col = 0; col < numResources; col++) {
+                maximum(row, col) = 2 * row + col + 1;
+                allocation(row, col) = row + col;
+            }
+        }
+
+        const auto file = std::filesystem::temp_directory_path() / ("bankers-snapshot-check-" + std::to_string(getpid()) + ".bin");
+        writeBinarySnapshot(file.string(), available, maximum.view(), allocation.view());
+        bool same = false;
+        {
+            MappedSnapshot mapped(file.string());
+            const ResourceMatrixView readMaximum = mapped.getMaximumMatrix();
+            const ResourceMatrixView readAllocation = mapped.getAllocationMatrix();
+            same = std::equal(available.begin(), available.end(), mapped.getAvailableResources().begin(), mapped.getAvailableResources().end()) &&
+                   readMaximum.rows() == numProcesses && readMaximum.cols() == numResources && readAllocation.rows() == numProcesses;
+            for (size_t row = 0; same && row < numProcesses; row++) {
+                for (size_t col = 0; col < numResources; col++) {
+                    same = same && readMaximum(row, col) == maximum(row, col) && readAllocation(row, col) == allocation(row, col);
+                }
+            }
+        }
+        std::filesystem::remove(file);
+        check("written snapshot reads back unchanged", same);
+    }
+
+    // Images that are valid
+    {
+        ImageBuffer image = makeImage(4, 11);
+        check("valid image is accepted", !rejects(image, image.size()));
+    }
+    {
+        ImageBuffer image = makeImage(0, 3);
+        check("image with no processes is accepted", !rejects(image, image.size()));
+    }
+
+    // Corrupt images, each made from a valid one by a single change
+    const vector<std::pair<string, std::function<size_t(ImageBuffer&)>>> corruptions = {
+        {"bad magic", [](ImageBuffer& image) {
+            image[0] = 'X';
+            return image.size();
+        }},
+        {"truncated image", [](ImageBuffer& image) {
+            return image.size() - sizeof(size_t);
+        }},
+        {"image shorter than the header", [](ImageBuffer&) {
+            return sizeof(BinarySnapshotHeader) - 1;
+        }},
+        {"misaligned block", [](ImageBuffer& image) {
+            headerOf(image).maximumOffset += sizeof(size_t);
+            return image.size();
+        }},
+        {"stride not matching numResources", [](ImageBuffer& image) {
+            headerOf(image).stride += RESOURCE_MATRIX_ALIGNMENT / sizeof(size_t);
+            return image.size();
+        }},
+        {"non-zero row padding", [](ImageBuffer& image) {
+            const BinarySnapshotHeader& header = headerOf(image);
+            reinterpret_cast<size_t*>(image.data() + header.allocationOffset)[header.stride - 1] = 1;
+            return image.size();
+        }},
+        {"row size wrapping to zero with no processes", [](ImageBuffer& image) {
+            headerOf(image).numProcesses = 0;
+            headerOf(image).numResources = headerOf(image).stride = uint64_t(1) << 61;
+            return image.size();
+        }},
+        {"row size wrapping to zero with one process", [](ImageBuffer& image) {
+            headerOf(image).numProcesses = 1;
+            headerOf(image).numResources = headerOf(image).stride = uint64_t(1) << 61;
+            return image.size();
+        }},
+        {"matrix size wrapping around", [](ImageBuffer& image) {
+            headerOf(image).numProcesses = (uint64_t(1) << 58) + 1;
+            return image.size();
+        }},
+    };
+    for (const auto& [name, corrupt]: corruptions) {
+        ImageBuffer image = makeImage(4, 11);
+        const size_t imageSize = corrupt(image);
+        check(name + " is rejected", rejects(image, imageSize));
+    }
+
+    if (failures > 0) {
+        cout << "FAILED: " << failures << " snapshot checks" << endl;
+        return 1;
+    }
+    cout << "All snapshot checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,160 @@
+// transport_bench.cpp
+// Times sending a stream of snapshots from a parent process to a forked child with every transport
+// Between rounds a few allocations change, one process leaves and another arrives, as in consecutive snapshots of one system.
+// The child adds up every number it received and sends the sum back, so each round covers the whole transfer
+// Usage: transport_bench.out [processes] [resources] [rounds] [changed cells per round]
+#include "../PipeTransport.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <sys/wait.h>
+
+using std::cout, std::endl;
+
+// Sum of every number of a snapshot, compared between parent and child
+uint64_t snapshotChecksum(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+    uint64_t sum = 0;
+    for (auto value: availableVector) {
+        sum += value;
+    }
+    for (size_t r = 0; r < maxMatrix.rows(); r++) {
+        for (auto value: maxMatrix.row(r)) {
+            sum += value;
+        }
+        for (auto value: allocationMatrix.row(r)) {
+            sum = sum * 3 + value;
+        }
+    }
+    return sum;
+}
+
+// Median time and mean bytes written per round of sending the snapshot to a child over transport
+struct TransportTimes {
+    double milliseconds;
+    double bytesPerRound;
+};
+
+// Change a few allocations, replace one process by a new one at the bottom, and keep the available vector in step
+void evolveSnapshot(std::mt19937_64& random, size_t changedCells, vector<size_t>& availableVector,
+                    ResourceMatrix& maxMatrix, ResourceMatrix& allocationMatrix) {
+    const size_t numProcesses = maxMatrix.rows();
+    const size_t numResources = maxMatrix.cols();
+    std::uniform_int_distribution<size_t> pickRow(0, numProcesses - 1);
+    std::uniform_int_distribution<size_t> pickColumn(0, numResources - 1);
+    std::uniform_int_distribution<size_t> distribution(0, 1000);
+
+    for (size_t k = 0; k < changedCells; k++) {
+        const size_t r = pickRow(random);
+        const size_t c = pickColumn(random);
+        allocationMatrix(r, c) = distribution(random) % (maxMatrix(r, c) + 1);
+        availableVector[c] = distribution(random);
+    }
+
+    const size_t leaving[] = {pickRow(random)};
+    maxMatrix.removeRows(leaving);
+    allocationMatrix.removeRows(leaving);
+    vector<size_t> maxRow(numResources), allocationRow(numResources);
+    for (size_t c = 0; c < numResources; c++) {
+        allocationRow[c] = distribution(random);
+        maxRow[c] = allocationRow[c] + distribution(random);
+    }
+    maxMatrix.appendRow(maxRow);
+    allocationMatrix.appendRow(allocationRow);
+}
+
+TransportTimes benchTransport(Transport kind, size_t rounds, size_t changedCells, vector<size_t> availableVector,
+                              ResourceMatrix maxMatrix, ResourceMatrix allocationMatrix) {
+    int childToParentFD[2], parentToChildFD[2];
+    if (pipe(childToParentFD) == -1 || pipe(parentToChildFD) == -1) {
+        throw std::runtime_error("Pipe Creation Failed");
+    }
+    SnapshotTransport transport(kind);
+
+    const pid_t cpid = fork();
+    if (cpid == -1) {
+        throw std::runtime_error("Fork Failed");
+    }
+
+    if (cpid == 0) {
+        close(childToParentFD[READ_END]);
+        close(parentToChildFD[WRITE_END]);
+        ReceivedSnapshot snapshot;
+        for (size_t round = 0; round < rounds; round++) {
+            transport.receive(parentToChildFD, snapshot);
+            const uint64_t sum = snapshotChecksum(snapshot.getAvailableResources(), snapshot.getMaximumMatrix(), snapshot.getAllocationMatrix());
+            writeFull(childToParentFD[WRITE_END], &sum, sizeof(sum), "Checksum");
+        }
+        _exit(0);
+    }
+
+    close(childToParentFD[WRITE_END]);
+    close(parentToChildFD[READ_END]);
+
+    std::mt19937_64 random(7);
+    vector<double> milliseconds;
+    const uint64_t bytesBefore = Stats::process().report()[Stat::PIPE_BYTES_WRITTEN];
+    for (size_t round = 0; round < rounds; round++) {
+        if (round > 0) {
+            evolveSnapshot(random, changedCells, availableVector, maxMatrix, allocationMatrix);
+        }
+        const uint64_t expected = snapshotChecksum(availableVector, maxMatrix, allocationMatrix);
+
+        const auto start = std::chrono::steady_clock::now();
+        transport.send(parentToChildFD, availableVector, maxMatrix, allocationMatrix);
+        uint64_t sum;
+        readFull(childToParentFD[READ_END], &sum, sizeof(sum), "Checksum");
+        milliseconds.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        if (sum != expected) {
+            throw std::runtime_error(string("Child received a different snapshot over the ") + transportName(kind) + " transport");
+        }
+    }
+
+    close(parentToChildFD[WRITE_END]);
+    close(childToParentFD[READ_END]);
+    waitpid(cpid, nullptr, 0);
+
+    const uint64_t bytesWritten = Stats::process().report()[Stat::PIPE_BYTES_WRITTEN] - bytesBefore;
+    std::sort(milliseconds.begin(), milliseconds.end());
+    return {milliseconds[milliseconds.size() / 2], static_cast<double>(bytesWritten) / rounds};
+}
+
+int main(int argc, char *argv[]) {
+    const size_t numProcesses = (argc > 1) ? std::stoul(argv[1]) : 10000;
+    const size_t numResources = (argc > 2) ? std::stoul(argv[2]) : 100;
+    const size_t rounds = (argc > 3) ? std::stoul(argv[3]) : 5;
+    const size_t changedCells = (argc > 4) ? std::stoul(argv[4]) : 10;
+
+    std::mt19937_64 random(42);
+    std::uniform_int_distribution<size_t> distribution(0, 1000);
+
+    vector<size_t> availableVector(numResources);
+    ResourceMatrix maxMatrix(numProcesses, numResources);
+    ResourceMatrix allocationMatrix(numProcesses, numResources);
+    for (auto& value: availableVector) {
+        value = distribution(random);
+    }
+    for (size_t r = 0; r < numProcesses; r++) {
+        for (size_t c = 0; c < numResources; c++) {
+            allocationMatrix(r, c) = distribution(random);
+            maxMatrix(r, c) = allocationMatrix(r, c) + distribution(random);
+        }
+    }
+
+    const double megabytes = 2.0 * numProcesses * numResources * sizeof(size_t) / 1e6;
+    cout << numProcesses << " processes x " << numResources << " resources, " << megabytes << " MB of matrices, "
+         << rounds << " rounds, " << changedCells << " changed cells per round" << endl;
+
+    for (Transport kind: {Transport::ELEMENT, Transport::FRAMED, Transport::SHARED_MEMORY, Transport::DELTA}) {
+        const TransportTimes times = benchTransport(kind, rounds, changedCells, availableVector, maxMatrix, allocationMatrix);
+        cout << std::left << std::setw(8) << transportName(kind) << std::right << std::fixed << std::setprecision(3)
+             << std::setw(12) << times.milliseconds << " ms" << std::setw(12) << megabytes / (times.milliseconds / 1000) << " MB/s"
+             << std::setw(14) << times.bytesPerRound / 1e3 << " KB/round" << endl;
+        cout.unsetf(std::ios::fixed);
+    }
+
+    return 0;
+}
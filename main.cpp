@@ -1,269 +1,855 @@
 // main.cpp
 #include "BankerAlgorithm.hpp"
+#include "SparseSafety.hpp"
+#include "SnapshotDecomposition.hpp"
 #include "ProgramSnapshotReader.hpp"
+#include "ThreadPool.hpp"
+#include "PipeTransport.hpp"
+#include "SolverWorkerPool.hpp"
+#include "BankerServer.hpp"
+#include "Stats.hpp"
+#include "SafeSequenceEnumerator.hpp"
+#include "WorkloadSimulator.hpp"
+#include "SnapshotGenerator.hpp"
+#include "SnapshotArena.hpp"
+#include "ResultCache.hpp"
+#include "FixedBankerAlgorithm.hpp"
 
 #include <string>
 #include <cstring>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <glob.h>
 #include <vector>
-
-#define READ_END 0
-#define WRITE_END 1
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <optional>
+#include <fstream>
 
 // Forking can be disabled to allow for easier debugging
 #define ENABLE_FORKING true
 
 using std::string, std::cout, std::endl;
 
-// Send ProgramSnapshotReader Object over Pipe
-void sendObjectOverPipe(int fd[2], ProgramSnapshotReader& obj) {
-    std::vector<size_t> availableVector = obj.getAvailableResources();
-    std::vector<std::vector<size_t>> maximumMatrix = obj.getMaximumMatrix();
-    std::vector<std::vector<size_t>> allocationMatrix = obj.getAllocationMatrix();
+// Formats a vector into an ordered list of numbers and returns string
+// Ex: (1, 2, 3, 4, 5)
+string vectorToString (const vector<size_t>& input) {
+    string out = "(";
+    for (auto i = 0; i < input.size(); i++) {
+        out += std::to_string(input[i]);
+        if (i < input.size() - 1) {
+            out += ", ";
+        }
+    }
+    out += ")";
 
-    size_t row_counter = 0;
-    size_t col_counter = 0;
+    return out;
+}
 
-    // Send Available Resources Vector
-    // First, send the size of the vector
-    size_t size_availableVector = availableVector.size();
-    if (write(fd[WRITE_END], &size_availableVector, sizeof(size_availableVector)) != sizeof(size_availableVector)) {
-        throw std::runtime_error("availableVector size write to pipe failed.");
+// Options selected by the executable arguments
+struct ProgramOptions {
+    string file_name;
+    SafetyEngine engine = SafetyEngine::SCAN;
+    SequenceOrder order = SequenceOrder::FIFO;
+
+    // How the parent process sends the snapshot to the child
+    Transport transport = Transport::FRAMED;
+
+    // Batch mode analyzes every snapshot named by batch_source on a pool of threads (0 means one per core)
+    string batch_source;
+    size_t threads = 0;
+
+    // With a number of processes, batch mode analyzes the snapshots on that many pre-forked solver processes instead
+    size_t processes = 0;
+
+    // Server mode answers requests on this Unix socket, see BankerServer.hpp
+    string serve_socket;
+
+    // Convert mode rewrites file_name into convert_output, text to binary or binary to text
+    // With convert_sparse the output uses the sparse formats of SparseSnapshot.hpp
+    string convert_output;
+    bool convert_sparse = false;
+
+    // Print the counters of Stats.hpp as JSON once done, including those of the child process
+    bool stats = false;
+
+    // Count every safe sequence of file_name, or list up to list_sequences of them (0 means all), see SafeSequenceEnumerator.hpp
+    bool count_sequences = false;
+    bool list_sequences = false;
+    size_t list_limit = 0;
+    // Limits of counting and listing, 0 means unlimited
+    size_t max_memory_mb = 0;
+    size_t time_limit_ms = 0;
+
+    // Print the largest request of each resource type each process of file_name can be granted while the state stays safe
+    bool max_request = false;
+
+    // Check the independent components of file_name separately on options.threads threads, see SnapshotDecomposition.hpp
+    bool decompose = false;
+
+    // Simulate workload.decisions requests against the state of file_name, or of a snapshot generated with generate_size
+    // (processes x resources), see WorkloadSimulator.hpp. The events are written to record_trace, or replayed from replay_trace.
+    bool simulate = false;
+    WorkloadConfig workload;
+    string generate_size;
+    string record_trace;
+    string replay_trace;
+
+    // Keep safety reports in cache_directory, so snapshots checked by an earlier run are not checked again, see ResultCache.hpp
+    // Batch mode also keeps them in memory for the length of the batch, with or without a directory.
+    string cache_directory;
+};
+
+// Returns the value following the option at argv[index], moving index onto it
+string optionValue(int argc, char *argv[], int& index) {
+    if (index + 1 >= argc) {
+        throw std::runtime_error(string("Missing value for option ") + argv[index]);
     }
-    // Next, send each value of the vector
-    for (auto value: availableVector) {
-        if (write(fd[WRITE_END], &value, sizeof(value)) != sizeof(value)) {
-            throw std::runtime_error("availableVector write to pipe failed.");
+    index++;
+    return argv[index];
+}
+
+// Extract the file name and options from executable arguments
+// Usage: bankers.out [file] [--engine scan|worklist|parallel|sparse] [--any-order] [--transport element|framed|shm|delta]
+//                    [--batch directory|glob|manifest] [--threads N] [--processes N] [--convert output [--sparse]] [--serve socket] [--stats]
+//                    [--count-sequences] [--list-sequences N] [--max-memory MB] [--time-limit ms] [--max-request] [--decompose]
+//                    [--simulate N] [--generate PxR] [--seed N] [--arrival-rate R] [--request-rate R] [--holding-shape A] [--hotspot F]
+//                    [--record trace] [--replay trace] [--cache directory]
+ProgramOptions parseArguments(int argc, char *argv[]) {
+    ProgramOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        const string argument = argv[i];
+
+        if (argument == "--engine") {
+            const string engine = optionValue(argc, argv, i);
+            if (engine == "scan") {
+                options.engine = SafetyEngine::SCAN;
+            } else if (engine == "worklist") {
+                options.engine = SafetyEngine::WORK_LIST;
+            } else if (engine == "parallel") {
+                options.engine = SafetyEngine::PARALLEL;
+            } else if (engine == "sparse") {
+                options.engine = SafetyEngine::SPARSE;
+            } else {
+                throw std::runtime_error("Unknown engine " + engine + ", expected scan, worklist, parallel or sparse");
+            }
+        } else if (argument == "--any-order") {
+            // Accept any safe sequence instead of the FIFO one, only the work list and parallel engines make use of it
+            options.order = SequenceOrder::ANY;
+        } else if (argument == "--transport") {
+            const string transport = optionValue(argc, argv, i);
+            if (transport == "element") {
+                options.transport = Transport::ELEMENT;
+            } else if (transport == "framed") {
+                options.transport = Transport::FRAMED;
+            } else if (transport == "shm") {
+                options.transport = Transport::SHARED_MEMORY;
+            } else if (transport == "delta") {
+                options.transport = Transport::DELTA;
+            } else {
+                throw std::runtime_error("Unknown transport " + transport + ", expected element, framed, shm or delta");
+            }
+        } else if (argument == "--batch") {
+            options.batch_source = optionValue(argc, argv, i);
+        } else if (argument == "--threads") {
+            options.threads = std::stoul(optionValue(argc, argv, i));
+        } else if (argument == "--processes") {
+            options.processes = std::stoul(optionValue(argc, argv, i));
+        } else if (argument == "--serve") {
+            options.serve_socket = optionValue(argc, argv, i);
+        } else if (argument == "--convert") {
+            options.convert_output = optionValue(argc, argv, i);
+        } else if (argument == "--sparse") {
+            options.convert_sparse = true;
+        } else if (argument == "--stats") {
+            options.stats = true;
+        } else if (argument == "--cache") {
+            options.cache_directory = optionValue(argc, argv, i);
+        } else if (argument == "--count-sequences") {
+            options.count_sequences = true;
+        } else if (argument == "--list-sequences") {
+            options.list_sequences = true;
+            options.list_limit = std::stoul(optionValue(argc, argv, i));
+        } else if (argument == "--max-memory") {
+            options.max_memory_mb = std::stoul(optionValue(argc, argv, i));
+        } else if (argument == "--time-limit") {
+            options.time_limit_ms = std::stoul(optionValue(argc, argv, i));
+        } else if (argument == "--max-request") {
+            options.max_request = true;
+        } else if (argument == "--decompose") {
+            options.decompose = true;
+        } else if (argument == "--simulate") {
+            options.simulate = true;
+            options.workload.decisions = std::stoul(optionValue(argc, argv, i));
+        } else if (argument == "--generate") {
+            options.generate_size = optionValue(argc, argv, i);
+        } else if (argument == "--seed") {
+            options.workload.seed = std::stoull(optionValue(argc, argv, i));
+        } else if (argument == "--arrival-rate") {
+            options.workload.arrivalRate = std::stod(optionValue(argc, argv, i));
+        } else if (argument == "--request-rate") {
+            options.workload.requestRate = std::stod(optionValue(argc, argv, i));
+        } else if (argument == "--holding-shape") {
+            options.workload.holdingShape = std::stod(optionValue(argc, argv, i));
+        } else if (argument == "--hotspot") {
+            options.workload.hotspotFraction = std::stod(optionValue(argc, argv, i));
+        } else if (argument == "--record") {
+            options.record_trace = optionValue(argc, argv, i);
+        } else if (argument == "--replay") {
+            options.simulate = true;
+            options.replay_trace = optionValue(argc, argv, i);
+        } else if (argument.starts_with("--")) {
+            throw std::runtime_error("Unknown option " + argument);
+        } else {
+            options.file_name = argument;
         }
     }
 
-    
-    // Send Maximum Matrix
-    // First, send the number of rows in the vector
-    size_t size_maximumMatrix = maximumMatrix.size();
-    if (write(fd[WRITE_END], &size_maximumMatrix, sizeof(size_maximumMatrix)) != sizeof(size_maximumMatrix)) {
-        throw std::runtime_error("maximumMatrix number of rows write to pipe failed.");
-    }
+    return options;
+}
 
-    for (auto row: maximumMatrix) {
-        // Next, send the size of the row
-        size_t row_size = row.size();
-        if (write(fd[WRITE_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
-            throw std::runtime_error(row_counter + "th row of Maximum Matrix size write to pipe failed.");
+// Collect the snapshot files named by a batch source, in the order their results are printed
+// The source is a directory (every regular file in it, sorted by name), a glob pattern, or a manifest file listing one path per line
+vector<string> collectSnapshotFiles(const string& source) {
+    vector<string> files;
+
+    if (std::filesystem::is_directory(source)) {
+        for (const auto& entry: std::filesystem::directory_iterator(source)) {
+            if (entry.is_regular_file()) {
+                files.push_back(entry.path().string());
+            }
         }
-        
-        // Finally, send the row's contents
-        col_counter = 0;
-        for (auto value: row) {
-            if(write(fd[WRITE_END], &value, sizeof(value)) != sizeof(value)) {
-                throw std::runtime_error(
-                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
-                    "th row of Maximum Matrix write to pipe failed.");
+        std::sort(files.begin(), files.end());
+    } else if (source.find_first_of("*?[") != string::npos) {
+        glob_t matches;
+        int status = glob(source.c_str(), 0, nullptr, &matches);
+        if (status == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                files.push_back(matches.gl_pathv[i]);
             }
-
-            col_counter++;
         }
-        row_counter++;
+        globfree(&matches);
+        if (status != 0 && status != GLOB_NOMATCH) {
+            throw std::runtime_error("Failed to expand glob pattern " + source);
+        }
+    } else if (std::filesystem::exists(source)) {
+        // Manifest, blank lines and lines starting with '#' are skipped
+        std::ifstream manifest(source);
+        string line;
+        while (getline(manifest, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                files.push_back(line);
+            }
+        }
+    } else {
+        throw std::runtime_error("Batch Source Not Found, " + source);
     }
 
+    return files;
+}
 
-    // Send Allocation Matrix
-    // First, send the number of rows in the vector
-    size_t size_allocationMatrix = allocationMatrix.size();
-    if (write(fd[WRITE_END], &size_allocationMatrix, sizeof(size_allocationMatrix)) != sizeof(size_allocationMatrix)) {
-        throw std::runtime_error("allocationMatrix number of rows write to pipe failed.");
+// Read the snapshot in the mapped file and return use(availableVector, maxMatrix, allocationMatrix)
+// Binary snapshots are used in place in the mapping without copying their matrices, text snapshots are parsed into
+// memory from resource, or from the global allocator when it is null
+template <typename Use>
+auto withSnapshotFile(const MappedFile& file, const string& file_name, Use use, std::pmr::memory_resource* resource = nullptr) {
+    if (hasBinarySnapshotMagic(file.text())) {
+        BinarySnapshotView snapshot(file.data(), file.size(), file_name);
+        return use(snapshot.getAvailableResources(), snapshot.getMaximumMatrix(), snapshot.getAllocationMatrix());
     }
 
-    for (auto row: allocationMatrix) {
-        // Next, send the size of the row
-        size_t row_size = row.size();
-        if (write(fd[WRITE_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
-            throw std::runtime_error(row_counter + "th row of Allocation Matrix size write to pipe failed.");
-        }
-        
-        // Finally, send the row's contents
-        col_counter = 0;
-        for (auto value: row) {
-            if(write(fd[WRITE_END], &value, sizeof(value)) != sizeof(value)) {
-                throw std::runtime_error(
-                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
-                    "th row of Allocation Matrix write to pipe failed.");
-            }
+    ProgramSnapshotReader reader(file, file_name, resource);
+    const auto& availableVector = reader.getAvailableResources();
+    const auto& maximumMatrix = reader.getMaximumMatrix();
+    const auto& allocationMatrix = reader.getAllocationMatrix();
+    return use(std::span<const size_t>(availableVector), maximumMatrix.view(), allocationMatrix.view());
+}
 
-            col_counter++;
+// Map file_name and return use(availableVector, maxMatrix, allocationMatrix) of the snapshot in it
+template <typename Use>
+auto withSnapshotFile(const string& file_name, Use use, std::pmr::memory_resource* resource = nullptr) {
+    const MappedFile file(file_name);
+    return withSnapshotFile(file, file_name, use, resource);
+}
+
+// Print the counters of this process, and those of the child that analyzed the snapshot if there was one, as JSON
+void printStats(const StatsReport* childStats = nullptr) {
+    cout << "{\"parent\": " << Stats::process().report().toJson();
+    if (childStats != nullptr) {
+        cout << ", \"child\": " << childStats->toJson();
+    }
+    cout << "}" << endl;
+}
+
+// Check a dense snapshot with the FixedBankerAlgorithm compiled in for its shape when there is one and the scan engine in
+// FIFO order is asked for, otherwise, and to diagnose a deadlock, with the sparse or a dense engine depending on its density
+SafetyReport checkDenseSnapshot(std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix,
+                                const ProgramOptions& options, std::pmr::memory_resource* resource = nullptr) {
+    if (options.engine == SafetyEngine::SCAN && options.order == SequenceOrder::FIFO) {
+        if (auto report = checkSafetyFixed(availableVector, maxMatrix, allocationMatrix)) {
+            return std::move(*report);
         }
-        row_counter++;
     }
+    return checkSafetyAuto(availableVector, maxMatrix, allocationMatrix, options.engine, options.order, resource);
+}
+
+// Analyze a snapshot file in this process, with the sparse or a dense engine depending on its density
+// Sparse snapshots are read without ever expanding them into dense matrices
+// Dense snapshots are read and checked in memory from resource when one is given, only the report is on the global heap
+SafetyReport checkSnapshotFile(const MappedFile& file, const string& file_name, const ProgramOptions& options,
+                               std::pmr::memory_resource* resource = nullptr) {
+    if (isSparseSnapshotContents(file.text())) {
+        SparseSnapshotReader reader(file.text(), file_name);
+        return checkSafetyAuto(reader.getSnapshot(), options.engine, options.order);
+    }
+    return withSnapshotFile(file, file_name, [&](std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+        return checkDenseSnapshot(availableVector, maxMatrix, allocationMatrix, options, resource);
+    }, resource);
+}
 
-    return;
+SafetyReport checkSnapshotFile(const string& file_name, const ProgramOptions& options, std::pmr::memory_resource* resource = nullptr) {
+    const MappedFile file(file_name);
+    return checkSnapshotFile(file, file_name, options, resource);
 }
 
-// Receive ProgramSnapshotReader Object from Pipe
-void receiveObjectOverPipe(int fd[2], ProgramSnapshotReader& obj) {
-    std::vector<size_t> availableVector;
-    std::vector<std::vector<size_t>> maximumMatrix;
-    std::vector<std::vector<size_t>> allocationMatrix;
-
-    // counters used for throwing errors
-    size_t row_counter = 0;
-    size_t col_counter = 0;
-
-    // Receive available resources vector
-    // First, receive the size of the vector
-    size_t size_availableVector;
-    if (read(fd[READ_END], &size_availableVector, sizeof(size_availableVector)) != sizeof(size_availableVector)) {
-        throw std::runtime_error("availableVector size read from pipe failed.");
-    }
-    availableVector = vector<size_t>(size_availableVector, 0);
-    // Next, receive each value of the vector
-    for (auto &value: availableVector) {
-        if (read(fd[READ_END], &value, sizeof(value)) != sizeof(value)) {
-            throw std::runtime_error("availableVector read from pipe failed.");
-        }
-    }
-
-    // Receive Maximum Matrix
-    // First, receive the number of rows in the vector
-    size_t size_maximumMatrix;
-    if (read(fd[READ_END], &size_maximumMatrix, sizeof(size_maximumMatrix)) != sizeof(size_maximumMatrix)) {
-        throw std::runtime_error("maximumMatrix number of rows read from pipe failed.");
-    }
-    maximumMatrix = std::vector<std::vector<size_t>>(size_maximumMatrix);
-
-    for (auto& row: maximumMatrix) {
-        // Next, receive the size of the row
-        size_t row_size;
-        if (read(fd[READ_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
-            throw std::runtime_error(std::to_string(row_counter) + "th row of Maximum Matrix size read from pipe failed.");
-        }
-        row = std::vector<size_t>(row_size, 0);
-
-        // Finally, receive the row's contents
-        col_counter = 0;
-        for (auto& value: row) {
-            if(read(fd[READ_END], &value, sizeof(value)) != sizeof(value)) {
-                throw std::runtime_error(
-                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
-                    "th row of Maximum Matrix read from pipe failed.");
+// Analyze a snapshot file in this process unless its report is in cache
+// The bytes of the file are looked up first, so a file checked before is not parsed at all. Dense snapshots are then looked
+// up by their matrices, which finds the same snapshot saved in another format or spacing, and only a miss is checked.
+// The file is mapped once, and a miss is read from the mapping its bytes were hashed from.
+SafetyReport checkSnapshotFileCached(const string& file_name, const ProgramOptions& options, ResultCache& cache,
+                                     std::pmr::memory_resource* resource = nullptr) {
+    const MappedFile file(file_name);
+    const SnapshotKey fileKey = hashSnapshotBytes(file.text(), cache.stamp());
+    if (auto cached = cache.find(fileKey)) {
+        return std::move(*cached);
+    }
+
+    SafetyReport report;
+    if (isSparseSnapshotContents(file.text())) {
+        report = checkSnapshotFile(file, file_name, options, resource);
+    } else {
+        report = withSnapshotFile(file, file_name, [&](std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+            const SnapshotKey matrixKey = hashSnapshotMatrices(availableVector, maxMatrix, allocationMatrix, cache.stamp());
+            if (auto cached = cache.find(matrixKey)) {
+                return std::move(*cached);
             }
+            SafetyReport checked = checkDenseSnapshot(availableVector, maxMatrix, allocationMatrix, options, resource);
+            cache.insert(matrixKey, checked);
+            return checked;
+        }, resource);
+    }
+    cache.insert(fileKey, report);
+    return report;
+}
+
+// Analyze a snapshot file in this process, through cache when there is one
+SafetyReport solveSnapshotFile(const string& file_name, const ProgramOptions& options, ResultCache* cache = nullptr,
+                               std::pmr::memory_resource* resource = nullptr) {
+    return cache != nullptr ? checkSnapshotFileCached(file_name, options, *cache, resource)
+                            : checkSnapshotFile(file_name, options, resource);
+}
 
-            col_counter++;
+// What the parent sends the child ahead of the snapshot
+// CACHED means the parent found the report in the result cache once it had read the snapshot, and sends nothing more
+enum class SnapshotLayout : uint64_t {
+    DENSE,
+    SPARSE,
+    CACHED
+};
+
+// Print the blocked processes of an unsafe safety report and which of them to preempt first
+void printDeadlockDiagnosis(const SafetyReport& report) {
+    cout << "Finished before the deadlock: " << vectorToString(report.sequence) << endl;
+    cout << "Blocked processes, with the units of the resource types they are short of:" << endl;
+    for (const auto& blocked: report.blocked) {
+        cout << "P" << blocked.process;
+        for (const auto& shortfall: blocked.shortfall) {
+            cout << " R" << shortfall.resource << ":" << shortfall.units;
         }
-        row_counter++;
+        cout << "\n";
     }
+    if (report.preemption.empty()) {
+        cout << "Preempting any single blocked process unblocks no other" << endl;
+        return;
+    }
+    cout << "Preempt first, with the number of other blocked processes that could then finish:" << endl;
+    for (const auto& candidate: report.preemption) {
+        cout << "P" << candidate.process << " " << candidate.unblocked << "\n";
+    }
+    cout.flush();
+}
 
+// Print the safe sequence or deadlock diagnosis the parent process received
+void printReceivedReport(const SafetyReport& report) {
+    if (report.safe) {
+        cout << "Parent Process Received: " << vectorToString(report.sequence) << endl;
+    } else {
+        cout << "Parent Process Received: Oops! Looks like we're stuck in a deadlock!" << endl;
+        printDeadlockDiagnosis(report);
+    }
+}
+
+// Convert a snapshot to the other format, a text snapshot to binary or a binary snapshot to text
+// With sparse, the output is written in the sparse text or binary format
+void convertSnapshot(const string& input, const string& output, bool sparse) {
+    const MappedFile file(input);
+    const bool binaryInput = hasBinarySnapshotMagic(file.text()) || hasSparseBinarySnapshotMagic(file.text());
+    if (sparse) {
+        SparseSnapshot snapshot;
+        if (isSparseSnapshotContents(file.text())) {
+            snapshot = SparseSnapshotReader(file.text(), input).takeSnapshot();
+        } else {
+            ProgramSnapshotReader reader(file, input);
+            snapshot = SparseSnapshot{reader.takeAvailableResources(), SparseResourceMatrix(reader.getMaximumMatrix().view()),
+                                      SparseResourceMatrix(reader.getAllocationMatrix().view())};
+        }
+        if (binaryInput) {
+            writeSparseTextSnapshot(output, snapshot);
+            cout << "Converted binary snapshot " << input << " to sparse text snapshot " << output << endl;
+        } else {
+            writeSparseBinarySnapshot(output, snapshot);
+            cout << "Converted text snapshot " << input << " to sparse binary snapshot " << output << endl;
+        }
+        return;
+    }
+
+    ProgramSnapshotReader reader(file, input);
+    const auto& availableVector = reader.getAvailableResources();
+    const auto& maximumMatrix = reader.getMaximumMatrix();
+    const auto& allocationMatrix = reader.getAllocationMatrix();
 
-    // Receive Allocation Matrix
-    // First, receive the number of rows in the vector
-    size_t size_allocationMatrix;
-    if (read(fd[READ_END], &size_allocationMatrix, sizeof(size_allocationMatrix)) != sizeof(size_allocationMatrix)) {
-        throw std::runtime_error("allocationMatrix number of rows read from pipe failed.");
+    if (binaryInput) {
+        writeTextSnapshot(output, availableVector, maximumMatrix, allocationMatrix);
+        cout << "Converted binary snapshot " << input << " to text snapshot " << output << endl;
+    } else {
+        writeBinarySnapshot(output, availableVector, maximumMatrix, allocationMatrix);
+        cout << "Converted text snapshot " << input << " to binary snapshot " << output << endl;
     }
-    allocationMatrix = std::vector<std::vector<size_t>>(size_allocationMatrix);
+}
 
-    for (auto& row: allocationMatrix) {
-        // Next, receive the size of the row
-        size_t row_size;
-        if (read(fd[READ_END], &row_size, sizeof(row_size)) != sizeof(row_size)) {
-            throw std::runtime_error(std::to_string(row_counter) + "th row of Allocation Matrix size read from pipe failed.");
+// Count or list the safe sequences of a snapshot in this process, counting on a pool of options.threads threads
+void enumerateSequences(const string& file_name, const ProgramOptions& options) {
+    EnumerationLimits limits;
+    limits.maxMemoryBytes = options.max_memory_mb * 1024 * 1024;
+    limits.timeLimit = std::chrono::milliseconds(options.time_limit_ms);
+    limits.maxSequences = options.list_limit;
+
+    withSnapshotFile(file_name, [&](std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+        SafeSequenceEnumerator enumerator(availableVector, maxMatrix, allocationMatrix, limits);
+
+        if (options.list_sequences) {
+            size_t listed = 0;
+            vector<size_t> sequence;
+            const EnumerationStatus status = enumerator.forEach([&](std::span<const size_t> order) {
+                sequence.assign(order.begin(), order.end());
+                cout << vectorToString(sequence) << "\n";
+                listed++;
+                return true;
+            });
+            cout << "Listed " << listed << " safe sequences";
+            if (status != EnumerationStatus::COMPLETE) {
+                cout << ", " << enumerationStatusName(status);
+            }
+            cout << endl;
         }
-        row = std::vector<size_t>(row_size, 0);
 
-        // Finally, receive the row's contents
-        col_counter = 0;
-        for (auto& value: row) {
-            if(read(fd[READ_END], &value, sizeof(value)) != sizeof(value)) {
-                throw std::runtime_error(
-                    std::to_string(col_counter) + "th element of " + std::to_string(row_counter) + 
-                    "th row of Allocation Matrix read from pipe failed.");
+        if (options.count_sequences) {
+            ThreadPool pool(options.threads);
+            const SequenceCountResult result = enumerator.count(&pool);
+            cout << "Safe sequences: " << (result.status != EnumerationStatus::COMPLETE ? "at least " : "")
+                 << sequenceCountToString(result.count) << (result.saturated ? " (saturated)" : "") << endl;
+            cout << "Explored " << result.statesVisited << " states, memoized " << result.statesMemoized << " on " << pool.size() << " threads";
+            if (result.status != EnumerationStatus::COMPLETE) {
+                cout << ", " << enumerationStatusName(result.status);
             }
+            cout << endl;
+        }
+    });
+}
 
-            col_counter++;
+// Print the table of BankerAlgorithm::maximumGrantableRequests for a snapshot, computed on a pool of options.threads threads
+void printMaximumRequests(const string& file_name, const ProgramOptions& options) {
+    withSnapshotFile(file_name, [&](std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+        BankerAlgorithm bankers(availableVector, maxMatrix, allocationMatrix);
+        ThreadPool pool(options.threads);
+        bankers.useThreadPool(pool);
+
+        if (bankers.findSafeSequence().empty()) {
+            cout << "The snapshot is unsafe, no request can be granted" << endl;
+            return;
         }
-        row_counter++;
-    }
+        const ResourceMatrix grantable = bankers.maximumGrantableRequests();
+        cout << "Largest request each process can be granted on its own:" << endl;
+        vector<size_t> row;
+        for (size_t i = 0; i < grantable.rows(); i++) {
+            row.assign(grantable.row(i).begin(), grantable.row(i).end());
+            cout << "P" << i << " " << vectorToString(row) << "\n";
+        }
+        cout.flush();
+    });
+}
 
-    // Set the passed object's value to the ones read from fd
-    obj.setAvailableResources(availableVector);
-    obj.setMaximumMatrix(maximumMatrix);
-    obj.setallocationMatrix(allocationMatrix);
+// Check a snapshot one independent component at a time and print the result of each, then the merged result
+void checkDecomposed(const string& file_name, const ProgramOptions& options) {
+    withSnapshotFile(file_name, [&](std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+        ThreadPool pool(options.threads);
+        const DecomposedSafetyReport result = checkSafetyDecomposed(availableVector, maxMatrix, allocationMatrix, options.engine, options.order, pool);
+
+        cout << "Found " << result.components.size() << " independent components" << endl;
+        vector<size_t> deadlocked;
+        for (size_t id = 0; id < result.components.size(); id++) {
+            const ComponentReport& component = result.components[id];
+            cout << "Component " << id << ": " << component.component.processes.size() << " processes, "
+                 << component.component.resources.size() << " resource types, " << (component.report.safe ? "safe" : "deadlocked") << endl;
+            if (!component.report.safe) {
+                printDeadlockDiagnosis(component.report);
+                deadlocked.push_back(id);
+            }
+        }
 
-    return;
+        if (result.merged.safe) {
+            cout << "Safe sequence: " << vectorToString(result.merged.sequence) << endl;
+        } else {
+            cout << "Oops! Looks like we're stuck in a deadlock! Deadlocked components: " << vectorToString(deadlocked) << endl;
+        }
+    });
+}
+
+// Print the latency percentiles of one kind of request decision
+void printLatencies(const string& label, const vector<uint64_t>& sorted) {
+    if (sorted.empty()) {
+        return;
+    }
+    cout << label << " latency p50 " << WorkloadReport::percentile(sorted, 0.5) << "ns, p90 " << WorkloadReport::percentile(sorted, 0.9)
+         << "ns, p99 " << WorkloadReport::percentile(sorted, 0.99) << "ns, p99.9 " << WorkloadReport::percentile(sorted, 0.999)
+         << "ns, max " << WorkloadReport::percentile(sorted, 1.0) << "ns" << endl;
 }
 
-// Send String over Pipe
-void sendStringOverPipe(int fd[2], const string& message) {
-    const char* msg = message.c_str();
+// Run a generated or replayed workload against a BankerEngine and print its throughput, denials and decision latencies
+void runSimulation(const string& file_name, const ProgramOptions& options) {
+    std::optional<BankerEngine> engine;
+    if (!options.generate_size.empty()) {
+        const size_t separator = options.generate_size.find('x');
+        if (separator == string::npos) {
+            throw std::runtime_error("Generated sizes are given as processes x resources, such as 2000x50, not " + options.generate_size);
+        }
+        SnapshotGenerator generator(options.workload.seed);
+        GeneratedSnapshot snapshot = generator.generate(std::stoul(options.generate_size.substr(0, separator)),
+                                                        std::stoul(options.generate_size.substr(separator + 1)), SnapshotShape::SAFE);
+        engine.emplace(std::move(snapshot.availableVector), std::move(snapshot.maxMatrix), std::move(snapshot.allocationMatrix));
+        cout << "Starting from a generated " << options.generate_size << " snapshot" << endl;
+    } else {
+        ProgramSnapshotReader reader(file_name);
+        engine.emplace(reader.takeAvailableResources(), reader.takeMaximumMatrix(), reader.takeAllocationMatrix());
+        cout << "Starting from " << file_name << endl;
+    }
 
-    // First, send length of string to pipe
-    size_t msglen = strlen(msg) + 1;
-    if (write(fd[WRITE_END], &msglen, sizeof(msglen)) != sizeof(msglen)) {
-        throw std::runtime_error("String length write to pipe failed.");
+    WorkloadSimulator simulator(*engine);
+    WorkloadReport report;
+    if (!options.replay_trace.empty()) {
+        std::ifstream trace(options.replay_trace);
+        if (!trace) {
+            throw std::runtime_error("Workload Trace Not Found, " + options.replay_trace);
+        }
+        report = simulator.replay(trace);
+    } else if (!options.record_trace.empty()) {
+        std::ofstream trace(options.record_trace);
+        if (!trace) {
+            throw std::runtime_error("Failed to create workload trace " + options.record_trace);
+        }
+        trace << "# time_us event pid amounts, recorded with seed " << options.workload.seed << "\n";
+        report = simulator.run(options.workload, &trace);
+    } else {
+        report = simulator.run(options.workload);
     }
 
-    // Next, send the string's raw value
-    if (write(fd[WRITE_END], msg, msglen) != msglen){
-        throw std::runtime_error("String write to pipe failed.");
+    const double wallSeconds = report.wallNanoseconds / 1e9;
+    cout << "Decided " << report.requests << " requests over " << report.simulatedMicroseconds / 1e6 << "s of simulated time in "
+         << wallSeconds << "s" << endl;
+    cout << "Granted " << report.count(RequestStatus::GRANTED) << " (" << static_cast<size_t>(report.grantsPerSecond()) << " grants/s), "
+         << requestStatusName(RequestStatus::MUST_WAIT) << " " << report.count(RequestStatus::MUST_WAIT) << ", "
+         << requestStatusName(RequestStatus::UNSAFE) << " " << report.count(RequestStatus::UNSAFE) << ", denial rate "
+         << 100.0 * report.denialRate() << "%" << endl;
+    printLatencies("Decision", report.decisionNanoseconds);
+    for (auto status: {RequestStatus::GRANTED, RequestStatus::MUST_WAIT, RequestStatus::UNSAFE}) {
+        printLatencies(string("  ") + requestStatusName(status), report.statusNanoseconds[static_cast<size_t>(status)]);
     }
+    cout << "Full safety checks " << report.safetyChecks << ", " << report.safetyNanoseconds / 1e6 << "ms in findSafeSequence, "
+         << report.decisionTotalNanoseconds() / 1e6 << "ms deciding requests, " << report.wallNanoseconds / 1e6 << "ms in total" << endl;
+    cout << "Processes: " << report.arrivals << " arrived, " << report.turnedAway << " turned away, " << report.departures
+         << " departed, " << report.activeAtEnd << " active at the end" << endl;
 }
 
-// Receive String from Pipe
-string receiveStringOverPipe(int fd[2]) {
-    // First, receive length of string from pipe
-    size_t msglen;
-    if (read(fd[READ_END], &msglen, sizeof(msglen)) != sizeof(msglen)) {
-        throw std::runtime_error("String length read from pipe failed.");
+// Result of analyzing one snapshot in batch mode
+struct BatchResult {
+    string verdict;
+    string sequence;
+    double microseconds = 0;
+    bool done = false;
+};
+
+// Append how many lookups of a batch the result cache answered
+void printCacheHits(const ResultCache& cache) {
+    if (cache.hitCount() > 0) {
+        cout << ", " << cache.hitCount() << " result cache hits";
     }
-    char* msg = new char[msglen];
+}
 
-    // Next, receive string from pipe
-    if (read(fd[READ_END], msg, msglen) != msglen) {
-        throw std::runtime_error("String read from pipe failed.");
+// Analyze every snapshot of the batch source on a work-stealing thread pool
+// Prints one line per snapshot in input order as soon as it and every snapshot before it are done:
+//     file <tab> safe|deadlock|error <tab> sequence or error message <tab> microseconds
+// Batch mode does not fork a child per snapshot, trading the process isolation of single file mode for throughput
+// Each thread reads and checks its snapshots in its own SnapshotArena, reset after every snapshot
+// Reports are shared between the threads in a ResultCache, so a snapshot repeated in the batch is only checked once
+void runBatch(const ProgramOptions& options) {
+    const vector<string> files = collectSnapshotFiles(options.batch_source);
+    vector<BatchResult> results(files.size());
+    ResultCache cache(resultCacheStamp(options.order), RESULT_CACHE_MEMORY_ENTRIES, options.cache_directory);
+    std::mutex resultsMutex;
+    std::condition_variable resultReady;
+
+    const auto batchStart = std::chrono::steady_clock::now();
+    size_t numThreads;
+    {
+        ThreadPool pool(options.threads);
+        numThreads = pool.size();
+
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.submit([&, i] {
+                thread_local SnapshotArena arena;
+                BatchResult result;
+                const auto start = std::chrono::steady_clock::now();
+                try {
+                    const SafetyReport report = solveSnapshotFile(files[i], options, &cache, arena.resource());
+                    result.verdict = report.safe ? "safe" : "deadlock";
+                    result.sequence = report.safe ? vectorToString(report.sequence) : "-";
+                } catch (const std::exception& e) {
+                    result.verdict = "error";
+                    result.sequence = e.what();
+                }
+                arena.reset();
+                result.microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+                result.done = true;
+
+                {
+                    std::lock_guard<std::mutex> lock(resultsMutex);
+                    results[i] = std::move(result);
+                }
+                resultReady.notify_all();
+            });
+        }
+
+        // Print results in input order while later snapshots are still being analyzed
+        for (size_t i = 0; i < files.size(); i++) {
+            std::unique_lock<std::mutex> lock(resultsMutex);
+            resultReady.wait(lock, [&] { return results[i].done; });
+            cout << files[i] << '\t' << results[i].verdict << '\t' << results[i].sequence << '\t'
+                 << static_cast<size_t>(results[i].microseconds) << "us\n";
+        }
     }
 
-    // return C++ string representation of c string
-    string out = string(msg);
-    delete[] msg;
-    return out;
+    const double batchMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batchStart).count();
+    cout << "Analyzed " << files.size() << " snapshots in " << batchMilliseconds << "ms on " << numThreads << " threads";
+    printCacheHits(cache);
+    cout << endl;
 }
 
-// Formats a vector into an ordered list of numbers and returns string
-// Ex: (1, 2, 3, 4, 5)
-string vectorToString (const vector<size_t>& input) {
-    string out = "(";
-    for (auto i = 0; i < input.size(); i++) {
-        out += std::to_string(input[i]);
-        if (i < input.size() - 1) {
-            out += ", ";
+// Analyze every snapshot of the batch source on pre-forked solver processes, printing the same lines as runBatch
+// The parent reads each snapshot and hands it to an idle worker, so no process is started per snapshot while every
+// analysis still runs isolated from the parent. A snapshot whose worker crashes is reported as an error.
+// The parent looks every snapshot up in a ResultCache before handing it out, like checkSnapshotFileCached. Workers only
+// return safe sequences, so only safe reports are added to the cache, a deadlock would be missing its diagnosis.
+void runWorkerBatch(const ProgramOptions& options) {
+    const vector<string> files = collectSnapshotFiles(options.batch_source);
+    vector<BatchResult> results(files.size());
+    vector<std::chrono::steady_clock::time_point> submitted(files.size());
+    ResultCache cache(resultCacheStamp(options.order), RESULT_CACHE_MEMORY_ENTRIES, options.cache_directory);
+    vector<std::pair<SnapshotKey, SnapshotKey>> fileAndMatrixKeys(files.size());
+
+    const auto batchStart = std::chrono::steady_clock::now();
+    SolverWorkerPool pool(options.processes, options.transport, options.engine, options.order);
+
+    size_t nextFile = 0;
+    size_t nextPrint = 0;
+    SolverResult solved;
+    while (nextPrint < files.size()) {
+        // Keep every worker busy
+        while (nextFile < files.size() && pool.hasIdleWorker()) {
+            const size_t i = nextFile++;
+            submitted[i] = std::chrono::steady_clock::now();
+            try {
+                auto& [fileKey, matrixKey] = fileAndMatrixKeys[i];
+                std::optional<SafetyReport> cached = cache.find(fileKey = hashSnapshotBytes(MappedFile(files[i]).text(), cache.stamp()));
+                if (!cached) {
+                    withSnapshotFile(files[i], [&](std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+                        matrixKey = hashSnapshotMatrices(availableVector, maxMatrix, allocationMatrix, cache.stamp());
+                        cached = cache.find(matrixKey);
+                        if (!cached) {
+                            pool.submit(i, availableVector, maxMatrix, allocationMatrix);
+                        }
+                    });
+                }
+                if (cached) {
+                    results[i].verdict = cached->safe ? "safe" : "deadlock";
+                    results[i].sequence = cached->safe ? vectorToString(cached->sequence) : "-";
+                    results[i].microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - submitted[i]).count();
+                    results[i].done = true;
+                }
+            } catch (const std::exception& e) {
+                results[i].verdict = "error";
+                results[i].sequence = e.what();
+                results[i].microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - submitted[i]).count();
+                results[i].done = true;
+            }
+        }
+
+        // Print results in input order while later snapshots are still being analyzed
+        while (nextPrint < files.size() && results[nextPrint].done) {
+            cout << files[nextPrint] << '\t' << results[nextPrint].verdict << '\t' << results[nextPrint].sequence << '\t'
+                 << static_cast<size_t>(results[nextPrint].microseconds) << "us\n";
+            nextPrint++;
+        }
+
+        if (pool.inFlight() > 0) {
+            pool.nextResult(solved);
+            BatchResult& result = results[solved.requestId];
+            result.microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - submitted[solved.requestId]).count();
+            switch (solved.status) {
+                case SolverStatus::SAFE: {
+                    result.verdict = "safe";
+                    result.sequence = vectorToString(solved.safeSequence);
+                    const SafetyReport report{true, solved.safeSequence, {}, {}};
+                    cache.insert(fileAndMatrixKeys[solved.requestId].first, report);
+                    cache.insert(fileAndMatrixKeys[solved.requestId].second, report);
+                    break;
+                }
+                case SolverStatus::DEADLOCK:
+                    result.verdict = "deadlock";
+                    result.sequence = "-";
+                    break;
+                case SolverStatus::ERROR:
+                    result.verdict = "error";
+                    result.sequence = solved.message;
+                    break;
+            }
+            result.done = true;
         }
     }
-    out += ")";
 
-    return out;
+    const double batchMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batchStart).count();
+    cout << "Analyzed " << files.size() << " snapshots in " << batchMilliseconds << "ms on " << pool.size() << " worker processes";
+    if (pool.restarts() > 0) {
+        cout << ", " << pool.restarts() << " restarted after crashing";
+    }
+    printCacheHits(cache);
+    cout << endl;
 }
 
 int main(int argc, char *argv[])
 {
     const string default_file_name = "sample.txt";
+    ProgramOptions options = parseArguments(argc, argv);
     string file_name;
 
+    if (!options.batch_source.empty()) {
+        if (options.processes > 0) {
+            runWorkerBatch(options);
+        } else {
+            runBatch(options);
+        }
+        if (options.stats) {
+            printStats();
+        }
+        return 0;
+    }
+
+    if (!options.serve_socket.empty()) {
+        BankerServer server(options.serve_socket, options.threads);
+        cout << "Serving on " << options.serve_socket << endl;
+        server.run();
+        cout << "Server stopped" << endl;
+        if (options.stats) {
+            printStats();
+        }
+        return 0;
+    }
+
+    if (!options.convert_output.empty()) {
+        convertSnapshot(options.file_name.empty() ? default_file_name : options.file_name, options.convert_output, options.convert_sparse);
+        return 0;
+    }
+
+    if (options.decompose) {
+        checkDecomposed(options.file_name.empty() ? default_file_name : options.file_name, options);
+        if (options.stats) {
+            printStats();
+        }
+        return 0;
+    }
+
+    if (options.max_request) {
+        printMaximumRequests(options.file_name.empty() ? default_file_name : options.file_name, options);
+        if (options.stats) {
+            printStats();
+        }
+        return 0;
+    }
+
+    if (options.simulate) {
+        runSimulation(options.file_name.empty() ? default_file_name : options.file_name, options);
+        if (options.stats) {
+            printStats();
+        }
+        return 0;
+    }
+
+    if (options.count_sequences || options.list_sequences) {
+        enumerateSequences(options.file_name.empty() ? default_file_name : options.file_name, options);
+        if (options.stats) {
+            printStats();
+        }
+        return 0;
+    }
+
     // Extract file name from executable arguments
     // If there are none, use the default file name
-    if (argc < 2) {
+    if (options.file_name.empty()) {
         file_name = default_file_name;
         cout << "No file name arguments given, defaulting to " << file_name << endl;
     } else {
-        file_name = argv[1];
+        file_name = options.file_name;
         cout << file_name << " has been loaded and will be analyzed" << endl;
     }
+
+    // A file whose bytes were checked by an earlier run is neither parsed nor handed to a child
+    std::optional<ResultCache> cache;
+    SnapshotKey fileKey;
+    if (!options.cache_directory.empty()) {
+        cache.emplace(resultCacheStamp(options.order), RESULT_CACHE_MEMORY_ENTRIES, options.cache_directory);
+        fileKey = hashSnapshotBytes(MappedFile(file_name).text(), cache->stamp());
+        if (const auto cached = cache->find(fileKey)) {
+            cout << "Found in the result cache, " << fileKey.hex() << endl;
+            printReceivedReport(*cached);
+            if (options.stats) {
+                printStats();
+            }
+            return 0;
+        }
+    }
     
     // Set up two pipes, one for child to parent and one for parent to child
     int childToParentFD[2], parentToChildFD[2];
     if (pipe(childToParentFD) == -1 || pipe(parentToChildFD) == -1) {
         throw std::runtime_error("Pipe Creation Failed");
     }
+    SnapshotTransport transport(options.transport);
 
     // Fork program
     pid_t cpid;
@@ -281,19 +867,33 @@ int main(int argc, char *argv[])
         close(parentToChildFD[WRITE_END]);      // close unused write end
         
         if (ENABLE_FORKING) {
-            // Create a ProgramSnapshotReader object to accept piped data from parent process
-            ProgramSnapshotReader reader;
-            receiveObjectOverPipe(parentToChildFD, reader);
-
-            // Initialize BankerAlgorithm Object and perform Banker's Algorithm
-            BankerAlgorithm bankers(reader.getAvailableResources(), reader.getMaximumMatrix(), reader.getAllocationMatrix());
-            auto safeSequence = bankers.findSafeSequence();
+            // Receive the snapshot piped from parent process, preceded by its layout
+            SnapshotLayout layout;
+            readFull(parentToChildFD[READ_END], &layout, sizeof(layout), "Snapshot layout");
+            if (layout == SnapshotLayout::CACHED) {
+                close(childToParentFD[WRITE_END]);
+                close(parentToChildFD[READ_END]);
+                return 0;
+            }
 
-            // Send safe sequence to Parent as a string or notify that there is a deadlock
-            if (safeSequence.empty()) {
-                sendStringOverPipe(childToParentFD, "Oops! Looks like we're stuck in a deadlock!");
+            // Perform Banker's Algorithm with the sparse engine, the fixed solver of the snapshot's shape, or the narrowest
+            // count type that fits the snapshot, depending on its shape and density
+            SafetyReport report;
+            if (layout == SnapshotLayout::SPARSE) {
+                const SparseSnapshot snapshot = receiveSparseSnapshotOverPipe(parentToChildFD);
+                report = checkSafetyAuto(snapshot, options.engine, options.order);
             } else {
-                sendStringOverPipe(childToParentFD, vectorToString(safeSequence));
+                ReceivedSnapshot snapshot;
+                transport.receive(parentToChildFD, snapshot);
+                report = checkDenseSnapshot(snapshot.getAvailableResources(), snapshot.getMaximumMatrix(), snapshot.getAllocationMatrix(), options);
+            }
+
+            // Send the safe sequence to Parent, or the diagnosis of the deadlock
+            sendSafetyReportOverPipe(childToParentFD, report);
+
+            // Send this process's counters after the result, the parent only reads them when they were asked for
+            if (options.stats) {
+                sendStatsOverPipe(childToParentFD, Stats::process().report());
             }
         }
 
@@ -312,29 +912,70 @@ int main(int argc, char *argv[])
         close(parentToChildFD[READ_END]);       // close unused read end
 
         if (ENABLE_FORKING) {
-            // Create a Program Snapshot Reader Object and send to Child over pipe
-            ProgramSnapshotReader reader(file_name);
-            sendObjectOverPipe(parentToChildFD, reader);
+            // Read the Program Snapshot and send it to Child over pipe
+            // Sparse snapshots are sent in their compressed rows instead of with the transport, which moves dense matrices
+            // Dense snapshots are looked up in the result cache by their matrices first, and not sent if found
+            std::optional<SafetyReport> cached;
+            SnapshotKey matrixKey;
+            const MappedFile file(file_name);
+            const SnapshotLayout layout = isSparseSnapshotContents(file.text()) ? SnapshotLayout::SPARSE : SnapshotLayout::DENSE;
+            if (layout == SnapshotLayout::SPARSE) {
+                writeFull(parentToChildFD[WRITE_END], &layout, sizeof(layout), "Snapshot layout");
+                sendSparseSnapshotOverPipe(parentToChildFD, SparseSnapshotReader(file.text(), file_name).getSnapshot());
+            } else {
+                withSnapshotFile(file, file_name, [&](std::span<const size_t> availableVector, ResourceMatrixView maxMatrix, ResourceMatrixView allocationMatrix) {
+                    if (cache) {
+                        matrixKey = hashSnapshotMatrices(availableVector, maxMatrix, allocationMatrix, cache->stamp());
+                        cached = cache->find(matrixKey);
+                    }
+                    const SnapshotLayout sent = cached ? SnapshotLayout::CACHED : layout;
+                    writeFull(parentToChildFD[WRITE_END], &sent, sizeof(sent), "Snapshot layout");
+                    if (!cached) {
+                        transport.send(parentToChildFD, availableVector, maxMatrix, allocationMatrix);
+                    }
+                });
+            }
 
-            // Receive Child's safe sequence or string message
-            string message = receiveStringOverPipe(childToParentFD);
+            // Receive Child's safe sequence or deadlock diagnosis, unless it was in the cache
+            SafetyReport report;
+            StatsReport childStats;
+            if (cached) {
+                report = std::move(*cached);
+                cout << "Found in the result cache, " << matrixKey.hex() << endl;
+            } else {
+                report = receiveSafetyReportOverPipe(childToParentFD);
+                if (options.stats) {
+                    childStats = receiveStatsOverPipe(childToParentFD);
+                }
+                if (cache && layout == SnapshotLayout::DENSE) {
+                    cache->insert(matrixKey, report);
+                }
+            }
+            if (cache) {
+                cache->insert(fileKey, report);
+            }
 
             // Close read and write ends after Parent is finished using them
             close(parentToChildFD[WRITE_END]);
             close(childToParentFD[READ_END]);
 
-            // Print string received by Parent from Child
-            cout << "Parent Process Received: " << message << endl;
+            // Print what Parent received from Child
+            printReceivedReport(report);
+            if (options.stats) {
+                printStats(cached ? nullptr : &childStats);
+            }
         } else {
             // If Forking is disabled, perform Banker's Algorithm in Parent Process
-            ProgramSnapshotReader reader(file_name);
-            BankerAlgorithm bankers(reader.getAvailableResources(), reader.getMaximumMatrix(), reader.getAllocationMatrix());
-            auto safeSequence = bankers.findSafeSequence();
+            const SafetyReport report = cache ? checkSnapshotFileCached(file_name, options, *cache) : checkSnapshotFile(file_name, options);
             cout << "Threading Disabled, Parent performing Banker's Algorithm" << endl;
-            if (safeSequence.empty()) {
+            if (!report.safe) {
                 cout << "Oops! Looks like we're stuck in a deadlock!" << endl;
+                printDeadlockDiagnosis(report);
             } else {
-                cout << "Parent Process found safe sequence: " << vectorToString(safeSequence) << endl;
+                cout << "Parent Process found safe sequence: " << vectorToString(report.sequence) << endl;
+            }
+            if (options.stats) {
+                printStats();
             }
         }
 